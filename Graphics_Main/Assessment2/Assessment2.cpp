@@ -13,12 +13,25 @@
 #include "camera.h"
 #include "plane.h"
 #include "object_parser.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_lod.h"
+#include "asset_stream.h"
+#include "bindless.h"
+#include "frame_uniforms.h"
+#include "render_queue.h"
+#include "shader_variants.h"
+#include "occlusion.h"
+#include "obj_parallel.h"
 #include "shadow.h"
 #include "cylinder.h"
 #include "casteljau.h"
 #include "interactivity.h"
 #include "tangent.h"
 
+// Set to 1 to print loader benchmarks at startup
+#define RUN_BENCHMARKS 0
+
 // Screen dimensions
 unsigned int width = 1000;
 unsigned int height = 800;
@@ -74,21 +87,42 @@ glm::vec3 posLightColour = glm::vec3(0.f, 0.5f, 0.f);
 #define SH_MAP_WIDTH 2048
 #define SH_MAP_HEIGHT 2048
 
-// Arrays storing vertex data for loaded objects
-std::vector<GLfloat> ship_array;
+// Arrays storing vertex data for generated objects
 std::vector<GLfloat> cylinder;
-std::vector<GLfloat> jet_array;
-std::vector<GLfloat> desert_dunes;
 std::vector<GLfloat> shooting_star;
-std::vector<GLfloat> rock_array;
-std::vector<GLfloat> vase_array;
+
+// Indexed vertex data for loaded objects and the pyramid
+indexed_mesh pyramid_mesh;
+indexed_mesh dunes_mesh;
+indexed_mesh ship_mesh;
+indexed_mesh jet_mesh;
+indexed_mesh rock_mesh;
+indexed_mesh vase_mesh;
 
 // Textures for objects
-GLuint brick_tex, sand_tex, ship_tex, ship_glow, ship_normal, ship_specular, ship_bump, jet_tex, skybox_tex, rocks_tex, rocks_normal, rocks_depth, rocks_rough, rocks_metal, rocks_ao, vase_tex, vase_normal, vase_metalic, vase_rough, vase_ao;
+GLuint brick_tex, sand_tex, ship_tex, ship_glow, ship_normal, ship_specular, ship_bump, jet_tex, skybox_tex;
+// Sand, jet and UFO textures, bindless when the driver supports it
+texture_table object_textures;
+int sand_textures, jet_textures, ufo_textures;
+// PBR materials, layers of one set of texture arrays
+material_set pbr_materials;
+int rocks_material, vase_material;
+// Draws of the scene, collected and sorted every frame
+render_queue scene_queue;
+// Hides the opaque items of the queue that the rest of the scene covers
+occlusion_culler scene_occlusion;
+// Geometry and lighting shader settings of each object in the queue
+int pyramid_geometry, ufo_geometry, dunes_geometry, jet_geometry, rocks_geometry, vase_geometry;
+int beam_geometry, red_geometry, green_geometry, blue_geometry;
+int dunes_shading, jet_shading, ufo_shading, pyramid_shading, rocks_shading, vase_shading, beam_shading, square_shading;
+// Lighting programs specialized for the features of each render material
+shader_variants lighting_variants;
 
 // Global Projection and View Matrices
 glm::mat4 projection;
 glm::mat4 view;
+// Uniform buffers holding the camera and lights for every program
+frame_uniforms scene_uniforms;
 
 // Determine if the UFO has been clicked
 bool is_clicked = false;
@@ -101,9 +135,13 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-// Number of VAO and VBOs to create and use
-#define NUM_VBO 13
-#define NUM_VAO 13
+// Vertex and index buffers of every object the lighting shader draws, one arena per vertex format
+geometry_arena packed_arena;
+geometry_arena float_arena;
+
+// Shooting star and skybox, drawn with their own shaders outside the arenas
+#define NUM_VBO 2
+#define NUM_VAO 2
 GLuint VAOs[NUM_VAO];
 GLuint VBOs[NUM_VBO];
 
@@ -412,167 +450,110 @@ void mouse_move_callback(GLFWwindow* window, double xpos, double ypos)
 	}
 }
 
+// Upload vertices in the float layout to the float arena and register them with the scene queue
+int add_float_geometry(const std::vector<GLfloat>& vertices) {
+	uint32_t num_vertices = (uint32_t)(vertices.size() / FLOAT_VERTEX_FLOATS);
+	std::vector<uint32_t> indices(num_vertices);
+	for (uint32_t i = 0; i < num_vertices; i++) {
+		indices[i] = i;
+	}
+	arena_range range = add_arena_geometry(float_arena, vertices.data(), num_vertices, indices.data(), num_vertices);
+	bounding_volume bounds = vertex_bounding_volume(vertices.data(), num_vertices, FLOAT_VERTEX_FLOATS);
+	return add_arena_range_geometry(scene_queue, float_arena, range, num_vertices, bounds);
+}
+
+// Squares store position, colour and normal, give them empty texture coordinates to fit the float layout
+int add_square_geometry(const GLfloat* square, size_t num_floats) {
+	std::vector<GLfloat> vertices;
+	for (size_t i = 0; i + 10 <= num_floats; i += 10) {
+		vertices.insert(vertices.end(), square + i, square + i + 7);
+		vertices.push_back(0.f);
+		vertices.push_back(0.f);
+		vertices.insert(vertices.end(), square + i + 7, square + i + 10);
+	}
+	return add_float_geometry(vertices);
+}
+
 void initialise_buffers() {
+	// Every object lit by the lighting shader shares one of two arenas, the streamed meshes are added as they load
+	init_geometry_arena(packed_arena, "packed", sizeof(packed_vertex), setup_packed_vertex_attributes);
+	init_geometry_arena(float_arena, "float", FLOAT_VERTEX_FLOATS * sizeof(float), setup_float_vertex_attributes);
 	// Generate number of VAOs
 	glGenVertexArrays(NUM_VAO, VAOs);
-
-	// ---------- PYRAMID ----------
-	// Bind buffers
-	glBindVertexArray(VAOs[0]);
 	glCreateBuffers(NUM_VBO, VBOs);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
 
+	// ---------- PYRAMID ----------
 	// Generate the tangent and bitangent vectors for pyramid to use in Parrallax Mapping
 	std::vector<GLfloat> finalVertexData;
 	// Work out number of triangles in the shape
 	size_t numVertices = sizeof(double_pyramid_vertices) / sizeof(GLfloat) / floatsPerInputVertex;
 	generateTangentsAndBitangents(double_pyramid_vertices, numVertices, finalVertexData);
 
-	// Store vertices in VBO
-	glBufferData(GL_ARRAY_BUFFER, finalVertexData.size() * sizeof(GLfloat), finalVertexData.data(), GL_STATIC_DRAW);
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// Colour attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	// Texture attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	// Normal attribute
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(8 * sizeof(float)));
-	glEnableVertexAttribArray(3);
-	// Tangent attribute 
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(11 * sizeof(float)));
-	glEnableVertexAttribArray(4);
-	// Bitangent attribute
-	glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(14 * sizeof(float)));
-	glEnableVertexAttribArray(5);
+	// Every corner is its own vertex, pack them like the loaded objects
+	pyramid_mesh.vertices.swap(finalVertexData);
+	pyramid_mesh.floats_per_vertex = floatsPerOutputVertex;
+	for (uint32_t i = 0; i < numVertices; i++) {
+		pyramid_mesh.indices.push_back(i);
+	}
+	pyramid_mesh.num_indices = (uint32_t)numVertices;
+	optimize_indexed_mesh(&pyramid_mesh, "Pyramid");
+	compute_mesh_bounds(&pyramid_mesh);
+	pack_indexed_mesh(&pyramid_mesh);
+
+	// Store vertices in the packed arena
+	upload_packed_mesh(packed_arena, pyramid_mesh);
+	pyramid_geometry = add_mesh_geometry(scene_queue, packed_arena, pyramid_mesh);
 
 
 	//  ---------- UFO ----------
-	// Configure VAO 2 (UFO)
-	glBindVertexArray(VAOs[2]);
-	// Bind VBO 2 
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[2]);
-	// Load object
-	std::vector<triangle> triangles;
 	// Specify the base folder path
 	std::string obj_path = "objs/ufo/Low_poly_UFO.obj";
 	std::string base_path = "objs/ufo";
-	int num_triangles = obj_parse(obj_path.c_str(), &triangles, base_path.c_str());
-	// Convert to array of floats
-	ship_array = tri_to_fl_array(triangles, true);
-	// Upload the vertex data to the VBO
-	glBufferData(GL_ARRAY_BUFFER, ship_array.size() * sizeof(GLfloat), ship_array.data(), GL_STATIC_DRAW);
-
-	// Set up vertex attributes
-	// Position attribute 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-
-	// Colour attribute 
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	// Texture attribute 
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
-	// Normal attribute 
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(8 * sizeof(float)));
-	glEnableVertexAttribArray(3);
-
-	// Tangent attribute 
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(11 * sizeof(float)));
-	glEnableVertexAttribArray(4);
-
-	// Bitangent attribute 
-	glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(14 * sizeof(float)));
-	glEnableVertexAttribArray(5);
+	// Stream object into the packed arena, from the mesh cache when it is up to date
+	stream_obj_mesh(&ship_mesh, obj_path.c_str(), base_path.c_str(), true, packed_arena);
+	ufo_geometry = add_mesh_geometry(scene_queue, packed_arena, ship_mesh);
 
 
 	// ---- FLAT PLANE ----
-	glBindVertexArray(VAOs[3]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[3]);
-
 	// Number of Squares, Width of each square
-	desert_dunes = generate_plane(64, 30.f, glm::vec3(1.f, 0.f, 0.f));
-	// Generate the vertices for the plane.
-	glBufferData(GL_ARRAY_BUFFER, desert_dunes.size() * sizeof(GLfloat), desert_dunes.data(), GL_STATIC_DRAW);
-	// Position Attribute for the plane
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// Colour Attribute for the plane
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	// Texture attribute for plane.
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	// Normal attribute for plane.
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(8 * sizeof(float)));
-	glEnableVertexAttribArray(3);
+	std::vector<GLfloat> desert_dunes = generate_plane(64, 30.f, glm::vec3(1.f, 0.f, 0.f));
+	// Packed like the pyramid so the plane is drawn with the other opaque objects
+	size_t numDuneVertices = desert_dunes.size() / floatsPerInputVertex;
+	dunes_mesh.vertices.swap(desert_dunes);
+	dunes_mesh.floats_per_vertex = floatsPerInputVertex;
+	for (uint32_t i = 0; i < numDuneVertices; i++) {
+		dunes_mesh.indices.push_back(i);
+	}
+	dunes_mesh.num_indices = (uint32_t)numDuneVertices;
+	optimize_indexed_mesh(&dunes_mesh, "Dunes");
+	compute_mesh_bounds(&dunes_mesh);
+	pack_indexed_mesh(&dunes_mesh);
+	upload_packed_mesh(packed_arena, dunes_mesh);
+	dunes_geometry = add_mesh_geometry(scene_queue, packed_arena, dunes_mesh);
 
 
 	// ---- CYLINDER ----
 	int num_cylinder_vertices = 0;
 	// Num Faces, Top Radius, Bottom Radius, Height, Opacity, Store num vertices
 	cylinder = form_cylinder(64, 0.3f, 1.8f, 2.2f, 0.3f, num_cylinder_vertices);
-
-	glBindVertexArray(VAOs[4]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[4]);
-	glBufferData(GL_ARRAY_BUFFER, cylinder.size() * sizeof(GLfloat), cylinder.data(), GL_STATIC_DRAW);
-
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 12 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// Colour attribute & Transparency using Alpha val
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 12 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	// Texture attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 12 * sizeof(float), (void*)(7 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	// Normal attribute
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 12 * sizeof(float), (void*)(9 * sizeof(float)));
-	glEnableVertexAttribArray(3);
+	// Position, colour with alpha, texture and normal, the same layout as the float arena
+	beam_geometry = add_float_geometry(cylinder);
 
 
 	//  ---------- JET PLANE ----------
-	// Configure VAO 5 
-	glBindVertexArray(VAOs[5]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[5]);
-
-
-	// Load object
-	std::vector<triangle> jet_triangles;
 	// Specify the base folder path
 	obj_path = "objs/jet/Rafale.obj";
 	base_path = "objs/jet";
-	num_triangles = obj_parse(obj_path.c_str(), &jet_triangles, base_path.c_str());
-
-	// Convert to array of floats
-	jet_array = tri_to_fl_array(jet_triangles, false);
-	// Upload the vertex data to the VBO
-	glBufferData(GL_ARRAY_BUFFER, jet_array.size() * sizeof(GLfloat), jet_array.data(), GL_STATIC_DRAW);
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// Colour attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	// Texture attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	// Normal attribute
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(8 * sizeof(float)));
-	glEnableVertexAttribArray(3);
+	// Stream object into the packed arena
+	stream_obj_mesh(&jet_mesh, obj_path.c_str(), base_path.c_str(), false, packed_arena);
+	jet_geometry = add_mesh_geometry(scene_queue, packed_arena, jet_mesh);
 
 
 
 	// ---- SHOOTING STARS ----
-	// Configure VAO 6
-	glBindVertexArray(VAOs[6]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[6]);
+	// Configure VAO 0
+	glBindVertexArray(VAOs[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
 
 	// Define initial control points
 	std::vector<point> ctrl_points = {
@@ -606,8 +587,8 @@ void initialise_buffers() {
 
 
 	// ---- SKYBOX ----
-	glBindVertexArray(VAOs[7]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[7]);
+	glBindVertexArray(VAOs[1]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBOs[1]);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices) * sizeof(GLfloat), cube_vertices, GL_STATIC_DRAW);
 	// Position attribute (Dobules as texture coordinates for cube map)
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
@@ -615,133 +596,94 @@ void initialise_buffers() {
 
 
 	// ---- ROCKS ----
-	// Configure VAO 7 
-	glBindVertexArray(VAOs[8]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[8]);
-
-	// Load object
-	std::vector<triangle> rock_triangles;
 	// Specify the base folder path
 	obj_path = "objs/egypt/source/test.obj";
 	base_path = "objs/egypt/source";
-	num_triangles = obj_parse(obj_path.c_str(), &rock_triangles, base_path.c_str());
-
-	// Convert to array of floats
-	rock_array = tri_to_fl_array(rock_triangles, true);
-	// Upload the vertex data to the VBO
-	glBufferData(GL_ARRAY_BUFFER, rock_array.size() * sizeof(GLfloat), rock_array.data(), GL_STATIC_DRAW);
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// Colour attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	// Texture attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	// Normal attribute
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(8 * sizeof(float)));
-	glEnableVertexAttribArray(3);
-	// Tangent attribute 
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(11 * sizeof(float)));
-	glEnableVertexAttribArray(4);
-	// Bitangent attribute 
-	glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(14 * sizeof(float)));
-	glEnableVertexAttribArray(5);
+	// Stream object into the packed arena
+	stream_obj_mesh(&rock_mesh, obj_path.c_str(), base_path.c_str(), true, packed_arena);
+	rocks_geometry = add_mesh_geometry(scene_queue, packed_arena, rock_mesh);
 
 
 	// ---- VASE ----
-	// Configure VAO 9
-	glBindVertexArray(VAOs[9]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[9]);
-
-	// Load object
-	std::vector<triangle> vase_triangles;
 	// Specify the base folder path
 	obj_path = "objs/vase/Flowervase.obj";
 	base_path = "objs/vase/";
-	num_triangles = obj_parse(obj_path.c_str(), &vase_triangles, base_path.c_str());
-
-	// Convert to array of floats
-	vase_array = tri_to_fl_array(vase_triangles, true);
-	// Upload the vertex data to the VBO
-	glBufferData(GL_ARRAY_BUFFER, vase_array.size() * sizeof(GLfloat), vase_array.data(), GL_STATIC_DRAW);
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// Colour attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	// Texture attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	// Normal attribute
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(8 * sizeof(float)));
-	glEnableVertexAttribArray(3);
-	// Tangent attribute 
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(11 * sizeof(float)));
-	glEnableVertexAttribArray(4);
-	// Bitangent attribute 
-	glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, 17 * sizeof(float), (void*)(14 * sizeof(float)));
-	glEnableVertexAttribArray(5);
-
-	// ---- RED SQUARE ----
-	glBindVertexArray(VAOs[10]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[10]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(redSquare), redSquare, GL_STATIC_DRAW);
-
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
+	// Stream object into the packed arena
+	stream_obj_mesh(&vase_mesh, obj_path.c_str(), base_path.c_str(), true, packed_arena);
+	vase_geometry = add_mesh_geometry(scene_queue, packed_arena, vase_mesh);
 
-	// Color attribute
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	// Normal attribute
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(7 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
-
-	// ---- GREEN SQUARE ----
-	glBindVertexArray(VAOs[11]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[11]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(greenSquare), greenSquare, GL_STATIC_DRAW);
+	// ---- SQUARES ----
+	red_geometry = add_square_geometry(redSquare, sizeof(redSquare) / sizeof(GLfloat));
+	green_geometry = add_square_geometry(greenSquare, sizeof(greenSquare) / sizeof(GLfloat));
+	blue_geometry = add_square_geometry(blueSquare, sizeof(blueSquare) / sizeof(GLfloat));
 
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
 
-	// Color attribute
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	// Unbind buffers and VAO
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
 
-	// Normal attribute
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(7 * sizeof(float)));
-	glEnableVertexAttribArray(2);
+// Model matrix of the UFO while it hovers over the pyramid
+glm::mat4 ufo_hover_model(float time) {
+	glm::mat4 modelUFO = glm::mat4(1.0f);
+	modelUFO = glm::translate(modelUFO, glm::vec3(0.f, 1.5f, 0.f));
+	modelUFO = glm::rotate(modelUFO, time / 20, glm::vec3(0.f, 1.f, 0.f));
+	modelUFO = glm::scale(modelUFO, glm::vec3(0.06f, 0.06f, 0.06f));
+	return modelUFO;
+}
 
+// Model matrix of the jet on its circular path
+glm::mat4 jet_model(float time) {
+	// Use time as an angle for the circular motion.
+	float angle = time / 2;
+	// Radius around the central point that the plane will travel
+	float radius = 45.0f;
+	// Position on the path of the circle
+	float x = radius * cos(angle);
+	float z = radius * sin(angle);
+	float y = 30.0f;
 
-	// ---- BLUE SQUARE ----
-	glBindVertexArray(VAOs[12]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[12]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(blueSquare), blueSquare, GL_STATIC_DRAW);
+	glm::mat4 modelJet = glm::mat4(1.0f);
+	modelJet = glm::scale(modelJet, glm::vec3(0.08f, 0.08f, 0.08f));
+	// Move to the side of the UFO, initial position
+	modelJet = glm::translate(modelJet, glm::vec3(x, y, z));
 
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
+	// Rotate to be perpendicular to tangent of path.
+	modelJet = glm::rotate(modelJet, -angle, glm::vec3(0.f, 1.f, 0.f));
+	// Bank the plane towards the center of the target.
+	modelJet = glm::rotate(modelJet, glm::radians(25.0f), glm::vec3(0.f, 0.f, 1.f));
+	return modelJet;
+}
 
-	// Color attribute
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+glm::mat4 rocks_model() {
+	glm::mat4 model = glm::mat4(1.0f);
+	model = glm::translate(model, glm::vec3(3.f, 1.1f, 4.f));
+	model = glm::rotate(model, glm::radians(-140.f), glm::vec3(0.f, 1.f, 0.f));
+	model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
+	return model;
+}
 
-	// Normal attribute
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(7 * sizeof(float)));
-	glEnableVertexAttribArray(2);
+glm::mat4 vase_model() {
+	glm::mat4 model = glm::mat4(1.0f);
+	model = glm::translate(model, glm::vec3(3.f, 0.8f, 4.f));
+	model = glm::rotate(model, glm::radians(-140.f), glm::vec3(0.f, 1.f, 0.f));
+	model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
+	return model;
+}
 
+// Level of detail of a mesh as seen from the active camera
+// The shadow pass uses it too, so shadows match the geometry on screen
+int active_lod(const indexed_mesh& mesh, const glm::mat4& model) {
+	return select_mesh_lod(mesh, model, activeCamera->Position, fov, (float)height);
+}
 
-	// Unbind buffers and VAO
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+// Tell the texture streamer how large a mesh's textures are drawn from the active camera
+void request_mesh_texture_detail(const indexed_mesh& mesh, const glm::mat4& model, int textures) {
+	float size = 2.f * mesh.bounds_radius * mesh_pixels_per_unit(mesh, model, activeCamera->Position, fov, (float)height);
+	for (GLuint* texture : object_textures.materials[textures].textures) {
+		if (texture)
+			request_texture_detail(*texture, size);
+	}
 }
 
 void initialise_cameras() {
@@ -776,6 +718,25 @@ void initialise_cameras() {
 	MoveAndOrientCamera(Fixed_Rotate_Camera, glm::vec3(0.f, 0.f, 0.f), cam_dist, -15.f, -20.f);
 }
 
+// Triangles the LODs save from each camera, with the scene in its starting pose
+// Called once the meshes have streamed in
+void report_camera_lods() {
+	const char* lod_names[] = { "UFO", "Jet", "Rocks", "Vase" };
+	const indexed_mesh* lod_meshes[] = { &ship_mesh, &jet_mesh, &rock_mesh, &vase_mesh };
+	glm::mat4 lod_models[] = { ufo_hover_model(0.f), jet_model(0.f), rocks_model(), vase_model() };
+	for (int c = 0; c < num_cameras; c++) {
+		uint32_t full = 0, drawn = 0;
+		printf("Camera %d LODs:", c);
+		for (int m = 0; m < 4; m++) {
+			int lod = select_mesh_lod(*lod_meshes[m], lod_models[m], cameras[c]->Position, fov, (float)height);
+			full += mesh_lod_triangles(*lod_meshes[m], 0);
+			drawn += mesh_lod_triangles(*lod_meshes[m], lod);
+			printf(" %s %d", lod_names[m], lod);
+		}
+		printf(", %u of %u triangles drawn, %u saved\n", drawn, full, full - drawn);
+	}
+}
+
 float random_range(float min, float max) {
 	// Generate a random float between min and max
 	return min + static_cast<float>(rand()) / (static_cast<float>(RAND_MAX / (max - min)));
@@ -795,29 +756,26 @@ void update_shooting_star_path() {
 	shooting_star = MakeFloatsFromVector(points, 1.f, 1.f, 0.f);
 
 	// Update VBO
-	glBindBuffer(GL_ARRAY_BUFFER, VBOs[6]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
 	glBufferData(GL_ARRAY_BUFFER, shooting_star.size() * sizeof(GLfloat), shooting_star.data(), GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void draw_star(unsigned int program) {
+	// Skip the star until its program has built instead of waiting for it
+	if (!ProgramReady(program))
+		return;
 	glUseProgram(program);
 
-	glm::mat4 view = glm::lookAt(activeCamera->Position, activeCamera->Position + activeCamera->Front, activeCamera->Up);
-	glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-
-	glm::mat4 projection = glm::perspective(glm::radians(45.f), (float)width / (float)height, .01f, 100.f);
-	glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
 	glm::mat4 model = glm::mat4(1.0f);
 	model = glm::translate(model, glm::vec3(0.f, 8.f, 0.f));
 	model = glm::rotate(model, glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f));
 	model = glm::scale(model, glm::vec3(1.f, 1.f, 1.f));
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	set_uniform(program, "model", model);
 
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	glLineWidth(3.0f);
-	glBindVertexArray(VAOs[6]);
+	glBindVertexArray(VAOs[0]);
 
 	static float t = 0.0f;
 	const float speed = 0.5f;
@@ -842,8 +800,8 @@ void draw_star(unsigned int program) {
 	}
 }
 
-void draw_beam(unsigned int program) {
-	glBindVertexArray(VAOs[4]);
+// Model matrix of the beam under the UFO, shrinking away once the UFO is clicked
+glm::mat4 beam_model() {
 	glm::mat4 modelCylinder = glm::mat4(1.0f);
 	if (!is_clicked) {
 		// Apply transformations
@@ -891,23 +849,16 @@ void draw_beam(unsigned int program) {
 		}
 	}
 
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(modelCylinder));
-
-	int num_object_vertices = cylinder.size() / 11;
-	// Draw cylinder
-	glDrawArrays(GL_TRIANGLES, 0, num_object_vertices);
+	return modelCylinder;
 }
 
-void draw_ufo(unsigned int program) {
-	// Bind the VAO
-	glBindVertexArray(VAOs[2]);
+// Model matrix of the UFO, hovering or flying off once clicked
+glm::mat4 ufo_model() {
 	glm::mat4 modelUFO = glm::mat4(1.0f);
 	// If UFO not clicked
 	if (!is_clicked) {
 		// Apply transformations to the UFO
-		modelUFO = glm::translate(modelUFO, glm::vec3(0.f, 1.5f, 0.f));
-		modelUFO = glm::rotate(modelUFO, (float)glfwGetTime() / 20, glm::vec3(0.f, 1.f, 0.f));
-		modelUFO = glm::scale(modelUFO, glm::vec3(0.06f, 0.06f, 0.06f));
+		modelUFO = ufo_hover_model((float)glfwGetTime());
 	}
 	else {
 		if (ufo_animation) {
@@ -943,66 +894,13 @@ void draw_ufo(unsigned int program) {
 		}
 	}
 
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(modelUFO));
-
-
-	int num_object_vertices = ship_array.size() / 11;
-	// Draw the UFO
-	glDrawArrays(GL_TRIANGLES, 0, num_object_vertices);
-
-}
-
-void draw_dunes(unsigned int program) {
-	// Dunes Plane
-	glBindVertexArray(VAOs[3]);
-	glm::mat4 modelDunes = glm::mat4(1.0f);
-	// Move right and forwards and down 
-	modelDunes = glm::translate(modelDunes, glm::vec3(6.f, -0.1f, 1.f));
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(modelDunes));
-	glDrawArrays(GL_TRIANGLES, 0, desert_dunes.size() / 11);
-}
-
-void draw_pyramid(unsigned int program) {
-	// Pyramid
-	glBindVertexArray(VAOs[0]);
-	glm::mat4 modelPyramind = glm::mat4(1.0f);
-	modelPyramind = glm::scale(modelPyramind, glm::vec3(1.f, 1.f, 1.f));
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(modelPyramind));
-	int num_vertices = sizeof(double_pyramid_vertices) / (11 * sizeof(float));
-	glDrawArrays(GL_TRIANGLES, 0, num_vertices);
-}
-
-void draw_jet(unsigned int program) {
-	// Bind the VAO
-	glBindVertexArray(VAOs[5]);
-
-	// Use time as an angle for the circular motion.
-	float angle = glfwGetTime() / 2;
-	// Radius around the central point that the plane will travel
-	float radius = 45.0f;
-	// Position on the path of the circle
-	float x = radius * cos(angle);
-	float z = radius * sin(angle);
-	float y = 30.0f;
-
-	// Apply transformations to the Jet
-	glm::mat4 modelJet = glm::mat4(1.0f);
-	modelJet = glm::scale(modelJet, glm::vec3(0.08f, 0.08f, 0.08f));
-	// Move to the side of the UFO, initial position
-	modelJet = glm::translate(modelJet, glm::vec3(x, y, z));
-
-	// Rotate to be perpendicular to tangent of path.
-	modelJet = glm::rotate(modelJet, -angle, glm::vec3(0.f, 1.f, 0.f));
-	// Bank the plane towards the center of the target.
-	modelJet = glm::rotate(modelJet, glm::radians(25.0f), glm::vec3(0.f, 0.f, 1.f));
-
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(modelJet));
-	int num_object_vertices = jet_array.size() / 11;
-	// Draw the Plane
-	glDrawArrays(GL_TRIANGLES, 0, num_object_vertices);
+	return modelUFO;
 }
 
 void draw_skybox(unsigned int program) {
+	// Clear colour shows until the skybox program has built
+	if (!ProgramReady(program))
+		return;
 	glUseProgram(program);
 
 	// Save current depth function state
@@ -1017,14 +915,8 @@ void draw_skybox(unsigned int program) {
 	// Activate texture unit and bind texture
 	glActiveTexture(GL_TEXTURE10);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_tex);
-	glUniform1i(glGetUniformLocation(program, "skybox"), 10);
-	glBindVertexArray(VAOs[7]);
-
-	// Set view and projection matrices
-	glm::mat4 view = glm::mat4(glm::mat3(GetViewMatrix(*activeCamera)));
-	glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	glm::mat4 projection = glm::perspective(glm::radians(45.f), (float)width / (float)height, .01f, 100.f);
-	glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+	set_uniform(program, "skybox", 10);
+	glBindVertexArray(VAOs[1]);
 
 	// Draw the cube
 	glDrawArrays(GL_TRIANGLES, 0, 36);
@@ -1038,133 +930,166 @@ void draw_skybox(unsigned int program) {
 	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 }
 
-void draw_rocks(unsigned int program) {
-	glBindVertexArray(VAOs[8]);
-	glm::mat4 model = glm::mat4(1.0f);
+// Register the lighting shader settings of every object in the scene queue, the geometry is registered as it is uploaded
+// Call once the texture table and PBR materials have their entries
+void initialise_render_queue() {
+	scene_queue.textures = &object_textures;
 
-	// Apply transformations
-	model = glm::translate(model, glm::vec3(3.f, 1.1f, 4.f));
-	model = glm::rotate(model, glm::radians(-140.f), glm::vec3(0.f, 1.f, 0.f));
-	model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
-
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	// ---- DESERT PLANE ----
+	render_material dunes;
+	dunes.textures = sand_textures;
+	// Reduced shininess for sand
+	dunes.shininess = 32.f;
+	dunes_shading = add_render_material(scene_queue, dunes);
 
+	// ---- JET PLANE ----
+	render_material jet;
+	jet.textures = jet_textures;
+	jet_shading = add_render_material(scene_queue, jet);
 
-	int num_object_vertices = rock_array.size() / 11;
-	// Draw the Rocks
-	glDrawArrays(GL_TRIANGLES, 0, num_object_vertices);
-}
+	// ---- UFO ----
+	// Diffuse, glow, normal, specular and bump maps
+	render_material ufo;
+	ufo.textures = ufo_textures;
+	ufo.uses_glow = true;
+	ufo.uses_normal = true;
+	ufo.uses_specular = true;
+	// Set a scale for the bump map
+	ufo.bump_scale = 30.f;
+	// Ship is more shiny than rest of scene
+	ufo.shininess = 256.f;
+	ufo_shading = add_render_material(scene_queue, ufo);
 
-void draw_vase(unsigned int program) {
-	glBindVertexArray(VAOs[9]);
-	glm::mat4 model = glm::mat4(1.0f);
+	// --- PYRAMID ---
+	render_material pyramid;
+	pyramid.pbr_material = rocks_material;
+	pyramid.uses_normal = true;
+	// Height for parrallax mapping
+	pyramid.uses_parrallax = true;
+	pyramid.height_scale = 0.2f;
+	// Increase texture scale
+	pyramid.uv_scale = 3.0f;
+	pyramid_shading = add_render_material(scene_queue, pyramid);
 
-	// Apply transformations
-	model = glm::translate(model, glm::vec3(3.f, 0.8f, 4.f));
-	model = glm::rotate(model, glm::radians(-140.f), glm::vec3(0.f, 1.f, 0.f));
-	model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
+	// ---- ROCKS ----
+	render_material rocks;
+	rocks.pbr_material = rocks_material;
+	rocks.uses_normal = true;
+	rocks.uses_pbr = true;
+	// Increase texture scale
+	rocks.uv_scale = 25.0f;
+	rocks_shading = add_render_material(scene_queue, rocks);
 
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	// ---- VASE ----
+	// Only the layer differs from the rocks
+	render_material vase = rocks;
+	vase.pbr_material = vase_material;
+	vase.uv_scale = 1.0f;
+	vase_shading = add_render_material(scene_queue, vase);
 
+	// --- CYLINDER ---
+	render_material beam;
+	beam.uses_texture = false;
+	// Very shiny for beam
+	beam.shininess = 512.f;
+	beam_shading = add_render_material(scene_queue, beam);
 
-	int num_object_vertices = vase_array.size() / 11;
-	// Draw the Vase
-	glDrawArrays(GL_TRIANGLES, 0, num_object_vertices);
+	// ---- SQUARES ----
+	render_material square;
+	square.uses_texture = false;
+	square_shading = add_render_material(scene_queue, square);
 }
 
-void draw_squares(unsigned int program) {
-	// Blue Square
-	glBindVertexArray(VAOs[12]);
-	glm::mat4 modelBlue = glm::mat4(1.0f);
-	modelBlue = glm::translate(modelBlue, glm::vec3(4.1f, 0.8f, 5.1f));
-	modelBlue = glm::rotate(modelBlue, glm::radians(-140.f), glm::vec3(0.f, 1.f, 0.f));
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(modelBlue));
-	int numBlueVertices = sizeof(blueSquare) / (10 * sizeof(float));
-	glDrawArrays(GL_TRIANGLES, 0, numBlueVertices);
-	// Green Square
-	glBindVertexArray(VAOs[11]);
-	glm::mat4 modelGreen = glm::mat4(1.0f);
-	modelGreen = glm::translate(modelGreen, glm::vec3(3.3f, 0.8f, 4.3f));
-	modelGreen = glm::rotate(modelGreen, glm::radians(-140.f), glm::vec3(0.f, 1.f, 0.f));
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(modelGreen));
-	int numGreenVertices = sizeof(greenSquare) / (10 * sizeof(float));
-	glDrawArrays(GL_TRIANGLES, 0, numGreenVertices);
-	// Red Square
-	glBindVertexArray(VAOs[10]);
-	glm::mat4 modelRed = glm::mat4(1.0f);
-	modelRed = glm::translate(modelRed, glm::vec3(2.f, 0.8f, 3.f));
-	modelRed = glm::rotate(modelRed, glm::radians(-140.f), glm::vec3(0.f, 1.f, 0.f));
-	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(modelRed));
-	int numRedVertices = sizeof(redSquare) / (10 * sizeof(float));
-	glDrawArrays(GL_TRIANGLES, 0, numRedVertices);
+// The lighting program specialized for a render material's features
+GLuint lighting_variant(int shading) {
+	return shader_variant(lighting_variants, (uint32_t)render_material_features(scene_queue.materials[shading]));
 }
 
-void generate_depth_map(unsigned int shadowShaderProgram, ShadowStruct shadow, glm::mat4 projectedLightSpaceMatrix) {
-	// Set the viewport to the size of the shadow map
-	glViewport(0, 0, SH_MAP_WIDTH, SH_MAP_HEIGHT);
-
-	// Bind the framebuffer for the shadow map
-	glBindFramebuffer(GL_FRAMEBUFFER, shadow.FBO);
-
-	// Clear the depth buffer of the framebuffer
-	glClear(GL_DEPTH_BUFFER_BIT);
-
-	// Use the shadow shader program
-	glUseProgram(shadowShaderProgram);
-
-	// Set the uniform for the light space matrix in the shader
-	glUniformMatrix4fv(glGetUniformLocation(shadowShaderProgram, "projectedLightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(projectedLightSpaceMatrix));
-
-	// Draw the objects using shadow shader
-	draw_pyramid(shadowShaderProgram);
-	draw_ufo(shadowShaderProgram);
-	draw_dunes(shadowShaderProgram);
-	draw_jet(shadowShaderProgram);
-	draw_rocks(shadowShaderProgram);
-	draw_vase(shadowShaderProgram);
-
-	// Unbind the framebuffer
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// Samplers and tables every lighting variant shares
+void set_lighting_uniforms(GLuint program) {
+	set_uniform(program, "shadowMap", 0);
+	// Texture units 3 to 7 are used by the texture table when bindless textures are unavailable.
+	bind_texture_table(object_textures, program);
+	// Every PBR material is a layer of the same arrays, bound once for all of the draws
+	bind_material_set(pbr_materials, program);
 }
 
-void render_with_shadow(unsigned int renderShaderProgram, ShadowStruct shadow, glm::mat4 projectedLightSpaceMatrix) {
-	// Set the viewport to the size of the window
-	glViewport(0, 0, width, height);
+// Variants finishing part way through a frame get the shared uniforms before they are drawn with
+void lighting_program_finished(GLuint program) {
+	if (is_shader_variant(lighting_variants, program))
+		set_lighting_uniforms(program);
+}
 
-	// Constant solid background colour 
-	static const GLfloat bgd[] = { .8f, .8f, .8f, 1.f };
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+// Submit the lighting variant of every render material up front, so they compile while the assets stream in
+void compile_lighting_variants() {
+	for (int shading = 0; shading < (int)scene_queue.materials.size(); shading++) {
+		begin_shader_variant(lighting_variants, (uint32_t)render_material_features(scene_queue.materials[shading]));
+	}
+	print_shader_variants(lighting_variants);
+}
 
-	glUseProgram(renderShaderProgram);
+// Queue an object for the shadow map and the opaque pass
+void submit_solid(GLuint shadow_program, int geometry, int shading, int lod, const glm::mat4& model) {
+	submit_render_item(scene_queue, RENDER_PASS_SHADOW, shadow_program, -1, geometry, lod, model);
+	submit_render_item(scene_queue, RENDER_PASS_OPAQUE, lighting_variant(shading), shading, geometry, lod, model);
+}
 
-	// Activate and Bind shadow map to texture unit 0
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, shadow.Texture);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "shadowMap"), 0);
+// Collect and sort this frame's draws of every object in the scene
+// Call after update_frame_uniforms, the camera pass culls against its view and projection
+void submit_scene(GLuint shadow_program, const glm::mat4& projectedLightSpaceMatrix) {
+	begin_render_frame(scene_queue, activeCamera->Position);
+	// The shadow map only holds what the light's ortho frustum sees
+	set_render_frustum(scene_queue, RENDER_PASS_SHADOW, projectedLightSpaceMatrix);
+	set_render_frustum(scene_queue, RENDER_PASS_OPAQUE, projection * view);
+	set_render_frustum(scene_queue, RENDER_PASS_TRANSPARENT, projection * view);
+
+	// Dunes Plane, moved right and forwards and down
+	glm::mat4 modelDunes = glm::translate(glm::mat4(1.0f), glm::vec3(6.f, -0.1f, 1.f));
+	submit_solid(shadow_program, dunes_geometry, dunes_shading, 0, modelDunes);
+
+	glm::mat4 modelJet = jet_model((float)glfwGetTime());
+	request_mesh_texture_detail(jet_mesh, modelJet, jet_textures);
+	submit_solid(shadow_program, jet_geometry, jet_shading, active_lod(jet_mesh, modelJet), modelJet);
+
+	submit_solid(shadow_program, pyramid_geometry, pyramid_shading, 0, glm::mat4(1.0f));
+	glm::mat4 modelRocks = rocks_model();
+	submit_solid(shadow_program, rocks_geometry, rocks_shading, active_lod(rock_mesh, modelRocks), modelRocks);
+	glm::mat4 modelVase = vase_model();
+	submit_solid(shadow_program, vase_geometry, vase_shading, active_lod(vase_mesh, modelVase), modelVase);
+
+	glm::mat4 modelUFO = ufo_model();
+	request_mesh_texture_detail(ship_mesh, modelUFO, ufo_textures);
+	submit_solid(shadow_program, ufo_geometry, ufo_shading, active_lod(ship_mesh, modelUFO), modelUFO);
+
+	// Transparent objects cast no shadow
+	submit_render_item(scene_queue, RENDER_PASS_TRANSPARENT, lighting_variant(beam_shading), beam_shading, beam_geometry, 0, beam_model());
+	// Squares beside the vase
+	glm::mat4 modelSquare = glm::rotate(glm::mat4(1.0f), glm::radians(-140.f), glm::vec3(0.f, 1.f, 0.f));
+	submit_render_item(scene_queue, RENDER_PASS_TRANSPARENT, lighting_variant(square_shading), square_shading, blue_geometry, 0, glm::translate(glm::mat4(1.0f), glm::vec3(4.1f, 0.8f, 5.1f)) * modelSquare);
+	submit_render_item(scene_queue, RENDER_PASS_TRANSPARENT, lighting_variant(square_shading), square_shading, green_geometry, 0, glm::translate(glm::mat4(1.0f), glm::vec3(3.3f, 0.8f, 4.3f)) * modelSquare);
+	submit_render_item(scene_queue, RENDER_PASS_TRANSPARENT, lighting_variant(square_shading), square_shading, red_geometry, 0, glm::translate(glm::mat4(1.0f), glm::vec3(2.f, 0.8f, 3.f)) * modelSquare);
+
+	sort_render_queue(scene_queue);
+}
 
-	// For the regular objects, set to false
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_specular"), false);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_glow"), false);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_normal"), false);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_bump"), false);
-	// Set PBR False
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_pbr"), false);
+// Fill the frame and light uniform buffers, every program reads the camera and lights from them
+void update_frame_uniforms(glm::mat4 projectedLightSpaceMatrix) {
+	static_assert(NUM_SPOTLIGHTS == MAX_SPOT_LIGHTS, "The light buffer holds every spot light");
+	view = glm::lookAt(activeCamera->Position, activeCamera->Position + activeCamera->Front, activeCamera->Up);
+	projection = glm::perspective(glm::radians(fov), (float)width / (float)height, .01f, 100.f);
 
-	glUniformMatrix4fv(glGetUniformLocation(renderShaderProgram, "projectedLightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(projectedLightSpaceMatrix));
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "camPos"), activeCamera->Position.x, activeCamera->Position.y, activeCamera->Position.z);
+	frame_data frame;
+	frame.view = view;
+	frame.projection = projection;
+	frame.projectedLightSpaceMatrix = projectedLightSpaceMatrix;
+	frame.camPos = activeCamera->Position;
+	frame.time = (float)glfwGetTime();
 
+	light_data lights = {};
 	// Directional Lighting
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "lightDirection"), lightDirection.x, lightDirection.y, lightDirection.z);
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "lightColour"), 1.f, 0.98f, 0.7f);
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "lightPos"), lightPos.x, lightPos.y, lightPos.z);
-
-	// Default Shininess
-	float default_shine = 64.f;
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "shininess"), default_shine);
-
-	// Yellowish Ambient light
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "environmentIntensity"), 1.f, 0.98f, 0.7f);
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "environmentIntensity"), 1.5f);
+	lights.lightDirection = lightDirection;
+	lights.lightColour = glm::vec3(1.f, 0.98f, 0.7f);
+	lights.lightPos = lightPos;
 
 	// Spot lighting
 	float t = glfwGetTime();
@@ -1175,279 +1100,72 @@ void render_with_shadow(unsigned int renderShaderProgram, ShadowStruct shadow, g
 		float angle = t / spot_speed + i * glm::two_pi<float>() / NUM_SPOTLIGHTS;
 		glm::vec3 dir = glm::normalize(glm::vec3(cos(-angle), -0.6f, sin(-angle)));
 		spotLightDirections[i] = dir;
+		// Give false directions to remove spotlights when ship dissapears
+		lights.spotLightDirections[i] = glm::vec4(is_clicked ? glm::vec3(0.f) : dir, 0.f);
 	}
+	lights.spotLightPos = spotLightPos;
+	lights.spotColour = glm::vec3(1.f, 0.f, 0.f);
+	lights.spotLightInnerCutoff = 45.f;
+	lights.spotLightOuterCutoff = 45.f;
 
-	// Give false directions to remove spotlights and poslight when ship dissapears
-	if (!is_clicked) {
-		glUniform3fv(glGetUniformLocation(renderShaderProgram, "spotLightDirections"), NUM_SPOTLIGHTS, glm::value_ptr(spotLightDirections[0]));
-		glUniform1i(glGetUniformLocation(renderShaderProgram, "posActive"), true);
-	}
-	else {
-		std::vector<glm::vec3> dummyDirections(NUM_SPOTLIGHTS, glm::vec3(0.0f));
-		glUniform3fv(glGetUniformLocation(renderShaderProgram, "spotLightDirections"), NUM_SPOTLIGHTS, glm::value_ptr(dummyDirections[0]));
-		glUniform1i(glGetUniformLocation(renderShaderProgram, "posActive"), false);
-	}
-
-
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "spotLightPos"), spotLightPos.x, spotLightPos.y, spotLightPos.z);
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "spotColour"), 1.f, 0.f, 0.f);
-
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "spotLightInnerCutoff"), 45.f);
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "spotLightOuterCutoff"), 45.f);
-
-
-	// Positional Light
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "posLightPos"), posLightPos.x, posLightPos.y, posLightPos.z);
-	glUniform3f(glGetUniformLocation(renderShaderProgram, "posColour"), posLightColour.r, posLightColour.g, posLightColour.b);
-
-
-	// Initial texture scale
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "uv_scale"), 1.0f);
-
-	view = glm::mat4(1.f);
-	view = glm::lookAt(activeCamera->Position, activeCamera->Position + activeCamera->Front, activeCamera->Up);
-	glUniformMatrix4fv(glGetUniformLocation(renderShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-
-	projection = glm::mat4(1.f);
-	projection = glm::perspective(glm::radians(fov), (float)width / (float)height, .01f, 100.f);
-	glUniformMatrix4fv(glGetUniformLocation(renderShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-
-	// --- PYRAMID ---
-
-	// Texture Unit 0 is used for Shadow Mapping.
-	// Texture Unit 1 is used by the Texture class.
-
-	// Bind to texture units
-	//Texture unit 11 - Rocks Base 
-	glActiveTexture(GL_TEXTURE11);
-	glBindTexture(GL_TEXTURE_2D, rocks_tex);
-
-	//Texture unit 12 - Rocks Diffuse 
-	glActiveTexture(GL_TEXTURE12);
-	glBindTexture(GL_TEXTURE_2D, rocks_normal);
-
-	//Texture unit 13 - Rocks Depth Map 
-	glActiveTexture(GL_TEXTURE13);
-	glBindTexture(GL_TEXTURE_2D, rocks_depth);
-
-	// Texture unit 14 - Rocks Metalic
-	glActiveTexture(GL_TEXTURE14);
-	glBindTexture(GL_TEXTURE_2D, rocks_metal);
-
-	// Texture unit 15 - Rocks AO
-	glActiveTexture(GL_TEXTURE15);
-	glBindTexture(GL_TEXTURE_2D, rocks_ao);
-
-	// Texture unit 16 - Rocks Roughness
-	glActiveTexture(GL_TEXTURE16);
-	glBindTexture(GL_TEXTURE_2D, rocks_rough);
-	glActiveTexture(GL_TEXTURE11);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "tex0"), 11);
-
-	// Normal Map
-	glActiveTexture(GL_TEXTURE12);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "normal_map"), 12);
-
-	// Depth Map
-	glActiveTexture(GL_TEXTURE13);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "depth_map"), 13);
-
-	// Height for parrallax mapping
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "height_scale"), 0.2f);
-
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_parrallax"), true);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_normal"), true);
-
-	// Increase texture scale
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "uv_scale"), 3.0f);
-
-	draw_pyramid(renderShaderProgram);
-
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_parrallax"), false);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_normal"), false);
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "uv_scale"), 1.0f);
-
-
-	// ---- DESERT PLANE ----
-
-	// Texture unit 8 - Sand
-	glActiveTexture(GL_TEXTURE8);
-	glBindTexture(GL_TEXTURE_2D, sand_tex);
-	// Activate sand texture in texture unit 8
-	glActiveTexture(GL_TEXTURE8);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "tex0"), 8);
-	// Reduced shininess for sand
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "shininess"), 32.f);
-	draw_dunes(renderShaderProgram);
-	// Set back to default
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "shininess"), default_shine);
-
-
-	// ---- JET PLANE ----
-	// Texture unit 9 - Jet Texture
-	glActiveTexture(GL_TEXTURE9);
-	glBindTexture(GL_TEXTURE_2D, jet_tex);
-	// Load texture
-	glActiveTexture(GL_TEXTURE9);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "tex0"), 9);
-
-	draw_jet(renderShaderProgram);
-
-
-
-
-	// ---- ROCKS ----
-	// Base texture
-	glActiveTexture(GL_TEXTURE11);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "tex0"), 11);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "albedoMap"), 11);
-
-	// Normal Map
-	glActiveTexture(GL_TEXTURE12);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "normal_map"), 12);
+	// Positional Light, off while the ship is gone
+	lights.posActive = is_clicked ? 0 : 1;
+	lights.posLightPos = posLightPos;
+	lights.posColour = posLightColour;
 
-	// Depth Map
-	glActiveTexture(GL_TEXTURE13);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "depth_map"), 13);
-
-	// Texture unit 14 - Rocks Metalic
-	glActiveTexture(GL_TEXTURE14);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "metallicMap"), 14);
-
-	// Texture unit 15 - AO
-	glActiveTexture(GL_TEXTURE15);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "aoMap"), 15);
-
-	// Texture unit 16 - Rocks Roughness
-	glActiveTexture(GL_TEXTURE16);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "roughnessMap"), 16);
-
-	// Increase texture scale
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "uv_scale"), 25.0f);
-
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_normal"), true);
-
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_pbr"), true);
-
-
-	draw_rocks(renderShaderProgram);
-
-	// Reset texture scale
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "uv_scale"), 1.0f);
+	// Yellowish Ambient light
+	lights.ambientLight = glm::vec3(1.f, 0.98f, 0.7f);
+	lights.environmentIntensity = 1.5f;
 
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_pbr"), false);
+	upload_frame_uniforms(scene_uniforms, frame, lights);
+}
 
-	// ---- VASE ----
-	// Reuse texture units
-	glActiveTexture(GL_TEXTURE11);
-	glBindTexture(GL_TEXTURE_2D, vase_tex);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "albedoMap"), 11);
+void generate_depth_map(ShadowStruct shadow) {
+	// Set the viewport to the size of the shadow map
+	glViewport(0, 0, SH_MAP_WIDTH, SH_MAP_HEIGHT);
 
-	//Texture unit 12 -  Diffuse 
-	glActiveTexture(GL_TEXTURE12);
-	glBindTexture(GL_TEXTURE_2D, vase_normal);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "normal_map"), 12);
+	// Bind the framebuffer for the shadow map
+	glBindFramebuffer(GL_FRAMEBUFFER, shadow.FBO);
 
-	// Texture unit 14 -  Metalic
-	glActiveTexture(GL_TEXTURE14);
-	glBindTexture(GL_TEXTURE_2D, vase_metalic);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "metallicMap"), 14);
+	// Clear the depth buffer of the framebuffer
+	glClear(GL_DEPTH_BUFFER_BIT);
 
-	// Texture unit 15 -  AO
-	glActiveTexture(GL_TEXTURE15);
-	glBindTexture(GL_TEXTURE_2D, vase_ao);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "aoMap"), 15);
+	// Draw the objects using shadow shader, the light space matrix comes from the frame uniforms
+	draw_render_pass(scene_queue, RENDER_PASS_SHADOW);
 
-	// Texture unit 16 -  Roughness
-	glActiveTexture(GL_TEXTURE16);
-	glBindTexture(GL_TEXTURE_2D, vase_rough);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "roughnessMap"), 16);
+	// Unbind the framebuffer
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_normal"), true);
+void render_with_shadow(const shader_variants& lighting, ShadowStruct shadow) {
+	// Set the viewport to the size of the window
+	glViewport(0, 0, width, height);
 
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_pbr"), true);
+	// Constant solid background colour 
+	static const GLfloat bgd[] = { .8f, .8f, .8f, 1.f };
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-	draw_vase(renderShaderProgram);
+	// Activate and Bind shadow map to texture unit 0
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, shadow.Texture);
 
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_pbr"), false);
+	// Camera and lights come from the frame uniforms, set in update_frame_uniforms
+	// Object settings come from the render queue's material table
 
+	// Texture unit 0 is used for Shadow Mapping, units 3 to 7 by the texture table and 11 onwards by the material arrays, see set_lighting_uniforms.
 
-	// ---- UFO ----
-	// Activate textures for UFO
-	// Texture unit 3 - UFO Diffuse
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, ship_tex);
-
-	// Texture unit 4 - UFO Glow
-	glActiveTexture(GL_TEXTURE4);
-	glBindTexture(GL_TEXTURE_2D, ship_glow);
-
-	// Texture unit 5 - UFO Normal
-	glActiveTexture(GL_TEXTURE5);
-	glBindTexture(GL_TEXTURE_2D, ship_normal);
-
-	// Texture unit 6 - UFO Specular
-	glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_2D, ship_specular);
-
-	// Texture unit 7 - UFO Bump
-	glActiveTexture(GL_TEXTURE7);
-	glBindTexture(GL_TEXTURE_2D, ship_bump);
-	// Texture Unit 3 - UFO Diffuse
-	glActiveTexture(GL_TEXTURE3);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "tex0"), 3);
-	// Texture Unit 4 - UFO Glow
-	glActiveTexture(GL_TEXTURE4);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "glow_map"), 4);
-	// Texture unit 5 - UFO Normal
-	glActiveTexture(GL_TEXTURE5);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "normal_map"), 5);
-	// Texture unit 6 - UFO Specular
-	glActiveTexture(GL_TEXTURE6);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "specular_map"), 6);
-	// Texture unit 7 - UFO Bump
-	glActiveTexture(GL_TEXTURE7);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "bump_map"), 7);
-
-	// Activate Maps in Fragment Shader
-	// Activate the glow map
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_glow"), true);
-	// Activate the normal map
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_normal"), true);
-	// Activate specular map
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_specular"), true);
-	// Set a scale for the bump map
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "bump_scale"), 30.f);
-	// Ship is more shiny than rest of scene
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "shininess"), 256.f);
+	// Every variant samples the same units, the uniform cache skips the ones already set
+	// Variants still building get them from set_lighting_uniforms when they finish
+	for (GLuint program : finished_shader_variant_programs(lighting)) {
+		set_lighting_uniforms(program);
+	}
 
-	draw_ufo(renderShaderProgram);
+	draw_render_pass(scene_queue, RENDER_PASS_OPAQUE);
 
-	// --- CYLINDER ---
-	// Deactivate textures
+	// Draw last for transparency, without writing depth
 	glDepthMask(GL_FALSE);
-
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_glow"), false);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_normal"), false);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_specular"), false);
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_texture"), false);
-	// Very shiny for beam
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "shininess"), 512.f);
-	draw_beam(renderShaderProgram);
-	// Re-activate textures
-	glUniform1f(glGetUniformLocation(renderShaderProgram, "shininess"), default_shine);
-
-	// ---- SQUARES ----
-	// Draw last for transparency
-
-
-	draw_squares(renderShaderProgram);
-
-	glUniform1i(glGetUniformLocation(renderShaderProgram, "uses_texture"), true);
-
+	draw_render_pass(scene_queue, RENDER_PASS_TRANSPARENT);
 	glDepthMask(GL_TRUE);
-
 }
 
 int main() {
@@ -1493,21 +1211,46 @@ int main() {
 
 	ShadowStruct shadow = setup_shadowmap(SH_MAP_WIDTH, SH_MAP_HEIGHT);
 
-	// Lighting and PBR Shader
-	GLuint lighting_program = CompileShader("lighting_vertex.vert", "lighting_fragment.frag");
+	// Draw and material tables of the scene, the shaders drawing from them need its defines
+	init_render_queue(scene_queue);
+	// Programs below are submitted without waiting, and checked when first drawn with
+	InitParallelShaderCompile();
 	// Shadow Shader
-	GLuint shadow_shader = CompileShader("shadow.vert", "shadow.frag");
+	GLuint shadow_shader = BeginCompileShader("shadow.vert", "shadow.frag", render_queue_shader_defines(scene_queue));
 	// Bestier Curve Shader for Shooting Stars
-	GLuint star_shader = CompileShader("star.vert", "star.frag");
+	GLuint star_shader = BeginCompileShader("star.vert", "star.frag");
 	// Cubemap Shader
-	GLuint skybox_shader = CompileShader("skybox.vert", "skybox.frag");
+	GLuint skybox_shader = BeginCompileShader("skybox.vert", "skybox.frag");
+	// Hi-Z occlusion culling of the opaque items, off where compute shaders are unavailable
+	init_occlusion_culler(scene_occlusion, scene_queue);
+	// Lighting and PBR Shader, reading bindless texture handles if the driver has them
+	GLuint lighting_program = compile_texture_table_program("lighting_vertex.vert", "lighting_fragment.frag", object_textures, render_queue_shader_defines(scene_queue));
+	// Each render material draws with a variant of it specialized for its features, built with the same texture mode
+	std::string lighting_defines = std::string(object_textures.bindless ? BINDLESS_SHADER_DEFINES : "") + render_queue_shader_defines(scene_queue);
+	init_shader_variants(lighting_variants, "lighting_vertex.vert", "lighting_fragment.frag", lighting_defines.c_str(), "MATERIAL_FEATURES", lighting_program);
+	AddProgramFinishedHook(lighting_program_finished);
+	// Bindless handles fix a texture's sampling state, so streamed levels cannot be faded in through it
+	configure_texture_streaming((size_t)TEXTURE_BUDGET_MB * 1024 * 1024, !object_textures.bindless);
+	// Camera and light uniform buffers shared by all of them
+	create_frame_uniforms(scene_uniforms);
+
+#if RUN_BENCHMARKS
+	// Compare the tinyobj and parallel OBJ loaders on the largest mesh in the scene
+	benchmark_obj_parse("objs/egypt/source/test.obj", "objs/egypt/source");
+	// Smooth tangent generation on the normal mapped PBR meshes
+	benchmark_tangent_space("objs/vase/Flowervase.obj", "objs/vase/");
+	benchmark_tangent_space("objs/egypt/source/test.obj", "objs/egypt/source");
+#endif
+
+	// Placeholder textures for everything that streams in
+	init_asset_stream();
+
+	// Create VAO and VBOs, the loaded objects stream in over the first frames
+	initialise_buffers();
 
 	// Initialise  cameras
 	initialise_cameras();
 
-	// Create VAO and VBOs, set objects and textures
-	initialise_buffers();
-
 	//Texture unit 10 - Cubemap
 	glActiveTexture(GL_TEXTURE10);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_tex);
@@ -1536,30 +1279,69 @@ int main() {
 		"skybox/back.png"
 	};
 
-	// Set up the cubemap texture
-	skybox_tex = setup_cubemap(faces);
-	// Set up the sand mipmap texture
-	sand_tex = setup_mipmaps(sand_files, 11);
-
-	// Load rest of textures
+	// Every texture in the scene, each shows a placeholder colour until it has loaded
 	// SRGB should be true unless for PBR
-	ship_tex = setup_texture("objs/ufo/ufo_diffuse.png");
-	ship_glow = setup_texture("objs/ufo/ufo_diffuse_glow.png");
-	ship_normal = setup_texture("objs/ufo/ufo_normal.png");
-	ship_specular = setup_texture("objs/ufo/ufo_spec.png");
-	ship_bump = setup_texture("objs/ufo/Map__7_Normal_Bump.tga");
-	jet_tex = setup_texture("objs/jet/Paint_tex.jpg");
-	rocks_tex = setup_texture("sandstone_parra/stone-block-wall_albedo.png");
-	rocks_normal = setup_texture_pbr("sandstone_parra/stone-block-wall_normal-dx.png", false);
-	rocks_depth = setup_texture_pbr("sandstone_parra/stone-block-wall_depth.png", false);
-	rocks_rough = setup_texture_pbr("sandstone_parra/stone-block-wall_roughness.png", false);
-	rocks_metal = setup_texture_pbr("sandstone_parra/stone-block-wall_metallic.png", false);
-	rocks_ao = setup_texture_pbr("sandstone_parra/stone-block-wall_ao.png", false);
-	vase_tex = setup_texture_pbr("objs/vase/T_Flowervase_BC.png", true);
-	vase_normal = setup_texture_pbr("objs/vase/T_Flowervase_N.png", false);
-	vase_metalic = setup_texture_pbr("objs/vase/T_Flowervase_MT.png", false);
-	vase_rough = setup_texture_pbr("objs/vase/T_Flowervase_R.png", false);
-	vase_ao = setup_texture_pbr("objs/vase/T_Flowervase_AO.png", false);
+	// Colour maps are stored as BC7, normal maps as BC5 and maps the shader reads one channel of as BC4
+	std::vector<texture_request> textures = {
+		// Cubemap for the skybox
+		texture_cubemap(&skybox_tex, faces),
+		// Sand using MipMaps
+		texture_mipmaps(&sand_tex, sand_files, 11, PLACEHOLDER_GREY),
+		texture_plain(&ship_tex, "objs/ufo/ufo_diffuse.png", COMPRESS_COLOUR, PLACEHOLDER_GREY),
+		texture_plain(&ship_glow, "objs/ufo/ufo_diffuse_glow.png", COMPRESS_COLOUR, PLACEHOLDER_BLACK),
+		texture_plain(&ship_normal, "objs/ufo/ufo_normal.png", COMPRESS_NORMAL, PLACEHOLDER_NORMAL),
+		texture_plain(&ship_specular, "objs/ufo/ufo_spec.png", COMPRESS_MASK, PLACEHOLDER_BLACK),
+		texture_plain(&ship_bump, "objs/ufo/Map__7_Normal_Bump.tga", COMPRESS_NORMAL, PLACEHOLDER_NORMAL),
+		texture_plain(&jet_tex, "objs/jet/Paint_tex.jpg", COMPRESS_COLOUR, PLACEHOLDER_GREY),
+	};
+
+	// PBR materials, each map is a layer of the array for its kind
+	// Maps are baked like the textures above, the vase's 4096x4096 maps drop their top level to fit the layers
+	material_desc rocks;
+	rocks.name = "sandstone";
+	rocks.files[MATERIAL_ALBEDO] = "sandstone_parra/stone-block-wall_albedo.png";
+	rocks.files[MATERIAL_NORMAL] = "sandstone_parra/stone-block-wall_normal-dx.png";
+	rocks.files[MATERIAL_AO] = "sandstone_parra/stone-block-wall_ao.png";
+	rocks.files[MATERIAL_ROUGHNESS] = "sandstone_parra/stone-block-wall_roughness.png";
+	rocks.files[MATERIAL_METALLIC] = "sandstone_parra/stone-block-wall_metallic.png";
+	rocks.files[MATERIAL_HEIGHT] = "sandstone_parra/stone-block-wall_depth.png";
+	rocks.files[MATERIAL_ORMH] = "sandstone_parra/stone-block-wall_ormh.tga";
+	rocks_material = add_material(pbr_materials, rocks);
+
+	material_desc vase;
+	vase.name = "vase";
+	vase.files[MATERIAL_ALBEDO] = "objs/vase/T_Flowervase_BC.png";
+	vase.albedo_srgb = true;
+	vase.files[MATERIAL_NORMAL] = "objs/vase/T_Flowervase_N.png";
+	vase.files[MATERIAL_AO] = "objs/vase/T_Flowervase_AO.png";
+	vase.files[MATERIAL_ROUGHNESS] = "objs/vase/T_Flowervase_R.png";
+	vase.files[MATERIAL_METALLIC] = "objs/vase/T_Flowervase_MT.png";
+	vase.files[MATERIAL_ORMH] = "objs/vase/T_Flowervase_ormh.tga";
+	vase_material = add_material(pbr_materials, vase);
+
+	// Textures of the other objects, slots they do not sample stay empty
+	texture_material sand_set, jet_set, ufo_set;
+	sand_set.textures[TEXTURE_SLOT_BASE] = &sand_tex;
+	jet_set.textures[TEXTURE_SLOT_BASE] = &jet_tex;
+	ufo_set.textures[TEXTURE_SLOT_BASE] = &ship_tex;
+	ufo_set.textures[TEXTURE_SLOT_GLOW] = &ship_glow;
+	ufo_set.textures[TEXTURE_SLOT_NORMAL] = &ship_normal;
+	ufo_set.textures[TEXTURE_SLOT_SPECULAR] = &ship_specular;
+	ufo_set.textures[TEXTURE_SLOT_BUMP] = &ship_bump;
+	sand_textures = add_texture_material(object_textures, sand_set);
+	jet_textures = add_texture_material(object_textures, jet_set);
+	ufo_textures = add_texture_material(object_textures, ufo_set);
+
+#if RUN_BENCHMARKS
+	// Serial against parallel decoding of the whole texture set
+	benchmark_texture_loading(textures);
+#endif
+
+	stream_textures(textures);
+	initialise_render_queue();
+	compile_lighting_variants();
+	// The benchmark compares both mask layouts, so it needs both loaded
+	stream_material_set(pbr_materials, RUN_BENCHMARKS != 0);
 
 	// Enable blending for transparency
 	glEnable(GL_BLEND);
@@ -1570,14 +1352,39 @@ int main() {
 	// Account for depth of 3D objects.
 	glEnable(GL_DEPTH_TEST);
 
+	bool first_frame = true;
+	bool assets_loaded = false;
+#if RUN_BENCHMARKS
+	bool materials_benchmarked = false;
+#endif
 	while (!glfwWindowShouldClose(window)) {
+		// Upload whatever the loader threads have finished, a few MB at a time
+		pump_asset_stream();
+		// Check the programs the driver has finished building
+		PumpProgramBuilds();
+		// Stream mip levels in and out using the detail last frame's draws asked for
+		pump_texture_streaming();
+		// Pick up handles of textures that streamed in this frame
+		update_texture_table(object_textures);
+		if (!assets_loaded && asset_stream_pending() == 0) {
+			assets_loaded = true;
+			printf("All assets streamed in after %.0f ms.\n", glfwGetTime() * 1000.0);
+			report_camera_lods();
+			print_texture_registry();
+			print_texture_streaming();
+			// Every program has been drawn with by now, warm launches load them all from the binary cache
+			print_program_cache();
+			print_uniform_counters();
+			print_render_counters(scene_queue);
+			print_occlusion_counters(scene_occlusion);
+			print_geometry_arena(packed_arena);
+			print_geometry_arena(float_arena);
+		}
+
 		// Clear the colour buffer
 		glClearColor(0.01f, 0.01f, 0.27f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		// Use the shader program
-		glUseProgram(lighting_program);
-
 		// Enable multisampling defined by hint
 		glEnable(GL_MULTISAMPLE);
 
@@ -1588,13 +1395,27 @@ int main() {
 		glm::mat4 lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 		glm::mat4 projectedLightSpaceMatrix = lightProjection * lightView;
 
+		// Camera and lights for every program this frame
+		update_frame_uniforms(projectedLightSpaceMatrix);
+		// Every object's draws, sorted by pass, program, arena and textures
+		submit_scene(shadow_shader, projectedLightSpaceMatrix);
+		// Drop the opaque items hidden behind others before anything is drawn
+		cull_occluded_items(scene_occlusion, scene_queue, width, height);
+
 		// Must be drawn first
 		draw_skybox(skybox_shader);
 
 		// Render rest of objects
 		glCullFace(GL_FRONT);
-		generate_depth_map(shadow_shader, shadow, projectedLightSpaceMatrix);
-		render_with_shadow(lighting_program, shadow, projectedLightSpaceMatrix);
+		generate_depth_map(shadow);
+		render_with_shadow(lighting_variants, shadow);
+#if RUN_BENCHMARKS
+		// Separate against packed mask maps, once every layer has streamed in
+		if (assets_loaded && !materials_benchmarked) {
+			materials_benchmarked = true;
+			benchmark_material_layouts(pbr_materials, [&] { draw_render_pass(scene_queue, RENDER_PASS_OPAQUE, true); });
+		}
+#endif
 		glCullFace(GL_BACK);
 		// Render the shooting stars
 		draw_star(star_shader);
@@ -1625,16 +1446,38 @@ int main() {
 		glBindVertexArray(0);
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		end_uniform_frame();
+
+		if (first_frame) {
+			first_frame = false;
+			printf("First frame after %.0f ms.\n", glfwGetTime() * 1000.0);
+		}
 	}
 
+	print_uniform_counters();
+	print_render_counters(scene_queue);
+	print_occlusion_counters(scene_occlusion);
+
+	// Release the bindless handles while the placeholders they may point at still exist
+	delete_texture_table(object_textures);
+	delete_frame_uniforms(scene_uniforms);
+	// Stop loads that are still queued
+	shutdown_asset_stream();
+	shutdown_texture_streaming();
+
 	// Remove objects
 	glDeleteVertexArrays(NUM_VAO, VAOs);
 	glDeleteBuffers(NUM_VBO, VBOs);
+	delete_geometry_arena(packed_arena);
+	delete_geometry_arena(float_arena);
+	delete_occlusion_culler(scene_occlusion);
+	delete_render_queue(scene_queue);
+	delete_material_set(pbr_materials);
 	// Delete the shader programs
-	glDeleteProgram(lighting_program);
-	glDeleteProgram(shadow_shader);
-	glDeleteProgram(star_shader);
-	glDeleteProgram(skybox_shader);
+	delete_shader_variants(lighting_variants);
+	DeleteProgram(shadow_shader);
+	DeleteProgram(star_shader);
+	DeleteProgram(skybox_shader);
 
 	// Remove the window
 	glfwDestroyWindow(window);
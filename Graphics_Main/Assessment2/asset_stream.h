@@ -0,0 +1,468 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+#include "texture.h"
+#include "material_array.h"
+#include "material_pack.h"
+#include "texture_streaming.h"
+#include "mesh_cache.h"
+#include "thread_pool.h"
+
+// Threads decoding images and OBJs, separate from worker_pool so they can hand work to it
+#define ASSET_STREAM_THREADS 2
+// Bytes copied to the GPU per frame, big assets are spread over several frames
+#define ASSET_UPLOAD_BUDGET (4 * 1024 * 1024)
+
+struct stream_item
+{
+	bool is_mesh = false;
+	std::string name;
+	bool failed = false;
+
+	// Texture requests, one image per file of the request
+	texture_request request;
+	std::vector<decoded_image> images;
+	// Registry key, a duplicate waits for the texture another request is loading
+	uint64_t key = 0;
+	bool duplicate = false;
+	// Material maps upload into their layer of the set's array instead of a texture of their own
+	material_set* materials = nullptr;
+	int material = 0;
+	material_map map = MATERIAL_ALBEDO;
+	// Baked 2D textures start from a small level and are handed to the texture streamer once uploaded
+	bool streamed_mips = false;
+	int first_level = 0;
+
+	// Mesh requests
+	indexed_mesh* mesh_target = nullptr;
+	indexed_mesh mesh;
+	std::string base_folder;
+	bool uses_normal = false;
+	geometry_arena* arena = nullptr;
+
+	// Upload progress on the GL thread
+	bool started = false;
+	bool uploaded = false;
+	GLuint texture = 0;
+	GLenum format = 0;
+	std::vector<stream_slice> slices;
+	size_t slice = 0;
+	size_t offset = 0;
+
+	~stream_item()
+	{
+		for (decoded_image& img : images) {
+			free_decoded_image(&img);
+		}
+	}
+};
+
+struct asset_stream_state
+{
+	// Items decoded by the loaders and waiting for the GL thread
+	std::mutex ready_mutex;
+	std::deque<std::shared_ptr<stream_item>> ready;
+	// Item the GL thread is part way through uploading
+	std::shared_ptr<stream_item> uploading;
+	// Requested but not yet uploaded
+	int pending = 0;
+	std::atomic<bool> cancelled{ false };
+
+	GLuint pbo = 0;
+	GLuint placeholders[NUM_PLACEHOLDERS] = {};
+	GLuint cube_placeholder = 0;
+};
+
+asset_stream_state& asset_stream()
+{
+	static asset_stream_state state;
+	return state;
+}
+
+thread_pool& asset_loaders()
+{
+	static thread_pool loaders(ASSET_STREAM_THREADS);
+	return loaders;
+}
+
+// Create the placeholder textures and the pixel unpack buffer, call on the GL thread after gl3wInit
+void init_asset_stream()
+{
+	asset_stream_state& state = asset_stream();
+	static const unsigned char colours[NUM_PLACEHOLDERS][4] = {
+		{ 128, 128, 128, 255 },
+		{ 255, 255, 255, 255 },
+		{ 0, 0, 0, 255 },
+		// Flat tangent space normal
+		{ 128, 128, 255, 255 },
+	};
+	glCreateTextures(GL_TEXTURE_2D, NUM_PLACEHOLDERS, state.placeholders);
+	for (int i = 0; i < NUM_PLACEHOLDERS; i++) {
+		glTextureStorage2D(state.placeholders[i], 1, GL_RGBA8, 1, 1);
+		glTextureSubImage2D(state.placeholders[i], 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, colours[i]);
+		glTextureParameteri(state.placeholders[i], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTextureParameteri(state.placeholders[i], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
+	// Night sky colour matching the clear colour
+	static const unsigned char sky[4] = { 3, 3, 69, 255 };
+	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &state.cube_placeholder);
+	glTextureStorage2D(state.cube_placeholder, 1, GL_RGBA8, 1, 1);
+	for (int face = 0; face < 6; face++) {
+		glTextureSubImage3D(state.cube_placeholder, 0, 0, 0, face, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, sky);
+	}
+
+	glCreateBuffers(1, &state.pbo);
+}
+
+// Decode every file of a texture item, mip levels and cube faces in parallel
+void decode_stream_texture(stream_item& item)
+{
+	// The packed masks are built from the separate maps first when they have changed
+	if (item.materials && item.map == MATERIAL_ORMH && !build_packed_masks(item.materials->materials[item.material])) {
+		item.failed = true;
+		return;
+	}
+	std::vector<decoded_image*> images;
+	for (decoded_image& img : item.images) {
+		images.push_back(&img);
+	}
+	decode_images(images, &worker_pool());
+	for (decoded_image& img : item.images) {
+		if (!img.loaded()) {
+			std::cerr << "Failed to load texture: " << img.filename << std::endl;
+			item.failed = true;
+			return;
+		}
+	}
+	if (item.request.kind == TEXTURE_MIPMAPS) {
+		// Hand made levels are trimmed to the part that forms a proper chain
+		item.failed = valid_mip_levels(item.images) == 0;
+		return;
+	}
+	if (item.materials) {
+		const baked_texture& baked = item.images[0].baked;
+		if (material_base_level(baked) < 0) {
+			std::cerr << "Material map " << item.name << " is " << baked.width << "x" << baked.height << ", layers are "
+				<< MATERIAL_LAYER_SIZE << "x" << MATERIAL_LAYER_SIZE << " with a full chain." << std::endl;
+			item.failed = true;
+		}
+		return;
+	}
+	// Cubemap faces share one storage
+	const baked_texture& first = item.images[0].baked;
+	for (decoded_image& img : item.images) {
+		if (img.baked.format != first.format || img.baked.width != first.width || img.baked.height != first.height) {
+			std::cerr << "Cubemap tex failed to load at path: " << img.filename << std::endl;
+			item.failed = true;
+			return;
+		}
+	}
+}
+
+// Run the decode half of a request on a loader thread, then queue it for upload
+void submit_stream_item(std::shared_ptr<stream_item> item)
+{
+	asset_stream_state& state = asset_stream();
+	state.pending++;
+	asset_loaders().submit([item] {
+		asset_stream_state& state = asset_stream();
+		if (state.cancelled)
+			return;
+		try {
+			if (item->is_mesh) {
+				read_obj_mesh(item->name.c_str(), item->base_folder.c_str(), item->uses_normal, &item->mesh);
+			}
+			else {
+				// Files another request already loaded or is loading are not decoded again
+				// Material layers are not textures of their own, so they are never shared
+				if (!item->materials) {
+					item->key = texture_request_key(item->request);
+					item->duplicate = !claim_texture(item->key, item->name);
+				}
+				if (!item->duplicate)
+					decode_stream_texture(*item);
+			}
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Failed to load " << item->name << ": " << e.what() << std::endl;
+			item->failed = true;
+		}
+		std::lock_guard<std::mutex> lock(state.ready_mutex);
+		state.ready.push_back(item);
+	});
+}
+
+// Stream a batch of textures, each target shows the request's placeholder until its texture has loaded
+void stream_textures(const std::vector<texture_request>& requests)
+{
+	asset_stream_state& state = asset_stream();
+	for (const texture_request& request : requests) {
+		if (request.kind == TEXTURE_CUBEMAP && request.files.size() != 6) {
+			std::cerr << "Error: Cubemap requires exactly 6 faces." << std::endl;
+			continue;
+		}
+		std::shared_ptr<stream_item> item = std::make_shared<stream_item>();
+		item->name = request.files[0];
+		item->request = request;
+		item->images = request_images(request);
+		*request.target = request.kind == TEXTURE_CUBEMAP ? state.cube_placeholder : state.placeholders[request.placeholder];
+		submit_stream_item(item);
+	}
+}
+
+// Stream every map of a material set into its arrays, draws use placeholder values for a map until it has loaded
+// Only the mask layout the set samples is loaded, unless both_layouts asks for the separate and packed masks
+void stream_material_set(material_set& set, bool both_layouts = false)
+{
+	for (int m = 0; m < (int)set.materials.size(); m++) {
+		for (int map = 0; map < NUM_MATERIAL_MAPS; map++) {
+			const material_desc& desc = set.materials[m];
+			if (desc.files[map].empty())
+				continue;
+			bool packed_map = map == MATERIAL_ORMH;
+			bool mask_map = map >= MATERIAL_AO && !packed_map;
+			if (!both_layouts && ((packed_map && !set.packed) || (mask_map && set.packed)))
+				continue;
+			std::shared_ptr<stream_item> item = std::make_shared<stream_item>();
+			item->name = desc.files[map];
+			item->request = material_map_request(desc, (material_map)map);
+			item->images = request_images(item->request);
+			item->materials = &set;
+			item->material = m;
+			item->map = (material_map)map;
+			submit_stream_item(item);
+		}
+	}
+}
+
+// Stream an OBJ into a range of the packed arena, target stays empty (and draws nothing) until it is uploaded
+void stream_obj_mesh(indexed_mesh* target, const char* filename, const char* base_folder, bool uses_normal, geometry_arena& arena)
+{
+	std::shared_ptr<stream_item> item = std::make_shared<stream_item>();
+	item->is_mesh = true;
+	item->name = filename;
+	item->base_folder = base_folder;
+	item->uses_normal = uses_normal;
+	item->mesh_target = target;
+	item->arena = &arena;
+	*target = indexed_mesh();
+	submit_stream_item(item);
+}
+
+// Create the immutable storage of a texture item and list the levels to upload
+// Material maps go into their set's array instead, false if the map does not fit it
+bool start_texture_upload(stream_item& item)
+{
+	int num_levels;
+	const decoded_image& first = item.images[0];
+	int width = first.width, height = first.height;
+	if (item.materials) {
+		if (!material_array_for(*item.materials, item.map, first.baked)) {
+			std::cerr << "Material map " << item.name << " is " << baked_format_name(first.baked.format) << ", unlike the rest of its array." << std::endl;
+			return false;
+		}
+		item.format = item.materials->formats[material_map_array(item.map)];
+		int base_level = material_base_level(first.baked);
+		add_baked_slices(item.slices, first.baked, base_level, base_level, first.baked.num_levels, material_layer(item.map, item.material));
+		return true;
+	}
+	if (item.request.kind == TEXTURE_MIPMAPS) {
+		num_levels = valid_mip_levels(item.images);
+		item.format = first.channels == 4 ? GL_RGBA8 : GL_RGB8;
+		for (int c = 0; c < num_levels; c++) {
+			const decoded_image& img = item.images[c];
+			item.slices.push_back(stream_slice{ img.pixels, c, 0, img.width, img.height, (size_t)img.width * img.channels, img.height });
+		}
+	}
+	else {
+		// Only the small levels of a streamed texture are uploaded now
+		item.streamed_mips = texture_streams_mips(item.request);
+		item.first_level = item.streamed_mips ? texture_stream_start_level(first.baked) : 0;
+		num_levels = first.baked.num_levels - item.first_level;
+		width = mip_extent(first.width, item.first_level);
+		height = mip_extent(first.height, item.first_level);
+		item.format = first.baked.format;
+		for (size_t face = 0; face < item.images.size(); face++) {
+			add_baked_slices(item.slices, item.images[face].baked, item.first_level, item.first_level, first.baked.num_levels, (GLint)face);
+		}
+	}
+
+	glCreateTextures(item.request.kind == TEXTURE_CUBEMAP ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, 1, &item.texture);
+	glTextureStorage2D(item.texture, num_levels, item.format, width, height);
+
+	if (item.request.kind == TEXTURE_CUBEMAP) {
+		glTextureParameteri(item.texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(item.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(item.texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(item.texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(item.texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+	else {
+		set_texture_sampling(item.texture, item.request.kind, num_levels, item.streamed_mips);
+	}
+	return true;
+}
+
+// Upload up to budget bytes of a texture item, returns the bytes used
+// At least one row is always uploaded so a row bigger than the budget still makes progress
+size_t upload_texture_step(stream_item& item, size_t budget)
+{
+	asset_stream_state& state = asset_stream();
+	if (!item.started) {
+		item.started = true;
+		if (!start_texture_upload(item)) {
+			item.failed = true;
+			return 0;
+		}
+	}
+
+	const stream_slice& slice = item.slices[item.slice];
+	// Cubemap faces and array layers are both uploaded as slices of a 3D image
+	bool layered = item.request.kind == TEXTURE_CUBEMAP || item.materials;
+	GLuint texture = item.materials ? item.materials->arrays[material_map_array(item.map)] : item.texture;
+	GLenum upload_format = item.request.kind == TEXTURE_MIPMAPS ? (item.format == GL_RGBA8 ? GL_RGBA : GL_RGB) : baked_upload_format(item.format);
+	size_t bytes = upload_slice_rows(state.pbo, texture, layered, item.format, upload_format, slice, item.offset, budget);
+
+	item.offset += bytes;
+	if (item.offset >= slice.row_bytes * slice.rows) {
+		item.slice++;
+		item.offset = 0;
+	}
+	item.uploaded = item.slice == item.slices.size();
+	return bytes;
+}
+
+// Upload up to budget bytes of a mesh item, vertices first and then indices
+size_t upload_mesh_step(stream_item& item, size_t budget)
+{
+	const indexed_mesh& mesh = item.mesh;
+	// Warm loads upload from the mapped cache file without copying it first
+	mesh_upload_data data = mesh_upload_source(mesh);
+	size_t vertex_bytes = (size_t)data.num_vertices * sizeof(packed_vertex);
+	size_t index_bytes = (size_t)data.num_indices * sizeof(uint32_t);
+	geometry_arena& arena = *item.arena;
+	if (!item.started) {
+		item.started = true;
+		// The range is fixed now, the buffers may still be reallocated by later meshes
+		arena_range range = allocate_arena_range(arena, data.num_vertices, data.num_indices);
+		item.mesh.base_vertex = range.base_vertex;
+		item.mesh.first_index = range.first_index;
+	}
+	size_t vertex_start = (size_t)mesh.base_vertex * sizeof(packed_vertex);
+	size_t index_start = (size_t)mesh.first_index * sizeof(uint32_t);
+
+	size_t bytes = std::min(std::max(budget, (size_t)1), vertex_bytes + index_bytes - item.offset);
+	size_t end = item.offset + bytes;
+	if (item.offset < vertex_bytes) {
+		size_t chunk_end = std::min(end, vertex_bytes);
+		glNamedBufferSubData(arena.vbo, vertex_start + item.offset, chunk_end - item.offset, (const unsigned char*)data.vertices + item.offset);
+	}
+	if (end > vertex_bytes) {
+		size_t start = std::max(item.offset, vertex_bytes) - vertex_bytes;
+		glNamedBufferSubData(arena.ebo, index_start + start, end - vertex_bytes - start, (const unsigned char*)data.indices + start);
+	}
+	item.offset = end;
+	item.uploaded = item.offset >= vertex_bytes + index_bytes;
+	return bytes;
+}
+
+// Hand a fully uploaded item over to the scene
+void finish_stream_item(stream_item& item)
+{
+	if (item.is_mesh) {
+		// The data lives in the buffers now, keep only what drawing needs
+		release_mesh_data(item.mesh);
+		*item.mesh_target = std::move(item.mesh);
+		printf("Streamed mesh %s.\n", item.name.c_str());
+		return;
+	}
+	if (item.materials) {
+		set_material_resident(*item.materials, item.material, item.map, item.images[0].baked);
+		printf("Streamed material map %s.\n", item.name.c_str());
+		return;
+	}
+	*item.request.target = item.texture;
+	item.texture = 0;
+	printf("Streamed texture %s.\n", item.name.c_str());
+}
+
+// Upload finished loads within a per frame byte budget, call once a frame on the GL thread
+void pump_asset_stream(size_t budget = ASSET_UPLOAD_BUDGET)
+{
+	asset_stream_state& state = asset_stream();
+	while (budget > 0) {
+		if (!state.uploading) {
+			std::lock_guard<std::mutex> lock(state.ready_mutex);
+			if (state.ready.empty())
+				break;
+			state.uploading = state.ready.front();
+			state.ready.pop_front();
+		}
+
+		stream_item& item = *state.uploading;
+		if (item.duplicate) {
+			resolve_texture(item.key, item.request.target);
+			printf("Shared texture %s with an earlier request.\n", item.name.c_str());
+			state.uploading.reset();
+			state.pending--;
+			continue;
+		}
+		if (!item.failed) {
+			size_t used = item.is_mesh ? upload_mesh_step(item, budget) : upload_texture_step(item, budget);
+			budget -= std::min(used, budget);
+		}
+		if (item.failed || item.uploaded) {
+			// Failed items keep their placeholder
+			if (!item.failed)
+				finish_stream_item(item);
+			if (!item.is_mesh && !item.materials)
+				register_texture(item.key, item.failed ? 0 : *item.request.target, texture_gpu_bytes(item.request, item.images), texture_decode_seconds(item.images));
+			// The streamer keeps the whole chain to upload the larger levels from later
+			if (!item.failed && item.streamed_mips)
+				stream_texture_mips(item.name, item.request.target, item.request.kind, std::move(item.images[0].baked), item.first_level);
+			if (item.texture)
+				glDeleteTextures(1, &item.texture);
+			state.uploading.reset();
+			state.pending--;
+		}
+	}
+}
+
+// Requests still loading or uploading
+int asset_stream_pending()
+{
+	return asset_stream().pending;
+}
+
+// Skip loads that have not started and free the GL objects
+// Loads already running finish when the loader threads are joined at exit
+void shutdown_asset_stream()
+{
+	asset_stream_state& state = asset_stream();
+	state.cancelled = true;
+	{
+		std::lock_guard<std::mutex> lock(state.ready_mutex);
+		state.ready.clear();
+	}
+	if (state.uploading && state.uploading->texture)
+		glDeleteTextures(1, &state.uploading->texture);
+	state.uploading.reset();
+	glDeleteTextures(NUM_PLACEHOLDERS, state.placeholders);
+	glDeleteTextures(1, &state.cube_placeholder);
+	glDeleteBuffers(1, &state.pbo);
+}
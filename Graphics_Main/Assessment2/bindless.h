@@ -0,0 +1,186 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+#include "shader.h"
+
+// Textures of the objects that do not use the material arrays, one entry per object
+// With ARB_bindless_texture every entry's handles live in an SSBO and a draw only picks its entry,
+// without it each entry's textures are bound to the fixed units of its samplers before the draw
+
+// Set to 0 to always bind texture units
+#define USE_BINDLESS_TEXTURES 1
+// Shader storage binding of the handle table, must match lighting_fragment.frag
+#define TEXTURE_TABLE_BINDING 3
+// Defines the shaders are compiled with in bindless mode
+#define BINDLESS_SHADER_DEFINES "#define BINDLESS_TEXTURES 1\n"
+
+// Must match the TEXTURE_SLOT_ defines in lighting_fragment.frag
+enum texture_slot
+{
+	TEXTURE_SLOT_BASE,
+	TEXTURE_SLOT_GLOW,
+	TEXTURE_SLOT_NORMAL,
+	TEXTURE_SLOT_SPECULAR,
+	TEXTURE_SLOT_BUMP,
+	NUM_TEXTURE_SLOTS
+};
+
+// Samplers each slot is read through without bindless, and the units they are bound to
+static const char* texture_slot_samplers[NUM_TEXTURE_SLOTS] = { "tex0", "glow_map", "normal_map", "specular_map", "bump_map" };
+static const int texture_slot_units[NUM_TEXTURE_SLOTS] = { 3, 4, 5, 6, 7 };
+
+// Textures of one object, pointing at the handles the asset stream writes so streamed textures are picked up
+// Slots the object does not use are null
+struct texture_material
+{
+	GLuint* textures[NUM_TEXTURE_SLOTS] = {};
+};
+
+struct texture_table
+{
+	bool bindless = false;
+	std::vector<texture_material> materials;
+
+	// Texture each handle was made from, a change means the texture streamed in
+	std::vector<GLuint> handle_textures;
+	std::vector<GLuint64> handles;
+	// A handle may only be made resident once, placeholders are shared by many slots
+	// Handles no slot uses any more are made non resident again
+	std::unordered_set<GLuint64> resident;
+	GLuint ssbo = 0;
+};
+
+// ARB_bindless_texture entry points, gl3w only loads core functions
+struct bindless_functions
+{
+	PFNGLGETTEXTUREHANDLEARBPROC GetTextureHandle = nullptr;
+	PFNGLMAKETEXTUREHANDLERESIDENTARBPROC MakeTextureHandleResident = nullptr;
+	PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC MakeTextureHandleNonResident = nullptr;
+};
+
+bindless_functions& bindless_gl()
+{
+	static bindless_functions functions;
+	return functions;
+}
+
+// Whether the driver has bindless textures, loading its functions if so, call after gl3wInit
+bool init_bindless_textures()
+{
+	if (!USE_BINDLESS_TEXTURES || !has_gl_extension("GL_ARB_bindless_texture"))
+		return false;
+	bindless_functions& gl = bindless_gl();
+	gl.GetTextureHandle = (PFNGLGETTEXTUREHANDLEARBPROC)gl3wGetProcAddress("glGetTextureHandleARB");
+	gl.MakeTextureHandleResident = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)gl3wGetProcAddress("glMakeTextureHandleResidentARB");
+	gl.MakeTextureHandleNonResident = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)gl3wGetProcAddress("glMakeTextureHandleNonResidentARB");
+	return gl.GetTextureHandle && gl.MakeTextureHandleResident && gl.MakeTextureHandleNonResident;
+}
+
+// Compile a program reading its textures through the table, bindless if the driver supports it
+// A driver that lists the extension but fails to build the bindless shaders falls back to bound units
+// defines are added in both modes
+GLuint compile_texture_table_program(const char* vsFilename, const char* fsFilename, texture_table& table, const char* defines = "")
+{
+	table.bindless = init_bindless_textures();
+	if (table.bindless) {
+		std::string bindless_defines = std::string(BINDLESS_SHADER_DEFINES) + defines;
+		GLuint program = CompileShader(vsFilename, fsFilename, bindless_defines.c_str());
+		if (ShaderLinked(program)) {
+			printf("Textures: bindless handles in an SSBO.\n");
+			return program;
+		}
+		DeleteProgram(program);
+		table.bindless = false;
+		fprintf(stderr, "Bindless shaders failed to build, falling back to texture units.\n");
+	}
+	printf("Textures: bound to texture units.\n");
+	return CompileShader(vsFilename, fsFilename, defines);
+}
+
+// Index of the new entry
+int add_texture_material(texture_table& table, const texture_material& material)
+{
+	table.materials.push_back(material);
+	return (int)table.materials.size() - 1;
+}
+
+// Make handles for textures that have changed since the last call and upload the table if any did
+// Call once a frame on the GL thread, does nothing when binding units
+void update_texture_table(texture_table& table)
+{
+	if (!table.bindless)
+		return;
+	bindless_functions& gl = bindless_gl();
+	size_t count = table.materials.size() * NUM_TEXTURE_SLOTS;
+	bool changed = table.handles.size() != count;
+	table.handles.resize(count, 0);
+	table.handle_textures.resize(count, 0);
+	for (size_t m = 0; m < table.materials.size(); m++) {
+		for (int slot = 0; slot < NUM_TEXTURE_SLOTS; slot++) {
+			GLuint* texture = table.materials[m].textures[slot];
+			size_t i = m * NUM_TEXTURE_SLOTS + slot;
+			if (!texture || *texture == 0 || *texture == table.handle_textures[i])
+				continue;
+			GLuint64 handle = gl.GetTextureHandle(*texture);
+			if (table.resident.insert(handle).second)
+				gl.MakeTextureHandleResident(handle);
+			GLuint64 previous = table.handles[i];
+			table.handles[i] = handle;
+			table.handle_textures[i] = *texture;
+			changed = true;
+			// Textures the streamer replaces are deleted a frame later, their handles must be released before then
+			if (previous && std::find(table.handles.begin(), table.handles.end(), previous) == table.handles.end()) {
+				gl.MakeTextureHandleNonResident(previous);
+				table.resident.erase(previous);
+			}
+		}
+	}
+	if (!changed)
+		return;
+	if (table.ssbo == 0)
+		glCreateBuffers(1, &table.ssbo);
+	glNamedBufferData(table.ssbo, table.handles.size() * sizeof(GLuint64), table.handles.data(), GL_DYNAMIC_DRAW);
+}
+
+// Point the program at the table, call after glUseProgram and before the first use_texture_material
+void bind_texture_table(const texture_table& table, GLuint program)
+{
+	if (table.bindless) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TEXTURE_TABLE_BINDING, table.ssbo);
+		return;
+	}
+	for (int slot = 0; slot < NUM_TEXTURE_SLOTS; slot++) {
+		set_uniform(program, texture_slot_samplers[slot], texture_slot_units[slot]);
+	}
+}
+
+// Bind an entry's textures for the following draws, bindless draws pick their entry through the render material instead
+void use_texture_material(const texture_table& table, int material)
+{
+	if (table.bindless)
+		return;
+	for (int slot = 0; slot < NUM_TEXTURE_SLOTS; slot++) {
+		GLuint* texture = table.materials[material].textures[slot];
+		if (texture)
+			glBindTextureUnit(texture_slot_units[slot], *texture);
+	}
+}
+
+void delete_texture_table(texture_table& table)
+{
+	for (GLuint64 handle : table.resident) {
+		bindless_gl().MakeTextureHandleNonResident(handle);
+	}
+	table.resident.clear();
+	glDeleteBuffers(1, &table.ssbo);
+	table.ssbo = 0;
+}
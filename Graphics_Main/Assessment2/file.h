@@ -2,6 +2,18 @@
 
 #include <iostream>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 char* read_file(const char* filename)
 {
@@ -20,4 +32,170 @@ char* read_file(const char* filename)
 		return NULL;
 	bfr[size] = '\0';
 	return bfr;
-}
\ No newline at end of file
+}
+
+// Read only view of a whole file mapped into memory
+struct mapped_file
+{
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+};
+
+bool map_file(const char* filename, mapped_file* out_map)
+{
+#ifdef _WIN32
+	out_map->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (out_map->file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(out_map->file, &size) || size.QuadPart == 0) {
+		CloseHandle(out_map->file);
+		out_map->file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	out_map->mapping = CreateFileMappingA(out_map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (out_map->mapping == NULL) {
+		CloseHandle(out_map->file);
+		out_map->file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	out_map->data = (const unsigned char*)MapViewOfFile(out_map->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (out_map->data == NULL) {
+		CloseHandle(out_map->mapping);
+		CloseHandle(out_map->file);
+		out_map->mapping = NULL;
+		out_map->file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+	out_map->size = (size_t)size.QuadPart;
+	return true;
+#else
+	out_map->fd = open(filename, O_RDONLY);
+	if (out_map->fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(out_map->fd, &st) != 0 || st.st_size == 0) {
+		close(out_map->fd);
+		out_map->fd = -1;
+		return false;
+	}
+
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, out_map->fd, 0);
+	if (data == MAP_FAILED) {
+		close(out_map->fd);
+		out_map->fd = -1;
+		return false;
+	}
+	out_map->data = (const unsigned char*)data;
+	out_map->size = (size_t)st.st_size;
+	return true;
+#endif
+}
+
+void unmap_file(mapped_file* map)
+{
+#ifdef _WIN32
+	if (map->data)
+		UnmapViewOfFile(map->data);
+	if (map->mapping)
+		CloseHandle(map->mapping);
+	if (map->file != INVALID_HANDLE_VALUE)
+		CloseHandle(map->file);
+	map->mapping = NULL;
+	map->file = INVALID_HANDLE_VALUE;
+#else
+	if (map->data)
+		munmap((void*)map->data, map->size);
+	if (map->fd >= 0)
+		close(map->fd);
+	map->fd = -1;
+#endif
+	map->data = nullptr;
+	map->size = 0;
+}
+
+// A mapping that unmaps itself, it can be moved but not copied so no two owners unmap the same view
+struct owned_mapped_file
+{
+	mapped_file map;
+
+	owned_mapped_file() {}
+	explicit owned_mapped_file(const mapped_file& mapped) : map(mapped) {}
+	owned_mapped_file(const owned_mapped_file&) = delete;
+	owned_mapped_file& operator=(const owned_mapped_file&) = delete;
+	owned_mapped_file(owned_mapped_file&& other) : map(other.map)
+	{
+		other.map = mapped_file();
+	}
+	owned_mapped_file& operator=(owned_mapped_file&& other)
+	{
+		if (this != &other) {
+			reset();
+			map = other.map;
+			other.map = mapped_file();
+		}
+		return *this;
+	}
+	~owned_mapped_file()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		if (map.data)
+			unmap_file(&map);
+		map = mapped_file();
+	}
+};
+
+// Get modification time and size of the source file, false if it does not exist
+bool get_file_stamp(const char* filename, int64_t* out_mtime, uint64_t* out_size)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(filename, &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return false;
+#endif
+	*out_mtime = (int64_t)st.st_mtime;
+	*out_size = (uint64_t)st.st_size;
+	return true;
+}
+
+// 64 bit hash of a whole file's contents, false if it cannot be read
+bool hash_file(const char* filename, uint64_t* out_hash)
+{
+	mapped_file map;
+	if (!map_file(filename, &map))
+		return false;
+
+	// FNV-1a style mixing over 8 byte words, the tail a byte at a time
+	uint64_t hash = 14695981039346656037ULL ^ (uint64_t)map.size;
+	size_t i = 0;
+	for (; i + 8 <= map.size; i += 8) {
+		uint64_t word;
+		memcpy(&word, map.data + i, 8);
+		hash = (hash ^ word) * 1099511628211ULL;
+		hash ^= hash >> 29;
+	}
+	for (; i < map.size; i++) {
+		hash = (hash ^ map.data[i]) * 1099511628211ULL;
+	}
+	unmap_file(&map);
+	*out_hash = hash;
+	return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+
+// Camera and light values every program shares, uploaded once a frame into two uniform buffers
+// The buffers stay bound to fixed binding points, so switching programs uploads nothing
+// The structs follow the std140 layout of the FrameData and LightData blocks in the shaders
+
+// Uniform buffer bindings, must match the binding qualifiers of the blocks
+#define FRAME_DATA_BINDING 0
+#define LIGHT_DATA_BINDING 1
+// Must match NUM_SPOTS in lighting_fragment.frag
+#define MAX_SPOT_LIGHTS 4
+
+// A vec3 followed by a float shares one 16 byte slot, a vec3 followed by another vec3 is padded
+struct frame_data
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 projectedLightSpaceMatrix;
+	glm::vec3 camPos;
+	float time;
+};
+
+struct light_data
+{
+	// Directional Lighting
+	glm::vec3 lightDirection;
+	float pad0;
+	glm::vec3 lightColour;
+	float pad1;
+	glm::vec3 lightPos;
+	float pad2;
+
+	// Spot Lighting
+	glm::vec3 spotColour;
+	float spotLightInnerCutoff;
+	glm::vec3 spotLightPos;
+	float spotLightOuterCutoff;
+	// Array elements of std140 are 16 bytes apart, w is unused
+	glm::vec4 spotLightDirections[MAX_SPOT_LIGHTS];
+
+	// Positional Lighting
+	glm::vec3 posColour;
+	int posActive;
+	glm::vec3 posLightPos;
+
+	// Environment Lighting
+	float environmentIntensity;
+	glm::vec3 ambientLight;
+	float pad3;
+};
+
+// Offsets std140 gives the block members
+static_assert(sizeof(frame_data) == 208 && offsetof(frame_data, camPos) == 192 && offsetof(frame_data, time) == 204, "frame_data does not match FrameData");
+static_assert(offsetof(light_data, spotColour) == 48 && offsetof(light_data, spotLightDirections) == 80 && offsetof(light_data, posColour) == 144, "light_data does not match LightData");
+static_assert(offsetof(light_data, posActive) == 156 && offsetof(light_data, environmentIntensity) == 172 && sizeof(light_data) == 192, "light_data does not match LightData");
+
+struct frame_uniforms
+{
+	GLuint frame_buffer = 0;
+	GLuint light_buffer = 0;
+};
+
+// Create both buffers and bind them, call once after gl3wInit
+void create_frame_uniforms(frame_uniforms& uniforms)
+{
+	glCreateBuffers(1, &uniforms.frame_buffer);
+	glNamedBufferStorage(uniforms.frame_buffer, sizeof(frame_data), nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glCreateBuffers(1, &uniforms.light_buffer);
+	glNamedBufferStorage(uniforms.light_buffer, sizeof(light_data), nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, uniforms.frame_buffer);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_DATA_BINDING, uniforms.light_buffer);
+}
+
+// Upload the frame's values, call once a frame before the first draw
+void upload_frame_uniforms(const frame_uniforms& uniforms, const frame_data& frame, const light_data& lights)
+{
+	glNamedBufferSubData(uniforms.frame_buffer, 0, sizeof(frame), &frame);
+	glNamedBufferSubData(uniforms.light_buffer, 0, sizeof(lights), &lights);
+}
+
+void delete_frame_uniforms(frame_uniforms& uniforms)
+{
+	glDeleteBuffers(1, &uniforms.frame_buffer);
+	glDeleteBuffers(1, &uniforms.light_buffer);
+	uniforms = frame_uniforms();
+}
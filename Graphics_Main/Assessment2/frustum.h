@@ -0,0 +1,173 @@
+#pragma once
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+
+// View frustum tests of object bounds, a sphere test first and a box test only where the sphere crosses a plane
+// The six planes are tested four at a time with SSE
+
+// SSE is always there on x64 builds, other targets use the plain float path
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define FRUSTUM_SIMD 1
+#else
+#define FRUSTUM_SIMD 0
+#endif
+
+// Object space bounds, computed once when the vertices are made
+struct bounding_volume
+{
+	glm::vec3 box_min = glm::vec3(0.f);
+	glm::vec3 box_max = glm::vec3(0.f);
+	glm::vec3 centre = glm::vec3(0.f);
+	float radius = 0.f;
+};
+
+// Inward facing planes, normalized, as structure of arrays padded to eight by repeating the last plane
+struct frustum
+{
+	alignas(16) float nx[8];
+	alignas(16) float ny[8];
+	alignas(16) float nz[8];
+	alignas(16) float d[8];
+};
+
+// Box around the positions at the start of each vertex, and the sphere around the box centre holding them
+bounding_volume vertex_bounding_volume(const GLfloat* vertices, size_t num_vertices, int floats_per_vertex)
+{
+	bounding_volume bounds;
+	if (num_vertices == 0)
+		return bounds;
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (size_t i = 0; i < num_vertices; i++) {
+		const GLfloat* v = &vertices[i * floats_per_vertex];
+		lo = glm::min(lo, glm::vec3(v[0], v[1], v[2]));
+		hi = glm::max(hi, glm::vec3(v[0], v[1], v[2]));
+	}
+	bounds.box_min = lo;
+	bounds.box_max = hi;
+	bounds.centre = (lo + hi) * 0.5f;
+	for (size_t i = 0; i < num_vertices; i++) {
+		const GLfloat* v = &vertices[i * floats_per_vertex];
+		bounds.radius = std::max(bounds.radius, glm::length(glm::vec3(v[0], v[1], v[2]) - bounds.centre));
+	}
+	return bounds;
+}
+
+// Planes of a clip space matrix (Gribb and Hartmann), whatever lies outside them is clipped
+frustum make_frustum(const glm::mat4& view_projection)
+{
+	const glm::mat4& m = view_projection;
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+	}
+	glm::vec4 planes[6] = {
+		rows[3] + rows[0], rows[3] - rows[0],
+		rows[3] + rows[1], rows[3] - rows[1],
+		rows[3] + rows[2], rows[3] - rows[2],
+	};
+	frustum f;
+	for (int i = 0; i < 8; i++) {
+		glm::vec4 plane = planes[std::min(i, 5)];
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.f)
+			plane /= length;
+		f.nx[i] = plane.x;
+		f.ny[i] = plane.y;
+		f.nz[i] = plane.z;
+		f.d[i] = plane.w;
+	}
+	return f;
+}
+
+enum frustum_test
+{
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE
+};
+
+// World space sphere against every plane
+frustum_test sphere_in_frustum(const frustum& f, const glm::vec3& centre, float radius)
+{
+#if FRUSTUM_SIMD
+	__m128 cx = _mm_set1_ps(centre.x), cy = _mm_set1_ps(centre.y), cz = _mm_set1_ps(centre.z);
+	__m128 r = _mm_set1_ps(radius), neg_r = _mm_set1_ps(-radius);
+	int outside = 0, crossing = 0;
+	for (int i = 0; i < 8; i += 4) {
+		__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(f.nx + i), cx), _mm_mul_ps(_mm_load_ps(f.ny + i), cy)),
+			_mm_add_ps(_mm_mul_ps(_mm_load_ps(f.nz + i), cz), _mm_load_ps(f.d + i)));
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(dist, neg_r));
+		crossing |= _mm_movemask_ps(_mm_cmplt_ps(dist, r));
+	}
+#else
+	int outside = 0, crossing = 0;
+	for (int i = 0; i < 6; i++) {
+		float dist = f.nx[i] * centre.x + f.ny[i] * centre.y + f.nz[i] * centre.z + f.d[i];
+		outside |= dist < -radius;
+		crossing |= dist < radius;
+	}
+#endif
+	if (outside)
+		return FRUSTUM_OUTSIDE;
+	return crossing ? FRUSTUM_INTERSECTS : FRUSTUM_INSIDE;
+}
+
+// World space box, given by its centre and half size, against every plane
+bool box_in_frustum(const frustum& f, const glm::vec3& centre, const glm::vec3& extent)
+{
+#if FRUSTUM_SIMD
+	__m128 cx = _mm_set1_ps(centre.x), cy = _mm_set1_ps(centre.y), cz = _mm_set1_ps(centre.z);
+	__m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+	// Clearing the sign bit gives the absolute value
+	__m128 sign = _mm_set1_ps(-0.f);
+	int outside = 0;
+	for (int i = 0; i < 8; i += 4) {
+		__m128 nx = _mm_load_ps(f.nx + i), ny = _mm_load_ps(f.ny + i), nz = _mm_load_ps(f.nz + i);
+		__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_load_ps(f.d + i)));
+		// Distance from the centre to the box corner furthest along the plane normal
+		__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, nx), ex), _mm_mul_ps(_mm_andnot_ps(sign, ny), ey)), _mm_mul_ps(_mm_andnot_ps(sign, nz), ez));
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, reach), _mm_setzero_ps()));
+	}
+	return outside == 0;
+#else
+	for (int i = 0; i < 6; i++) {
+		float dist = f.nx[i] * centre.x + f.ny[i] * centre.y + f.nz[i] * centre.z + f.d[i];
+		float reach = fabsf(f.nx[i]) * extent.x + fabsf(f.ny[i]) * extent.y + fabsf(f.nz[i]) * extent.z;
+		if (dist + reach < 0.f)
+			return false;
+	}
+	return true;
+#endif
+}
+
+// World space box around the transformed object box (Arvo 1990), as its centre and half size
+void world_box(const glm::mat4& model, const bounding_volume& bounds, glm::vec3& centre, glm::vec3& extent)
+{
+	centre = glm::vec3(model * glm::vec4((bounds.box_min + bounds.box_max) * 0.5f, 1.f));
+	glm::vec3 half = (bounds.box_max - bounds.box_min) * 0.5f;
+	extent = glm::vec3(0.f);
+	for (int column = 0; column < 3; column++) {
+		extent += glm::abs(glm::vec3(model[column])) * half[column];
+	}
+}
+
+// Whether an object with the given model matrix can be inside the frustum
+bool bounds_in_frustum(const frustum& f, const glm::mat4& model, const bounding_volume& bounds)
+{
+	// The sphere grows with the largest axis scale of the model
+	glm::vec3 centre = glm::vec3(model * glm::vec4(bounds.centre, 1.f));
+	float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	frustum_test test = sphere_in_frustum(f, centre, bounds.radius * scale);
+	if (test != FRUSTUM_INTERSECTS)
+		return test == FRUSTUM_INSIDE;
+
+	glm::vec3 box_centre, extent;
+	world_box(model, bounds, box_centre, extent);
+	return box_in_frustum(f, box_centre, extent);
+}
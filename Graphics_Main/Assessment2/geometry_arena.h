@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+// One vertex buffer and one index buffer shared by every mesh of a vertex format, each mesh gets a range of both
+// Draws pick their mesh with a base vertex and first index, so every mesh of a format is drawn from one VAO
+// Indices stay relative to the mesh, the base vertex is added when drawing
+
+// Starting sizes, an arena doubles whenever a mesh does not fit
+#define ARENA_START_VERTICES (64 * 1024)
+#define ARENA_START_INDICES (256 * 1024)
+
+struct geometry_arena
+{
+	const char* name = "";
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	GLuint ebo = 0;
+	GLsizei stride = 0;
+	// Attribute layout of the format, called with the VAO and VBO bound
+	void (*setup_attributes)() = nullptr;
+
+	uint32_t vertex_capacity = 0;
+	uint32_t vertices_used = 0;
+	uint32_t index_capacity = 0;
+	uint32_t indices_used = 0;
+	// Times the buffers were reallocated to fit a mesh
+	int grows = 0;
+};
+
+// Where a mesh lives in its arena
+struct arena_range
+{
+	int32_t base_vertex = 0;
+	uint32_t first_index = 0;
+};
+
+// Point the VAO at the arena's current buffers
+void attach_arena_buffers(geometry_arena& arena)
+{
+	glBindVertexArray(arena.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, arena.vbo);
+	arena.setup_attributes();
+	glVertexArrayElementBuffer(arena.vao, arena.ebo);
+	glBindVertexArray(0);
+}
+
+void init_geometry_arena(geometry_arena& arena, const char* name, GLsizei stride, void (*setup_attributes)())
+{
+	arena.name = name;
+	arena.stride = stride;
+	arena.setup_attributes = setup_attributes;
+	arena.vertex_capacity = ARENA_START_VERTICES;
+	arena.index_capacity = ARENA_START_INDICES;
+	glCreateVertexArrays(1, &arena.vao);
+	glCreateBuffers(1, &arena.vbo);
+	glCreateBuffers(1, &arena.ebo);
+	glNamedBufferData(arena.vbo, (GLsizeiptr)arena.vertex_capacity * stride, NULL, GL_STATIC_DRAW);
+	glNamedBufferData(arena.ebo, (GLsizeiptr)arena.index_capacity * sizeof(uint32_t), NULL, GL_STATIC_DRAW);
+	attach_arena_buffers(arena);
+}
+
+// Copy the used part of a buffer into a new one of the given size
+GLuint grow_arena_buffer(GLuint buffer, size_t used_bytes, size_t new_bytes)
+{
+	GLuint grown;
+	glCreateBuffers(1, &grown);
+	glNamedBufferData(grown, (GLsizeiptr)new_bytes, NULL, GL_STATIC_DRAW);
+	if (used_bytes > 0)
+		glCopyNamedBufferSubData(buffer, grown, 0, 0, (GLsizeiptr)used_bytes);
+	glDeleteBuffers(1, &buffer);
+	return grown;
+}
+
+// Reserve room for a mesh, growing the buffers if it does not fit
+arena_range allocate_arena_range(geometry_arena& arena, uint32_t num_vertices, uint32_t num_indices)
+{
+	bool grown = false;
+	if (arena.vertices_used + num_vertices > arena.vertex_capacity) {
+		uint32_t capacity = arena.vertex_capacity;
+		while (arena.vertices_used + num_vertices > capacity)
+			capacity *= 2;
+		arena.vbo = grow_arena_buffer(arena.vbo, (size_t)arena.vertices_used * arena.stride, (size_t)capacity * arena.stride);
+		arena.vertex_capacity = capacity;
+		grown = true;
+	}
+	if (arena.indices_used + num_indices > arena.index_capacity) {
+		uint32_t capacity = arena.index_capacity;
+		while (arena.indices_used + num_indices > capacity)
+			capacity *= 2;
+		arena.ebo = grow_arena_buffer(arena.ebo, (size_t)arena.indices_used * sizeof(uint32_t), (size_t)capacity * sizeof(uint32_t));
+		arena.index_capacity = capacity;
+		grown = true;
+	}
+	if (grown) {
+		attach_arena_buffers(arena);
+		arena.grows++;
+	}
+
+	arena_range range;
+	range.base_vertex = (int32_t)arena.vertices_used;
+	range.first_index = arena.indices_used;
+	arena.vertices_used += num_vertices;
+	arena.indices_used += num_indices;
+	return range;
+}
+
+// Allocate a range and fill it, indices relative to the first vertex
+arena_range add_arena_geometry(geometry_arena& arena, const void* vertices, uint32_t num_vertices, const uint32_t* indices, uint32_t num_indices)
+{
+	arena_range range = allocate_arena_range(arena, num_vertices, num_indices);
+	glNamedBufferSubData(arena.vbo, (GLintptr)range.base_vertex * arena.stride, (GLsizeiptr)num_vertices * arena.stride, vertices);
+	glNamedBufferSubData(arena.ebo, (GLintptr)range.first_index * sizeof(uint32_t), (GLsizeiptr)num_indices * sizeof(uint32_t), indices);
+	return range;
+}
+
+void print_geometry_arena(const geometry_arena& arena)
+{
+	printf("Geometry arena %s: %u of %u vertices, %u of %u indices, %.1f MB, grown %d times.\n", arena.name,
+		arena.vertices_used, arena.vertex_capacity, arena.indices_used, arena.index_capacity,
+		((double)arena.vertex_capacity * arena.stride + (double)arena.index_capacity * sizeof(uint32_t)) / (1024.0 * 1024.0), arena.grows);
+}
+
+void delete_geometry_arena(geometry_arena& arena)
+{
+	glDeleteVertexArrays(1, &arena.vao);
+	glDeleteBuffers(1, &arena.vbo);
+	glDeleteBuffers(1, &arena.ebo);
+	arena = geometry_arena();
+}
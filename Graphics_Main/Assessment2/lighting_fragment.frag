@@ -1,4 +1,7 @@
 #version 450 core
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
 
 layout (location = 0) out vec4 fColour;
 
@@ -7,74 +10,166 @@ in vec4 colour;
 in vec3 nor;
 in vec3 FragPosWorldSpace;
 in vec4 FragPosProjectedLightSpace;
+flat in int drawMaterial;
+
+// Settings of every render material, must match material_data in render_queue.h
+// The per object values below are read from the draw's entry at the start of main
+#define MATERIAL_USES_TEXTURE 1
+#define MATERIAL_USES_GLOW 2
+#define MATERIAL_USES_NORMAL 4
+#define MATERIAL_USES_SPECULAR 8
+#define MATERIAL_USES_PBR 16
+#define MATERIAL_USES_PARRALLAX 32
+// Variants compiled with MATERIAL_FEATURES, see shader_variants.h, make every uses_ flag a constant so the paths it skips are compiled out
+// The generic program reads the flags from the draw's material instead
+#ifdef MATERIAL_FEATURES
+#define FEATURE_FLAG const bool
+#define FEATURE_VALUE(bit) ((MATERIAL_FEATURES & bit) != 0)
+#else
+#define FEATURE_FLAG bool
+#define FEATURE_VALUE(bit) false
+#endif
+struct MaterialData
+{
+    // Texture table entry, material array layer or -1, MATERIAL_USES_ bits
+    ivec4 info;
+    // Shininess, texture scale, bump scale, parallax height scale
+    vec4 params;
+};
+layout(std430, binding = 5) readonly buffer MaterialTable
+{
+    MaterialData materials[];
+};
 
-uniform float shininess;
+float shininess = 64.0;
 
 // Tangent Space
 in mat3 TBN;
 
 // Texture Scaling
-uniform float uv_scale;
+float uv_scale = 1.0;
 
 // Shadows
 uniform sampler2D shadowMap;
 
-// Directional Lighting
-uniform vec3 lightDirection;
-uniform vec3 lightColour;
-uniform vec3 lightPos;
-uniform vec3 camPos;
+// Camera values of the frame, must match frame_data in frame_uniforms.h
+layout(std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 projectedLightSpaceMatrix;
+    vec3 camPos;
+    float time;
+};
 
 // Spot Lighting
 #define NUM_SPOTS 4
-uniform vec3 spotLightDirections[NUM_SPOTS];
-uniform vec3 spotColour;
-uniform vec3 spotLightPos;
-uniform float spotLightInnerCutoff; 
-uniform float spotLightOuterCutoff; 
 
-
-// Positional Lighting
-uniform bool posActive;
-uniform vec3 posColour;
-uniform vec3 posLightPos;
+// Lights of the frame, must match light_data in frame_uniforms.h
+layout(std140, binding = 1) uniform LightData
+{
+    // Directional Lighting
+    vec3 lightDirection;
+    vec3 lightColour;
+    vec3 lightPos;
+
+    // Spot Lighting
+    vec3 spotColour;
+    float spotLightInnerCutoff;
+    vec3 spotLightPos;
+    float spotLightOuterCutoff;
+    vec3 spotLightDirections[NUM_SPOTS];
+
+    // Positional Lighting
+    vec3 posColour;
+    bool posActive;
+    vec3 posLightPos;
+
+    // Environment Lighting
+    // How bright
+    float environmentIntensity;
+    // Colour
+    vec3 ambientLight;
+};
 
 // Texture 
 in vec2 texCoords;
-uniform sampler2D tex0;
-uniform bool uses_texture;
+FEATURE_FLAG uses_texture = FEATURE_VALUE(MATERIAL_USES_TEXTURE);
 
 // Advanced Texture
-uniform bool uses_specular;
-uniform bool uses_glow;
-uniform bool uses_normal;
-
-uniform float bump_scale; 
-
+FEATURE_FLAG uses_specular = FEATURE_VALUE(MATERIAL_USES_SPECULAR);
+FEATURE_FLAG uses_glow = FEATURE_VALUE(MATERIAL_USES_GLOW);
+FEATURE_FLAG uses_normal = FEATURE_VALUE(MATERIAL_USES_NORMAL);
+
+float bump_scale = 0.0;
+
+// Textures of the objects outside the material arrays
+// Slots must match texture_slot in bindless.h
+#define TEXTURE_SLOT_BASE 0
+#define TEXTURE_SLOT_GLOW 1
+#define TEXTURE_SLOT_NORMAL 2
+#define TEXTURE_SLOT_SPECULAR 3
+#define TEXTURE_SLOT_BUMP 4
+#define NUM_TEXTURE_SLOTS 5
+
+#ifdef BINDLESS_TEXTURES
+// Handles of every object's textures, the draw picks its entry through its render material
+layout(std430, binding = 3) readonly buffer TextureTable {
+    uvec2 textureHandles[];
+};
+int textureMaterial = 0;
+
+#define TEXTURE_SLOT(slot) sampler2D(textureHandles[textureMaterial * NUM_TEXTURE_SLOTS + slot])
+#define BASE_MAP TEXTURE_SLOT(TEXTURE_SLOT_BASE)
+#define GLOW_MAP TEXTURE_SLOT(TEXTURE_SLOT_GLOW)
+#define NORMAL_MAP TEXTURE_SLOT(TEXTURE_SLOT_NORMAL)
+#define SPECULAR_MAP TEXTURE_SLOT(TEXTURE_SLOT_SPECULAR)
+#else
+// Bound to fixed texture units by the application
+uniform sampler2D tex0;
 uniform sampler2D glow_map;
 uniform sampler2D normal_map;
 uniform sampler2D specular_map;
 uniform sampler2D bump_map;
 
+#define BASE_MAP tex0
+#define GLOW_MAP glow_map
+#define NORMAL_MAP normal_map
+#define SPECULAR_MAP specular_map
+#endif
+
 // Parallax Mapping
 uniform sampler2D depth_map;
-uniform float height_scale;
-uniform bool uses_parrallax;
+float height_scale = 0.0;
+FEATURE_FLAG uses_parrallax = FEATURE_VALUE(MATERIAL_USES_PARRALLAX);
 
 // PBR Textures
-uniform bool uses_pbr;
-// Base Colour texture
-uniform sampler2D albedoMap;     
-// Additional Textures for details
-uniform sampler2D metallicMap; 
-uniform sampler2D roughnessMap;  
-uniform sampler2D aoMap;        
-
-// Environment Lighting
-// Colour
-uniform vec3 ambientLight; 
-// How bright
-uniform float environmentIntensity;
+// Every PBR object reads its albedo and masks from the material arrays
+FEATURE_FLAG uses_pbr = FEATURE_VALUE(MATERIAL_USES_PBR);
+
+// Material arrays, see material_array.h
+// One layer per material in the albedo and normal arrays, MATERIAL_MASKS in the mask array
+#define MAX_MATERIALS 8
+#define MATERIAL_MASKS 4
+#define MATERIAL_ALBEDO 0
+#define MATERIAL_NORMAL 1
+#define MATERIAL_AO 2
+#define MATERIAL_ROUGHNESS 3
+#define MATERIAL_METALLIC 4
+#define MATERIAL_HEIGHT 5
+#define MATERIAL_ORMH 6
+#define MATERIAL_ALBEDO_SRGB 7
+bool uses_material = false;
+int materialIndex = 0;
+uniform sampler2DArray materialAlbedo;
+uniform sampler2DArray materialNormal;
+uniform sampler2DArray materialMasks;
+// AO, roughness, metallic and height packed into one RGBA layer per material
+uniform sampler2DArray materialOrmh;
+// Sample the packed layer instead of the four mask layers
+uniform bool materialPacked;
+// Bit per map that has loaded, the rest read their placeholder value
+uniform int materialResident[MAX_MATERIALS];
 
 // Value of Pi
 const float PI = 3.14159265359;
@@ -84,17 +179,75 @@ vec2 getScaledTexCoords() {
     return texCoords * uv_scale;
 }
 
+// ---- Material Arrays ----
+bool materialHas(int map) {
+    return (materialResident[materialIndex] & (1 << map)) != 0;
+}
+
+vec3 srgbToLinear(vec3 c) {
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), greaterThan(c, vec3(0.04045)));
+}
+
+vec4 sampleMaterialAlbedo(vec2 coords) {
+    if (!materialHas(MATERIAL_ALBEDO)) {
+        return vec4(vec3(0.5), 1.0);
+    }
+    vec4 albedo = texture(materialAlbedo, vec3(coords, materialIndex));
+    if (materialHas(MATERIAL_ALBEDO_SRGB)) {
+        albedo.rgb = srgbToLinear(albedo.rgb);
+    }
+    return albedo;
+}
+
+float sampleMaterialMask(int map, vec2 coords, float placeholder) {
+    if (!materialHas(map)) {
+        return placeholder;
+    }
+    return texture(materialMasks, vec3(coords, materialIndex * MATERIAL_MASKS + map - MATERIAL_AO)).r;
+}
+
+bool materialUsesPacked() {
+    return materialPacked && materialHas(MATERIAL_ORMH);
+}
+
+// AO, roughness, metallic and height in one fetch of the packed layer, or four of the mask layers
+vec4 sampleMaterialMasks(vec2 coords) {
+    if (materialUsesPacked()) {
+        return texture(materialOrmh, vec3(coords, materialIndex));
+    }
+    return vec4(sampleMaterialMask(MATERIAL_AO, coords, 1.0),
+                sampleMaterialMask(MATERIAL_ROUGHNESS, coords, 1.0),
+                sampleMaterialMask(MATERIAL_METALLIC, coords, 0.0),
+                sampleMaterialMask(MATERIAL_HEIGHT, coords, 0.0));
+}
+
+// Parallax depth
+float sampleDepthMap(vec2 coords) {
+    if (uses_material) {
+        return materialUsesPacked() ? texture(materialOrmh, vec3(coords, materialIndex)).a : sampleMaterialMask(MATERIAL_HEIGHT, coords, 0.0);
+    }
+    return texture(depth_map, coords).r;
+}
+
 // ---- Normal Map ----
+// Normal maps are BC5 with only x and y stored, so z is rebuilt from them
+vec3 sampleNormalMap(vec2 coords) {
+    vec2 xy = vec2(0.0);
+    if (!uses_material) {
+        xy = texture(NORMAL_MAP, coords).rg * 2.0 - 1.0;
+    } else if (materialHas(MATERIAL_NORMAL)) {
+        xy = texture(materialNormal, vec3(coords, materialIndex)).rg * 2.0 - 1.0;
+    }
+    return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
+
 vec3 calculateNormalFromMap() {
     if (!uses_normal) {
         return normalize(nor);
     }
     // Sample the normal map with scaled coordinates
     vec2 scaledCoords = getScaledTexCoords();
-    vec3 normalColour = texture(normal_map, scaledCoords).rgb;
-    
-    // Transform from [0,1] range to [-1,1] range
-    vec3 normalTangentSpace = normalize(normalColour * 2.0 - 1.0);
+    vec3 normalTangentSpace = normalize(sampleNormalMap(scaledCoords));
     
     return normalize(TBN * normalTangentSpace);
 }
@@ -108,7 +261,7 @@ float calculateSpecular(vec3 normal, vec3 viewDir, vec3 lightDir) {
     if (uses_specular) {
         // Sample from specular map with scaled coordinates
         vec2 scaledCoords = getScaledTexCoords();
-        float specularStrength = texture(specular_map, scaledCoords).r;
+        float specularStrength = texture(SPECULAR_MAP, scaledCoords).r;
         return spec * specularStrength;
     }
     
@@ -142,14 +295,14 @@ vec2 ParallaxOcclusionMapping(vec2 texCoords, vec3 viewDirTangent)
     
     // Initialize values
     vec2 currentTexCoords = scaledCoords;
-    float currentDepthMapValue = texture(depth_map, currentTexCoords).r;
+    float currentDepthMapValue = sampleDepthMap(currentTexCoords);
     
     // Loop until find where ray intersects heightmap
     while(currentLayerDepth < currentDepthMapValue)
     {
         // Shift to next layer
         currentTexCoords -= deltaTexCoords;
-        currentDepthMapValue = texture(depth_map, currentTexCoords).r;
+        currentDepthMapValue = sampleDepthMap(currentTexCoords);
         currentLayerDepth += layerDepth;
         
         // Prevent infinite loops
@@ -162,7 +315,7 @@ vec2 ParallaxOcclusionMapping(vec2 texCoords, vec3 viewDirTangent)
     
     // Get depth values for linear interpolation
     float afterDepth = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(depth_map, prevTexCoords).r - (currentLayerDepth - layerDepth);
+    float beforeDepth = sampleDepthMap(prevTexCoords) - (currentLayerDepth - layerDepth);
     
     // Calculate interpolation weight
     float weight = afterDepth / (afterDepth - beforeDepth);
@@ -199,8 +352,7 @@ vec3 ParallaxMappedNormal()
     vec2 scaledParallaxCoords = parallaxCoords * uv_scale;
     
     // Sample normal map using the offset coordinates
-    vec3 normalColour = texture(normal_map, scaledParallaxCoords).rgb;
-    vec3 normalTangentSpace = normalize(normalColour * 2.0 - 1.0);
+    vec3 normalTangentSpace = normalize(sampleNormalMap(scaledParallaxCoords));
     
     // Transform back to world space 
     return normalize(TBN * normalTangentSpace);
@@ -381,7 +533,7 @@ vec4 applyGlowMap(vec4 baseColour) {
     if (uses_glow) {
         // Use scaled coordinates for glow map
         vec2 scaledCoords = getScaledTexCoords();
-        vec4 glowColour = texture(glow_map, scaledCoords);
+        vec4 glowColour = texture(GLOW_MAP, scaledCoords);
         // Intensity of glow
         float intensity = 0.4f;
         return clamp(baseColour + glowColour * intensity, 0.0, 1.0);
@@ -575,8 +727,34 @@ vec3 CalculatePBR(vec3 N, vec3 V, vec3 albedoValue, float metallicValue, float r
     return Colour;
 }
 
+// Per object values of the draw's render material
+void loadMaterial()
+{
+    MaterialData material = materials[drawMaterial];
+#ifndef MATERIAL_FEATURES
+    int flags = material.info.z;
+    uses_texture = (flags & MATERIAL_USES_TEXTURE) != 0;
+    uses_glow = (flags & MATERIAL_USES_GLOW) != 0;
+    uses_normal = (flags & MATERIAL_USES_NORMAL) != 0;
+    uses_specular = (flags & MATERIAL_USES_SPECULAR) != 0;
+    uses_pbr = (flags & MATERIAL_USES_PBR) != 0;
+    uses_parrallax = (flags & MATERIAL_USES_PARRALLAX) != 0;
+#endif
+#ifdef BINDLESS_TEXTURES
+    textureMaterial = material.info.x;
+#endif
+    uses_material = material.info.y >= 0;
+    materialIndex = max(material.info.y, 0);
+    shininess = material.params.x;
+    uv_scale = material.params.y;
+    bump_scale = material.params.z;
+    height_scale = material.params.w;
+}
+
 void main()
 {
+    loadMaterial();
+
     // Get correct normal depending on which technique in use
     // Calculate in main to be consistent accross each process
     vec3 N;
@@ -621,10 +799,11 @@ void main()
         vec2 pbrTexCoords = currentTexCoords * uv_scale;
     
         // Sample textures
-        albedoValue = texture(albedoMap, pbrTexCoords).rgb;
-        metallicValue = texture(metallicMap, pbrTexCoords).r;
-        roughnessValue = texture(roughnessMap, pbrTexCoords).r;
-        aoValue = texture(aoMap, pbrTexCoords).r;
+        albedoValue = sampleMaterialAlbedo(pbrTexCoords).rgb;
+        vec4 masks = sampleMaterialMasks(pbrTexCoords);
+        aoValue = masks.r;
+        roughnessValue = masks.g;
+        metallicValue = masks.b;
         
         // Calculate lighting using PBR
         vec3 pbrColour = CalculatePBR(N, V, albedoValue, metallicValue, roughnessValue, aoValue);
@@ -650,7 +829,7 @@ void main()
         
         // Apply to base Colour
         if (uses_texture) {
-            vec4 texColour = texture(tex0, scaledTexCoords);
+            vec4 texColour = uses_material ? sampleMaterialAlbedo(scaledTexCoords) : texture(BASE_MAP, scaledTexCoords);
             finalColour = vec4(finalLightColour * texColour.rgb, texColour.a);
         } else {
             finalColour = vec4(finalLightColour * colour.rgb, colour.a);
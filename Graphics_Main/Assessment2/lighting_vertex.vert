@@ -1,10 +1,15 @@
 #version 450 core
+#ifdef MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 layout(location = 0) in vec4 vPos;
 layout(location = 1) in vec4 vColor;
 layout(location = 2) in vec2 vTexture;
 layout(location = 3) in vec3 vNor;
 layout(location = 4) in vec3 tangent;
 layout(location = 5) in vec3 bitangent;
+// Packed meshes only
+layout(location = 6) in uint vMaterial;
 
 out vec4 colour;
 out vec2 texCoords;
@@ -12,25 +17,86 @@ out vec3 nor;
 out mat3 TBN;
 out vec3 FragPosWorldSpace;
 out vec4 FragPosProjectedLightSpace;
+// Render material of the draw, read by the fragment shader
+flat out int drawMaterial;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 projectedLightSpaceMatrix;
+// Per draw values written by the render queue, must match draw_data in render_queue.h
+struct DrawData
+{
+    mat4 model;
+    // Packed meshes dequantize positions from their bounds
+    vec4 posOffset;
+    vec4 posScale;
+    // Render material, 1 for packed vertices, first palette entry
+    ivec4 info;
+};
+layout(std430, binding = 4) readonly buffer DrawTable
+{
+    DrawData draws[];
+};
+
+// Draw table entry of the first draw in the batch
+uniform int drawBase;
+#ifdef MULTI_DRAW
+#define DRAW_INDEX (drawBase + gl_DrawIDARB)
+#else
+#define DRAW_INDEX drawBase
+#endif
+
+// Camera values of the frame, must match frame_data in frame_uniforms.h
+layout(std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 projectedLightSpaceMatrix;
+    vec3 camPos;
+    float time;
+};
+
+// Colours of every packed mesh, a vertex indexes its mesh's entries
+layout(std430, binding = 6) readonly buffer PaletteTable
+{
+    vec4 palettes[];
+};
+
+// Unit vector from octahedral encoding
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
-    FragPosWorldSpace = vec3(model * vPos);
-    gl_Position = projection * view * model * vPos;
+    DrawData draw = draws[DRAW_INDEX];
+    mat4 model = draw.model;
+    drawMaterial = draw.info.x;
+
+    vec4 position = vPos;
+    vec3 normal = vNor;
+    vec3 vertexTangent = tangent;
+    float bitangentSign = 1.0;
     colour = vColor;
+    if (draw.info.y != 0) {
+        position = vec4(draw.posOffset.xyz + vPos.xyz * draw.posScale.xyz, 1.0);
+        normal = octDecode(vNor.xy);
+        vertexTangent = octDecode(tangent.xy);
+        bitangentSign = tangent.z < 0.0 ? -1.0 : 1.0;
+        colour = vec4(palettes[draw.info.z + int(vMaterial)].rgb, 1.0);
+    }
+
+    FragPosWorldSpace = vec3(model * position);
+    gl_Position = projection * view * model * position;
     texCoords = vTexture;
     mat3 normalMatrix = transpose(inverse(mat3(model)));
-    nor = normalize(normalMatrix * vNor);
-    vec3 T = normalize(normalMatrix * tangent);
-    vec3 B = normalize(normalMatrix * bitangent);
+    nor = normalize(normalMatrix * normal);
+    vec3 T = normalize(normalMatrix * vertexTangent);
     vec3 N = nor;    
     T = normalize(T - dot(T, N) * N);   
-    B = cross(N, T);
+    vec3 B = cross(N, T) * bitangentSign;
     TBN = mat3(T, B, N);
-    FragPosProjectedLightSpace = projectedLightSpaceMatrix * model * vPos;
-}
\ No newline at end of file
+    FragPosProjectedLightSpace = projectedLightSpaceMatrix * model * position;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <GL/gl3w.h>
+
+#include "texture.h"
+
+// PBR materials packed into layers of GL_TEXTURE_2D_ARRAY textures
+// Every material's maps of one kind share an array, so one set of binds serves every PBR draw
+// and a draw only picks its layer through its render material
+
+// Must match MAX_MATERIALS in lighting_fragment.frag
+#define MAX_MATERIALS 8
+// Width and height of every layer, bigger maps drop their top mip levels to fit
+#define MATERIAL_LAYER_SIZE 2048
+// Read AO, roughness, metallic and height from one packed layer instead of four mask layers, see material_pack.h
+#define PACK_MATERIAL_MASKS 1
+
+// Timed repeats of the material draws per mask layout in benchmark_material_layouts
+#define MATERIAL_BENCHMARK_DRAWS 50
+
+// Texture units the arrays are bound to
+#define MATERIAL_UNIT_ALBEDO 11
+#define MATERIAL_UNIT_NORMAL 12
+#define MATERIAL_UNIT_MASKS 13
+#define MATERIAL_UNIT_ORMH 14
+
+enum material_map
+{
+	MATERIAL_ALBEDO,
+	MATERIAL_NORMAL,
+	// Single channel maps, sharing the mask array in this order
+	MATERIAL_AO,
+	MATERIAL_ROUGHNESS,
+	MATERIAL_METALLIC,
+	// Depth for parallax mapping
+	MATERIAL_HEIGHT,
+	// The four masks packed into RGBA by the asset build step
+	MATERIAL_ORMH,
+	NUM_MATERIAL_MAPS
+};
+
+// Mask array layers per material
+#define MATERIAL_MASKS (MATERIAL_ORMH - MATERIAL_AO)
+
+enum material_array
+{
+	MATERIAL_ARRAY_ALBEDO,
+	MATERIAL_ARRAY_NORMAL,
+	MATERIAL_ARRAY_MASKS,
+	MATERIAL_ARRAY_ORMH,
+	NUM_MATERIAL_ARRAYS
+};
+
+// Resident bit of each map is 1 << map, the shader uses a flat placeholder value for maps without one
+// The albedo array is linear, an albedo baked as sRGB sets this and is decoded in the shader
+#define MATERIAL_ALBEDO_SRGB (1 << NUM_MATERIAL_MAPS)
+
+// Source files of one material, empty for maps it does not have
+// The ORMH file is written from the mask files, see material_pack.h
+struct material_desc
+{
+	std::string name;
+	std::string files[NUM_MATERIAL_MAPS];
+	bool albedo_srgb = false;
+};
+
+struct material_set
+{
+	std::vector<material_desc> materials;
+	// Created with the first layer that loads, taking its format
+	GLuint arrays[NUM_MATERIAL_ARRAYS] = {};
+	GLenum formats[NUM_MATERIAL_ARRAYS] = {};
+	// Bits of the maps that have loaded, per material
+	GLint resident[MAX_MATERIALS] = {};
+	// Which mask layout draws sample
+	bool packed = PACK_MATERIAL_MASKS != 0;
+};
+
+// Index of the new material, -1 if the set is full
+// Materials have to be added before the set starts streaming, the arrays are sized once
+int add_material(material_set& set, const material_desc& desc)
+{
+	if (set.materials.size() >= MAX_MATERIALS) {
+		std::cerr << "Material set is full, " << desc.name << " was not added." << std::endl;
+		return -1;
+	}
+	set.materials.push_back(desc);
+	return (int)set.materials.size() - 1;
+}
+
+material_array material_map_array(material_map map)
+{
+	if (map == MATERIAL_ALBEDO)
+		return MATERIAL_ARRAY_ALBEDO;
+	if (map == MATERIAL_NORMAL)
+		return MATERIAL_ARRAY_NORMAL;
+	if (map == MATERIAL_ORMH)
+		return MATERIAL_ARRAY_ORMH;
+	return MATERIAL_ARRAY_MASKS;
+}
+
+// Layer of a material's map within its array, must match the layer maths in lighting_fragment.frag
+int material_layer(material_map map, int material)
+{
+	if (map < MATERIAL_AO || map == MATERIAL_ORMH)
+		return material;
+	return material * MATERIAL_MASKS + (map - MATERIAL_AO);
+}
+
+int material_array_layers(const material_set& set, material_array array)
+{
+	return (int)set.materials.size() * (array == MATERIAL_ARRAY_MASKS ? MATERIAL_MASKS : 1);
+}
+
+// Request that bakes one map like the separate PBR textures were
+texture_request material_map_request(const material_desc& desc, material_map map)
+{
+	static const texture_compression compressions[NUM_MATERIAL_MAPS] = { COMPRESS_COLOUR, COMPRESS_NORMAL, COMPRESS_MASK, COMPRESS_MASK, COMPRESS_MASK, COMPRESS_MASK, COMPRESS_DATA };
+	static const texture_placeholder placeholders[NUM_MATERIAL_MAPS] = { PLACEHOLDER_GREY, PLACEHOLDER_NORMAL, PLACEHOLDER_WHITE, PLACEHOLDER_WHITE, PLACEHOLDER_BLACK, PLACEHOLDER_BLACK, PLACEHOLDER_WHITE };
+	return texture_pbr(nullptr, desc.files[map].c_str(), map == MATERIAL_ALBEDO && desc.albedo_srgb, compressions[map], placeholders[map]);
+}
+
+// First level of a baked chain that is a whole layer, -1 if the map cannot fill one
+int material_base_level(const baked_texture& baked)
+{
+	int layer_levels = full_mip_count(MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE);
+	for (int level = 0; level + layer_levels <= baked.num_levels; level++) {
+		if (mip_extent(baked.width, level) == MATERIAL_LAYER_SIZE && mip_extent(baked.height, level) == MATERIAL_LAYER_SIZE)
+			return level;
+	}
+	return -1;
+}
+
+// sRGB and linear formats with the same layout, arrays use the linear one
+GLenum material_array_format(GLenum format)
+{
+	if (format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM)
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	if (format == GL_SRGB8_ALPHA8)
+		return GL_RGBA8;
+	return format;
+}
+
+// Array a baked map goes into, created on first use, zero if its format does not match the array's
+GLuint material_array_for(material_set& set, material_map map, const baked_texture& baked)
+{
+	material_array array = material_map_array(map);
+	GLenum format = material_array_format(baked.format);
+	if (set.arrays[array] == 0) {
+		glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &set.arrays[array]);
+		glTextureStorage3D(set.arrays[array], full_mip_count(MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE), format, MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE, material_array_layers(set, array));
+		glTextureParameteri(set.arrays[array], GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTextureParameteri(set.arrays[array], GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTextureParameteri(set.arrays[array], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(set.arrays[array], GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		set.formats[array] = format;
+		printf("Created material array %d: %d layers of %dx%d %s.\n", (int)array, material_array_layers(set, array), MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE, baked_format_name(format));
+	}
+	return set.formats[array] == format ? set.arrays[array] : 0;
+}
+
+// A map's layer has been uploaded, draws sample it from now on
+void set_material_resident(material_set& set, int material, material_map map, const baked_texture& baked)
+{
+	set.resident[material] |= 1 << map;
+	if (map == MATERIAL_ALBEDO && baked.format != material_array_format(baked.format))
+		set.resident[material] |= MATERIAL_ALBEDO_SRGB;
+}
+
+// Bind every array once, call after glUseProgram and before the first material draw
+void bind_material_set(const material_set& set, GLuint program)
+{
+	glBindTextureUnit(MATERIAL_UNIT_ALBEDO, set.arrays[MATERIAL_ARRAY_ALBEDO]);
+	glBindTextureUnit(MATERIAL_UNIT_NORMAL, set.arrays[MATERIAL_ARRAY_NORMAL]);
+	glBindTextureUnit(MATERIAL_UNIT_MASKS, set.arrays[MATERIAL_ARRAY_MASKS]);
+	glBindTextureUnit(MATERIAL_UNIT_ORMH, set.arrays[MATERIAL_ARRAY_ORMH]);
+	set_uniform(program, "materialAlbedo", MATERIAL_UNIT_ALBEDO);
+	set_uniform(program, "materialNormal", MATERIAL_UNIT_NORMAL);
+	set_uniform(program, "materialMasks", MATERIAL_UNIT_MASKS);
+	set_uniform(program, "materialOrmh", MATERIAL_UNIT_ORMH);
+	set_uniform(program, "materialPacked", set.packed);
+	set_uniform_array(program, "materialResident", set.resident, MAX_MATERIALS);
+}
+
+void delete_material_set(material_set& set)
+{
+	glDeleteTextures(NUM_MATERIAL_ARRAYS, set.arrays);
+	for (int i = 0; i < NUM_MATERIAL_ARRAYS; i++) {
+		set.arrays[i] = 0;
+	}
+}
+
+// Video memory of one layer with its mip chain
+size_t material_layer_bytes(GLenum format)
+{
+	size_t bytes = 0;
+	for (int level = 0; level < full_mip_count(MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE); level++) {
+		bytes += baked_level_size(format, mip_extent(MATERIAL_LAYER_SIZE, level), mip_extent(MATERIAL_LAYER_SIZE, level));
+	}
+	return bytes;
+}
+
+// GPU time of the same material draws sampling the four mask layers and then the packed layer
+// Both layouts have to be streamed in, see stream_material_set
+// draw repeats with depth testing at GL_LEQUAL, so every pass shades every visible fragment again
+void benchmark_material_layouts(material_set& set, const std::function<void()>& draw)
+{
+	int masks = 0, packed_masks = 0;
+	for (int m = 0; m < (int)set.materials.size(); m++) {
+		for (int map = MATERIAL_AO; map < MATERIAL_ORMH; map++) {
+			masks += (set.resident[m] >> map) & 1;
+		}
+		packed_masks += (set.resident[m] >> MATERIAL_ORMH) & 1;
+	}
+	if (packed_masks == 0 || masks == 0) {
+		printf("Material layout benchmark skipped, only one mask layout loaded.\n");
+		return;
+	}
+
+	bool packed = set.packed;
+	GLuint query;
+	glGenQueries(1, &query);
+	GLuint64 nanoseconds[2] = {};
+	glDepthFunc(GL_LEQUAL);
+	for (int layout = 0; layout < 2; layout++) {
+		set.packed = layout == 1;
+		// Untimed pass so neither layout pays for first use
+		draw();
+		glFinish();
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		for (int i = 0; i < MATERIAL_BENCHMARK_DRAWS; i++) {
+			draw();
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds[layout]);
+	}
+	glDepthFunc(GL_LESS);
+	glDeleteQueries(1, &query);
+	set.packed = packed;
+
+	printf("Material layout benchmark: %d passes of the material draws\n", MATERIAL_BENCHMARK_DRAWS);
+	printf("  %d mask layers: %8.3f ms per pass, %.1f MB per material\n", masks, nanoseconds[0] / 1e6 / MATERIAL_BENCHMARK_DRAWS,
+		MATERIAL_MASKS * material_layer_bytes(set.formats[MATERIAL_ARRAY_MASKS]) / (1024.0 * 1024.0));
+	printf("  %d packed layers: %6.3f ms per pass, %.1f MB per material (%.2fx)\n", packed_masks, nanoseconds[1] / 1e6 / MATERIAL_BENCHMARK_DRAWS,
+		material_layer_bytes(set.formats[MATERIAL_ARRAY_ORMH]) / (1024.0 * 1024.0), (double)nanoseconds[0] / std::max<GLuint64>(nanoseconds[1], 1));
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "texture.h"
+#include "file.h"
+#include "material_array.h"
+
+// Asset build step packing a material's single channel maps into one RGBA image
+// R occlusion, G roughness, B metallic, A height, so the shader reads all four with one fetch
+// Maps a material does not have are filled with the value their placeholder would show
+
+// Uncompressed 32 bit TGA with the first row at the top, which stb_image reads back
+bool write_tga(const char* filename, const std::vector<unsigned char>& rgba, int width, int height)
+{
+	FILE* f;
+	fopen_s(&f, filename, "wb");
+	if (f == NULL)
+		return false;
+	unsigned char header[18] = {};
+	// Uncompressed true colour
+	header[2] = 2;
+	header[12] = (unsigned char)(width & 0xff);
+	header[13] = (unsigned char)(width >> 8);
+	header[14] = (unsigned char)(height & 0xff);
+	header[15] = (unsigned char)(height >> 8);
+	header[16] = 32;
+	// 8 alpha bits, top left origin
+	header[17] = 0x28;
+	std::vector<unsigned char> bgra(rgba.size());
+	for (size_t i = 0; i < rgba.size(); i += 4) {
+		bgra[i] = rgba[i + 2];
+		bgra[i + 1] = rgba[i + 1];
+		bgra[i + 2] = rgba[i];
+		bgra[i + 3] = rgba[i + 3];
+	}
+	bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header) && fwrite(bgra.data(), 1, bgra.size(), f) == bgra.size();
+	fclose(f);
+	return ok;
+}
+
+// Whether the packed image is missing or older than any of the maps it is built from
+bool packed_masks_stale(const material_desc& desc)
+{
+	int64_t packed_mtime, mtime;
+	uint64_t size;
+	if (!get_file_stamp(desc.files[MATERIAL_ORMH].c_str(), &packed_mtime, &size))
+		return true;
+	for (int map = MATERIAL_AO; map < MATERIAL_ORMH; map++) {
+		if (!desc.files[map].empty() && get_file_stamp(desc.files[map].c_str(), &mtime, &size) && mtime > packed_mtime)
+			return true;
+	}
+	return false;
+}
+
+// Write desc.files[MATERIAL_ORMH] from the material's AO, roughness, metallic and height maps
+// Every map that loads must be the same size, false if none load or they differ
+bool pack_material_masks(const material_desc& desc)
+{
+	auto start = std::chrono::steady_clock::now();
+	// AO and roughness default to white like their placeholders, metallic and height to black
+	static const unsigned char defaults[MATERIAL_MASKS] = { 255, 255, 0, 0 };
+	int width = 0, height = 0;
+	std::vector<unsigned char> rgba;
+	int packed = 0;
+	// Pack the maps as stored, the loader flips the packed image like any other
+	stbi_set_flip_vertically_on_load_thread(0);
+	for (int channel = 0; channel < MATERIAL_MASKS; channel++) {
+		const std::string& file = desc.files[MATERIAL_AO + channel];
+		if (file.empty())
+			continue;
+		int w, h, c;
+		unsigned char* pixels = stbi_load(file.c_str(), &w, &h, &c, 1);
+		if (!pixels) {
+			std::cerr << "Failed to load texture: " << file << ", packing the default instead." << std::endl;
+			continue;
+		}
+		if (rgba.empty()) {
+			width = w;
+			height = h;
+			rgba.resize((size_t)width * height * 4);
+			for (size_t i = 0; i < rgba.size(); i++) {
+				rgba[i] = defaults[i % 4];
+			}
+		}
+		if (w != width || h != height) {
+			std::cerr << "Cannot pack " << file << ", it is " << w << "x" << h << " and the other maps are " << width << "x" << height << "." << std::endl;
+			stbi_image_free(pixels);
+			return false;
+		}
+		for (size_t i = 0; i < (size_t)width * height; i++) {
+			rgba[i * 4 + channel] = pixels[i];
+		}
+		stbi_image_free(pixels);
+		packed++;
+	}
+	if (packed == 0) {
+		std::cerr << "No maps of material " << desc.name << " loaded, nothing to pack." << std::endl;
+		return false;
+	}
+	if (!write_tga(desc.files[MATERIAL_ORMH].c_str(), rgba, width, height)) {
+		std::cerr << "Failed to write packed masks: " << desc.files[MATERIAL_ORMH] << std::endl;
+		return false;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("Packed %d maps of %s into %s (%dx%d) in %.0f ms.\n", packed, desc.name.c_str(), desc.files[MATERIAL_ORMH].c_str(), width, height, seconds * 1000.0);
+	return true;
+}
+
+// Pack a material's masks unless the packed image is up to date, safe to call from any thread
+bool build_packed_masks(const material_desc& desc)
+{
+	if (desc.files[MATERIAL_ORMH].empty())
+		return false;
+	if (!packed_masks_stale(desc))
+		return true;
+	return pack_material_masks(desc);
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <chrono>
+
+#include "file.h"
+#include "object_parser.h"
+#include "vertex_format.h"
+#include "tangent.h"
+#include "geometry_arena.h"
+
+// Levels of detail kept per mesh, including the full mesh
+#define MAX_MESH_LODS 4
+
+// Index range of one level of detail inside the mesh index buffer
+struct mesh_lod
+{
+	uint32_t first_index;
+	uint32_t num_indices;
+	// Largest distance, in object space, the surface moved from LOD 0
+	float error;
+};
+
+// Mesh stored as a table of unique vertices plus triangle indices into it
+struct indexed_mesh
+{
+	// Interleaved vertex data in the float layout of vertex_format.h
+	std::vector<GLfloat> vertices;
+	// Three indices per triangle
+	std::vector<uint32_t> indices;
+	// MESH_VERTEX_FLOATS with tangent and bitangent, MESH_VERTEX_FLOATS_NO_TANGENT without
+	int floats_per_vertex = 0;
+	// Counts stay valid after the data is uploaded, even when the vectors are empty
+	uint32_t num_vertices = 0;
+	uint32_t num_indices = 0;
+
+	// Packed form of vertices, filled by pack_indexed_mesh
+	std::vector<packed_vertex> packed_vertices;
+	// Object space position is pos_offset + packed position * pos_scale
+	glm::vec3 pos_offset = glm::vec3(0.f);
+	glm::vec3 pos_scale = glm::vec3(1.f);
+	// Colour of each material index
+	std::vector<glm::vec3> palette;
+
+	// Where the vertices and indices start in the geometry arena, set when uploaded
+	int32_t base_vertex = 0;
+	uint32_t first_index = 0;
+
+	// Levels of detail inside indices, filled by build_mesh_lods
+	std::vector<mesh_lod> lods;
+	// Object space bounding sphere used to pick a LOD and cull
+	glm::vec3 bounds_centre = glm::vec3(0.f);
+	float bounds_radius = 0.f;
+	// Object space box used to cull
+	glm::vec3 bounds_min = glm::vec3(0.f);
+	glm::vec3 bounds_max = glm::vec3(0.f);
+
+	// Meshes read from the binary cache leave their vertices and indices in the mapped file until they are uploaded
+	// packed_vertices and indices stay empty for them, the pointers below point into the mapping
+	// Owning the mapping makes meshes move only, a copy would leave two owners of one view
+	owned_mapped_file cache_map;
+	const packed_vertex* cached_vertices = nullptr;
+	const uint32_t* cached_indices = nullptr;
+};
+
+// Vertices and indices to upload, straight from the mapped cache or from the vectors
+struct mesh_upload_data
+{
+	const packed_vertex* vertices;
+	uint32_t num_vertices;
+	const uint32_t* indices;
+	uint32_t num_indices;
+};
+
+// Everything that decides whether two triangle corners can share a vertex
+struct weld_key
+{
+	// Position, colour, texture coordinates and normal
+	GLfloat attribs[11];
+	int material;
+
+	bool operator==(const weld_key& other) const
+	{
+		return material == other.material && memcmp(attribs, other.attribs, sizeof(attribs)) == 0;
+	}
+};
+
+struct weld_key_hash
+{
+	size_t operator()(const weld_key& key) const
+	{
+		// FNV-1a over the raw bytes of the key
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&key);
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < sizeof(weld_key); i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+		return (size_t)hash;
+	}
+};
+
+weld_key make_weld_key(const vertex& v)
+{
+	weld_key key;
+	// Adding zero turns -0.0 into 0.0 so both weld together
+	GLfloat attribs[11] = {
+		v.pos.x + 0.f, v.pos.y + 0.f, v.pos.z + 0.f,
+		v.col.r + 0.f, v.col.g + 0.f, v.col.b + 0.f,
+		v.tex.x + 0.f, v.tex.y + 0.f,
+		v.nor.x + 0.f, v.nor.y + 0.f, v.nor.z + 0.f
+	};
+	memcpy(key.attribs, attribs, sizeof(attribs));
+	key.material = v.mat;
+	return key;
+}
+
+// Split interleaved vertices into the arrays generate_tangent_space reads
+void fill_tangent_input(const std::vector<GLfloat>& vertices, int floats_per_vertex, tangent_space_input* out_input)
+{
+	size_t count = vertices.size() / floats_per_vertex;
+	out_input->resize(count);
+	for (size_t i = 0; i < count; i++) {
+		const GLfloat* v = &vertices[i * floats_per_vertex];
+		out_input->pos_x[i] = v[0]; out_input->pos_y[i] = v[1]; out_input->pos_z[i] = v[2];
+		out_input->tex_u[i] = v[6]; out_input->tex_v[i] = v[7];
+		out_input->nor_x[i] = v[8]; out_input->nor_y[i] = v[9]; out_input->nor_z[i] = v[10];
+	}
+}
+
+// Weld identical triangle corners into an indexed mesh for glDrawElements
+void tri_to_indexed_mesh(const std::vector<triangle>& triangles, bool uses_normal, indexed_mesh* out_mesh)
+{
+	out_mesh->floats_per_vertex = uses_normal ? MESH_VERTEX_FLOATS : MESH_VERTEX_FLOATS_NO_TANGENT;
+	out_mesh->vertices.clear();
+	out_mesh->indices.clear();
+	out_mesh->indices.reserve(triangles.size() * 3);
+
+	// Maps each unique corner to its index in the vertex table
+	std::unordered_map<weld_key, uint32_t, weld_key_hash> unique_vertices;
+	unique_vertices.reserve(triangles.size() * 3);
+
+	for (const triangle& tri : triangles) {
+		const vertex* verts[3] = { &tri.v1, &tri.v2, &tri.v3 };
+
+		for (int i = 0; i < 3; ++i) {
+			const vertex& v = *verts[i];
+			weld_key key = make_weld_key(v);
+
+			auto found = unique_vertices.find(key);
+			uint32_t index;
+			if (found != unique_vertices.end()) {
+				index = found->second;
+			}
+			else {
+				// First time this corner is seen, add it to the vertex table
+				index = (uint32_t)unique_vertices.size();
+				unique_vertices.emplace(key, index);
+				out_mesh->vertices.insert(out_mesh->vertices.end(), key.attribs, key.attribs + 11);
+			}
+
+			out_mesh->indices.push_back(index);
+		}
+	}
+
+	if (uses_normal) {
+		// Smooth tangent frame over the welded vertices
+		size_t count = unique_vertices.size();
+		tangent_space_input input;
+		fill_tangent_input(out_mesh->vertices, 11, &input);
+		tangent_space_output frames;
+		generate_tangent_space(input, out_mesh->indices.data(), out_mesh->indices.size(), &frames);
+
+		// Re-interleave with the tangent frame after each vertex
+		std::vector<GLfloat> with_tangents;
+		with_tangents.reserve(count * 17);
+
+		for (size_t i = 0; i < count; i++) {
+			const GLfloat* v = &out_mesh->vertices[i * 11];
+			glm::vec3 normal(v[8], v[9], v[10]);
+			if (glm::dot(normal, normal) > 0.f)
+				normal = glm::normalize(normal);
+			glm::vec3 tangent(frames.tan_x[i], frames.tan_y[i], frames.tan_z[i]);
+			glm::vec3 bitangent = glm::cross(normal, tangent) * frames.sign[i];
+			if (glm::dot(bitangent, bitangent) < 1e-12f) {
+				bitangent = glm::vec3(0.f, 1.f, 0.f);
+			}
+
+			with_tangents.insert(with_tangents.end(), v, v + 11);
+			with_tangents.push_back(tangent.x);
+			with_tangents.push_back(tangent.y);
+			with_tangents.push_back(tangent.z);
+			with_tangents.push_back(bitangent.x);
+			with_tangents.push_back(bitangent.y);
+			with_tangents.push_back(bitangent.z);
+		}
+
+		out_mesh->vertices.swap(with_tangents);
+	}
+
+	out_mesh->num_vertices = (uint32_t)unique_vertices.size();
+	out_mesh->num_indices = (uint32_t)out_mesh->indices.size();
+
+	size_t corners = triangles.size() * 3;
+	printf("Welded %zu corners into %zu unique vertices (%.1fx smaller VBO).\n",
+		corners, unique_vertices.size(), unique_vertices.empty() ? 0.0 : (double)corners / unique_vertices.size());
+}
+
+// Time generate_tangent_space on one thread and on the worker pool, best of a few runs each
+void benchmark_tangent_space(const char* filename, const char* base_folder)
+{
+	std::vector<triangle> triangles;
+	obj_parse(filename, &triangles, base_folder);
+	indexed_mesh mesh;
+	tri_to_indexed_mesh(triangles, false, &mesh);
+
+	tangent_space_input input;
+	fill_tangent_input(mesh.vertices, mesh.floats_per_vertex, &input);
+	tangent_space_output frames;
+
+	thread_pool* pools[2] = { nullptr, &worker_pool() };
+	double best_ms[2] = { 1e30, 1e30 };
+	for (int p = 0; p < 2; p++) {
+		for (int run = 0; run < 5; run++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			generate_tangent_space(input, mesh.indices.data(), mesh.indices.size(), &frames, pools[p]);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			best_ms[p] = std::min(best_ms[p], ms);
+		}
+	}
+
+	printf("Tangent benchmark: %s (%u vertices, %u triangles)\n", filename, mesh.num_vertices, mesh.num_indices / 3);
+	printf("  1 thread:  %8.2f ms  %8.1f M vertices/s\n", best_ms[0], mesh.num_vertices / best_ms[0] / 1000.0);
+	printf("  %u threads: %8.2f ms  %8.1f M vertices/s  (%.1fx)\n", worker_pool().size(), best_ms[1], mesh.num_vertices / best_ms[1] / 1000.0, best_ms[0] / best_ms[1]);
+}
+
+// Quantize the float vertices into packed_vertices and release the float copy
+void pack_indexed_mesh(indexed_mesh* mesh)
+{
+	int stride = mesh->floats_per_vertex;
+	size_t count = mesh->vertices.size() / stride;
+
+	// Bounds used to normalize positions
+	glm::vec3 min_pos(FLT_MAX), max_pos(-FLT_MAX);
+	for (size_t i = 0; i < count; i++) {
+		const GLfloat* v = &mesh->vertices[i * stride];
+		min_pos = glm::min(min_pos, glm::vec3(v[0], v[1], v[2]));
+		max_pos = glm::max(max_pos, glm::vec3(v[0], v[1], v[2]));
+	}
+	if (count == 0) {
+		min_pos = max_pos = glm::vec3(0.f);
+	}
+	mesh->pos_offset = min_pos;
+	mesh->pos_scale = max_pos - min_pos;
+	for (int axis = 0; axis < 3; axis++) {
+		// Flat meshes still need a non zero scale to divide by
+		if (mesh->pos_scale[axis] <= 0.f)
+			mesh->pos_scale[axis] = 1.f;
+	}
+
+	mesh->palette.clear();
+	mesh->packed_vertices.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		const GLfloat* v = &mesh->vertices[i * stride];
+		packed_vertex& out = mesh->packed_vertices[i];
+
+		glm::vec3 normalized = (glm::vec3(v[0], v[1], v[2]) - mesh->pos_offset) / mesh->pos_scale;
+		for (int axis = 0; axis < 3; axis++) {
+			out.pos[axis] = (uint16_t)roundf(glm::clamp(normalized[axis], 0.f, 1.f) * 65535.f);
+		}
+
+		// Vertex colours come from the material, so each distinct colour is one material
+		glm::vec3 colour(v[3], v[4], v[5]);
+		size_t material = 0;
+		while (material < mesh->palette.size() && mesh->palette[material] != colour)
+			material++;
+		if (material == mesh->palette.size()) {
+			if (material < MAX_MESH_MATERIALS) {
+				mesh->palette.push_back(colour);
+			}
+			else {
+				// Out of palette entries, reuse the last one
+				material = MAX_MESH_MATERIALS - 1;
+			}
+		}
+		out.material = (uint16_t)material;
+
+		out.tex[0] = float_to_half(v[6]);
+		out.tex[1] = float_to_half(v[7]);
+
+		glm::vec3 normal(v[8], v[9], v[10]);
+		glm::vec2 oct_normal = oct_encode(normal);
+		out.normal[0] = to_snorm16(oct_normal.x);
+		out.normal[1] = to_snorm16(oct_normal.y);
+
+		// Meshes without a tangent frame get a fixed one, they are not normal mapped
+		glm::vec3 tangent(1.f, 0.f, 0.f);
+		float sign = 1.f;
+		if (stride == 17) {
+			tangent = glm::vec3(v[11], v[12], v[13]);
+			glm::vec3 bitangent(v[14], v[15], v[16]);
+			// The shader rebuilds the bitangent as cross(normal, tangent) * sign
+			sign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.f ? -1.f : 1.f;
+		}
+		glm::vec2 oct_tangent = oct_encode(tangent);
+		out.tangent[0] = to_snorm8(oct_tangent.x);
+		out.tangent[1] = to_snorm8(oct_tangent.y);
+		out.bitangent_sign = to_snorm8(sign);
+		out.padding = 0;
+	}
+
+	if (mesh->palette.empty()) {
+		mesh->palette.push_back(glm::vec3(1.f));
+	}
+	mesh->num_vertices = (uint32_t)count;
+	std::vector<GLfloat>().swap(mesh->vertices);
+
+	printf("Packed %zu vertices from %zu to %zu bytes each.\n", count, stride * sizeof(GLfloat), sizeof(packed_vertex));
+}
+
+mesh_upload_data mesh_upload_source(const indexed_mesh& mesh)
+{
+	mesh_upload_data data;
+	if (mesh.cache_map.map.data) {
+		data.vertices = mesh.cached_vertices;
+		data.num_vertices = mesh.num_vertices;
+		data.indices = mesh.cached_indices;
+		data.num_indices = mesh.num_indices;
+		return data;
+	}
+	data.vertices = mesh.packed_vertices.data();
+	data.num_vertices = (uint32_t)mesh.packed_vertices.size();
+	data.indices = mesh.indices.data();
+	data.num_indices = (uint32_t)mesh.indices.size();
+	return data;
+}
+
+// Close the cache file an uploaded mesh was read from
+void release_mesh_cache(indexed_mesh& mesh)
+{
+	mesh.cache_map.reset();
+	mesh.cached_vertices = nullptr;
+	mesh.cached_indices = nullptr;
+}
+
+// Drop the CPU copy of an uploaded mesh, the counts stay valid
+void release_mesh_data(indexed_mesh& mesh)
+{
+	std::vector<packed_vertex>().swap(mesh.packed_vertices);
+	std::vector<uint32_t>().swap(mesh.indices);
+	release_mesh_cache(mesh);
+}
+
+// Upload the packed vertices and indices into a range of the packed arena
+void upload_packed_mesh(geometry_arena& arena, indexed_mesh& mesh)
+{
+	mesh_upload_data data = mesh_upload_source(mesh);
+	arena_range range = add_arena_geometry(arena, data.vertices, data.num_vertices, data.indices, data.num_indices);
+	mesh.base_vertex = range.base_vertex;
+	mesh.first_index = range.first_index;
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+#include "file.h"
+#include "mesh.h"
+#include "mesh_optimize.h"
+#include "mesh_lod.h"
+#include "obj_parallel.h"
+
+// Binary mesh cache written next to each OBJ as <name>.obj.meshcache
+// Layout: header, packed vertex blob, index blob, colour palette, LOD table
+// The palette already holds what drawing needs from the materials, so they are not stored
+#define MESH_CACHE_MAGIC 0x4853454D
+// Bump whenever the header or blob layout changes so old caches are rebuilt
+#define MESH_CACHE_VERSION 6
+// Blobs start on a 16 byte boundary
+#define MESH_CACHE_ALIGN 16
+
+struct mesh_cache_header
+{
+	uint32_t magic;
+	uint32_t version;
+	// Identify the source OBJ the cache was built from
+	uint64_t source_path_hash;
+	int64_t source_mtime;
+	uint64_t source_size;
+	// Float layout the mesh was built from, 17 with a tangent frame and 11 without
+	uint32_t floats_per_vertex;
+	// Size of one packed vertex
+	uint32_t vertex_stride;
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	uint32_t num_colours;
+	uint32_t num_lods;
+	// Dequantization of the packed positions
+	float pos_offset[3];
+	float pos_scale[3];
+	// Vertex cache figures from when the mesh was optimized
+	mesh_optimize_stats optimize_stats;
+	// Object space bounding sphere for LOD selection and culling
+	float bounds_centre[3];
+	float bounds_radius;
+	// Object space box for culling
+	float bounds_min[3];
+	float bounds_max[3];
+	// Byte offsets of each blob from the start of the file
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t palette_offset;
+	uint64_t lod_offset;
+};
+
+uint64_t hash_string(const char* str)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char* c = str; *c; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+std::string mesh_cache_path(const char* filename)
+{
+	return std::string(filename) + ".meshcache";
+}
+
+size_t align_cache_offset(size_t offset)
+{
+	return (offset + MESH_CACHE_ALIGN - 1) & ~(size_t)(MESH_CACHE_ALIGN - 1);
+}
+
+// Check a mapped cache belongs to this source file and every blob is inside the file
+bool validate_mesh_cache(const mapped_file& map, const char* filename, int floats_per_vertex)
+{
+	if (map.size < sizeof(mesh_cache_header))
+		return false;
+
+	const mesh_cache_header* header = (const mesh_cache_header*)map.data;
+	if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION)
+		return false;
+
+	int64_t mtime;
+	uint64_t size;
+	if (!get_file_stamp(filename, &mtime, &size))
+		return false;
+	if (header->source_path_hash != hash_string(filename) || header->source_mtime != mtime || header->source_size != size)
+		return false;
+	if (header->floats_per_vertex != (uint32_t)floats_per_vertex || header->vertex_stride != sizeof(packed_vertex))
+		return false;
+	if (header->num_colours == 0 || header->num_colours > MAX_MESH_MATERIALS)
+		return false;
+	if (header->num_lods == 0 || header->num_lods > MAX_MESH_LODS)
+		return false;
+
+	uint64_t vertex_bytes = (uint64_t)header->num_vertices * sizeof(packed_vertex);
+	uint64_t index_bytes = (uint64_t)header->num_indices * sizeof(uint32_t);
+	uint64_t palette_bytes = (uint64_t)header->num_colours * sizeof(glm::vec3);
+	uint64_t lod_bytes = (uint64_t)header->num_lods * sizeof(mesh_lod);
+	if (header->vertex_offset + vertex_bytes > map.size
+		|| header->index_offset + index_bytes > map.size
+		|| header->palette_offset + palette_bytes > map.size
+		|| header->lod_offset + lod_bytes > map.size)
+		return false;
+
+	// Every LOD must draw from inside the index blob
+	const mesh_lod* lods = (const mesh_lod*)(map.data + header->lod_offset);
+	for (uint32_t i = 0; i < header->num_lods; i++) {
+		if ((uint64_t)lods[i].first_index + lods[i].num_indices > header->num_indices)
+			return false;
+	}
+	return true;
+}
+
+bool write_mesh_cache(const char* filename, const indexed_mesh& mesh, const mesh_optimize_stats& optimize_stats)
+{
+	mesh_cache_header header = {};
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.source_path_hash = hash_string(filename);
+	if (!get_file_stamp(filename, &header.source_mtime, &header.source_size))
+		return false;
+	header.floats_per_vertex = mesh.floats_per_vertex;
+	header.vertex_stride = sizeof(packed_vertex);
+	header.num_vertices = mesh.num_vertices;
+	header.num_indices = mesh.num_indices;
+	header.num_colours = (uint32_t)mesh.palette.size();
+	for (int axis = 0; axis < 3; axis++) {
+		header.pos_offset[axis] = mesh.pos_offset[axis];
+		header.pos_scale[axis] = mesh.pos_scale[axis];
+	}
+	header.optimize_stats = optimize_stats;
+	header.num_lods = (uint32_t)mesh.lods.size();
+	for (int axis = 0; axis < 3; axis++) {
+		header.bounds_centre[axis] = mesh.bounds_centre[axis];
+		header.bounds_min[axis] = mesh.bounds_min[axis];
+		header.bounds_max[axis] = mesh.bounds_max[axis];
+	}
+	header.bounds_radius = mesh.bounds_radius;
+
+	size_t vertex_bytes = mesh.packed_vertices.size() * sizeof(packed_vertex);
+	size_t index_bytes = mesh.indices.size() * sizeof(uint32_t);
+	header.vertex_offset = align_cache_offset(sizeof(mesh_cache_header));
+	header.index_offset = align_cache_offset(header.vertex_offset + vertex_bytes);
+	header.palette_offset = align_cache_offset(header.index_offset + index_bytes);
+	size_t palette_bytes = mesh.palette.size() * sizeof(glm::vec3);
+	header.lod_offset = align_cache_offset(header.palette_offset + palette_bytes);
+
+	// Write to a temporary file first so a crash never leaves a half written cache
+	std::string cache_path = mesh_cache_path(filename);
+	std::string temp_path = cache_path + ".tmp";
+	FILE* f;
+	fopen_s(&f, temp_path.c_str(), "wb");
+	if (f == NULL)
+		return false;
+
+	static const unsigned char padding[MESH_CACHE_ALIGN] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(padding, 1, header.vertex_offset - sizeof(header), f) == header.vertex_offset - sizeof(header);
+	ok = ok && fwrite(mesh.packed_vertices.data(), 1, vertex_bytes, f) == vertex_bytes;
+	ok = ok && fwrite(padding, 1, header.index_offset - header.vertex_offset - vertex_bytes, f) == header.index_offset - header.vertex_offset - vertex_bytes;
+	ok = ok && fwrite(mesh.indices.data(), 1, index_bytes, f) == index_bytes;
+	ok = ok && fwrite(padding, 1, header.palette_offset - header.index_offset - index_bytes, f) == header.palette_offset - header.index_offset - index_bytes;
+	ok = ok && fwrite(mesh.palette.data(), sizeof(glm::vec3), mesh.palette.size(), f) == mesh.palette.size();
+	ok = ok && fwrite(padding, 1, header.lod_offset - header.palette_offset - palette_bytes, f) == header.lod_offset - header.palette_offset - palette_bytes;
+	ok = ok && fwrite(mesh.lods.data(), sizeof(mesh_lod), mesh.lods.size(), f) == mesh.lods.size();
+	fclose(f);
+
+	if (!ok) {
+		remove(temp_path.c_str());
+		return false;
+	}
+	// Rename does not overwrite on Windows
+	remove(cache_path.c_str());
+	return rename(temp_path.c_str(), cache_path.c_str()) == 0;
+}
+
+// Read an OBJ into packed vertices and indices, using the binary cache when it is up to date
+// Makes no GL calls, so it can run on a loader thread
+void read_obj_mesh(const char* filename, const char* base_folder, bool uses_normal, indexed_mesh* out_mesh)
+{
+	int floats_per_vertex = uses_normal ? MESH_VERTEX_FLOATS : MESH_VERTEX_FLOATS_NO_TANGENT;
+	std::string cache_path = mesh_cache_path(filename);
+
+	mapped_file map;
+	if (map_file(cache_path.c_str(), &map)) {
+		if (validate_mesh_cache(map, filename, floats_per_vertex)) {
+			const mesh_cache_header* header = (const mesh_cache_header*)map.data;
+			out_mesh->vertices.clear();
+			out_mesh->floats_per_vertex = floats_per_vertex;
+			// Vertices and indices are uploaded straight from the mapping, which stays open until then
+			out_mesh->packed_vertices.clear();
+			out_mesh->indices.clear();
+			out_mesh->cached_vertices = (const packed_vertex*)(map.data + header->vertex_offset);
+			out_mesh->cached_indices = (const uint32_t*)(map.data + header->index_offset);
+			out_mesh->num_vertices = header->num_vertices;
+			out_mesh->num_indices = header->num_indices;
+			out_mesh->pos_offset = glm::vec3(header->pos_offset[0], header->pos_offset[1], header->pos_offset[2]);
+			out_mesh->pos_scale = glm::vec3(header->pos_scale[0], header->pos_scale[1], header->pos_scale[2]);
+			const glm::vec3* palette = (const glm::vec3*)(map.data + header->palette_offset);
+			out_mesh->palette.assign(palette, palette + header->num_colours);
+			const mesh_lod* lods = (const mesh_lod*)(map.data + header->lod_offset);
+			out_mesh->lods.assign(lods, lods + header->num_lods);
+			out_mesh->bounds_centre = glm::vec3(header->bounds_centre[0], header->bounds_centre[1], header->bounds_centre[2]);
+			out_mesh->bounds_radius = header->bounds_radius;
+			out_mesh->bounds_min = glm::vec3(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+			out_mesh->bounds_max = glm::vec3(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+
+			printf("Loaded %s from mesh cache (%u vertices, %u triangles).\n", filename, header->num_vertices, out_mesh->lods[0].num_indices / 3);
+			print_optimize_stats(filename, header->optimize_stats);
+			print_mesh_lods(filename, out_mesh->lods);
+			out_mesh->cache_map = owned_mapped_file(map);
+			return;
+		}
+		unmap_file(&map);
+	}
+
+	// Cache missing or stale, parse the OBJ and rebuild it
+	std::vector<triangle> triangles;
+	std::vector<tinyobj::material_t> materials;
+	int64_t mtime;
+	uint64_t size;
+	if (get_file_stamp(filename, &mtime, &size) && size >= PARALLEL_OBJ_MIN_BYTES) {
+		obj_parse_parallel(filename, &triangles, base_folder, &materials);
+	}
+	else {
+		obj_parse(filename, &triangles, base_folder, &materials);
+	}
+	tri_to_indexed_mesh(triangles, uses_normal, out_mesh);
+	mesh_optimize_stats optimize_stats = optimize_indexed_mesh(out_mesh, filename);
+	build_mesh_lods(out_mesh, filename);
+	pack_indexed_mesh(out_mesh);
+
+	if (write_mesh_cache(filename, *out_mesh, optimize_stats)) {
+		printf("Wrote mesh cache %s.\n", cache_path.c_str());
+	}
+	else {
+		std::cerr << "Failed to write mesh cache: " << cache_path << std::endl;
+	}
+}
+
+// Load an OBJ as packed vertices into the packed arena, blocking until it is uploaded
+void load_obj_mesh(const char* filename, const char* base_folder, bool uses_normal, geometry_arena& arena, indexed_mesh* out_mesh)
+{
+	read_obj_mesh(filename, base_folder, uses_normal, out_mesh);
+	upload_packed_mesh(arena, *out_mesh);
+	release_mesh_cache(*out_mesh);
+}
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "mesh_optimize.h"
+#include "frustum.h"
+
+// Each LOD aims for this fraction of the triangles of the one before it
+#define LOD_REDUCTION 0.5f
+// A LOD is dropped from the chain when it keeps more than this fraction of the previous triangles
+#define LOD_MIN_REDUCTION 0.9f
+// Largest simplification error, in pixels, a LOD may show on screen
+#define LOD_PIXEL_ERROR 1.f
+
+// Error quadric (Garland and Heckbert 1997), the upper triangle of a symmetric 4x4 matrix
+// Weight is the triangle area summed into it, so the error can be turned back into a distance
+struct quadric
+{
+	double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+	double weight;
+
+	void add(const quadric& other)
+	{
+		xx += other.xx; xy += other.xy; xz += other.xz; xw += other.xw;
+		yy += other.yy; yz += other.yz; yw += other.yw;
+		zz += other.zz; zw += other.zw;
+		ww += other.ww;
+		weight += other.weight;
+	}
+
+	// Area weighted mean squared distance from p to the planes summed into the quadric
+	double error(const glm::vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = xx * x * x + 2.0 * xy * x * y + 2.0 * xz * x * z + 2.0 * xw * x
+			+ yy * y * y + 2.0 * yz * y * z + 2.0 * yw * y
+			+ zz * z * z + 2.0 * zw * z
+			+ ww;
+		return weight > 0.0 ? fabs(e) / weight : 0.0;
+	}
+};
+
+quadric plane_quadric(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+{
+	quadric q = {};
+	glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+	float length = glm::length(n);
+	if (length == 0.f)
+		return q;
+	double area = length * 0.5;
+	double a = n.x / length, b = n.y / length, c = n.z / length;
+	double d = -(a * p0.x + b * p0.y + c * p0.z);
+	q.xx = a * a * area; q.xy = a * b * area; q.xz = a * c * area; q.xw = a * d * area;
+	q.yy = b * b * area; q.yz = b * c * area; q.yw = b * d * area;
+	q.zz = c * c * area; q.zw = c * d * area;
+	q.ww = d * d * area;
+	q.weight = area;
+	return q;
+}
+
+struct lod_collapse
+{
+	uint32_t from;
+	uint32_t to;
+	float error;
+};
+
+// Quadric error edge collapse of an indexed triangle list, down to roughly target_triangles
+// Vertices only ever move onto one of their neighbours, so the result indexes the same vertex buffer
+// Open borders stay fixed, and a vertex on a UV or material seam only collapses along the seam
+// out_error receives the largest distance the surface moved
+std::vector<uint32_t> simplify_mesh(const std::vector<GLfloat>& vertices, int floats_per_vertex, const std::vector<uint32_t>& indices, size_t target_triangles, float* out_error)
+{
+	size_t num_vertices = vertices.size() / floats_per_vertex;
+	std::vector<uint32_t> result = indices;
+	*out_error = 0.f;
+
+	// Vertices split by a seam share a position, collapses are decided per position
+	std::vector<uint32_t> order(num_vertices);
+	for (uint32_t v = 0; v < num_vertices; v++) {
+		order[v] = v;
+	}
+	auto position_less = [&](uint32_t a, uint32_t b) {
+		const GLfloat* pa = &vertices[(size_t)a * floats_per_vertex];
+		const GLfloat* pb = &vertices[(size_t)b * floats_per_vertex];
+		return memcmp(pa, pb, 3 * sizeof(GLfloat)) < 0;
+	};
+	std::sort(order.begin(), order.end(), position_less);
+	std::vector<uint32_t> position_of(num_vertices);
+	std::vector<glm::vec3> positions;
+	for (size_t i = 0; i < num_vertices; i++) {
+		if (i == 0 || position_less(order[i - 1], order[i])) {
+			const GLfloat* p = &vertices[(size_t)order[i] * floats_per_vertex];
+			positions.push_back(glm::vec3(p[0], p[1], p[2]));
+		}
+		position_of[order[i]] = (uint32_t)(positions.size() - 1);
+	}
+	size_t num_positions = positions.size();
+
+	// Edges used by one triangle are open borders, edges used by more than two are non manifold
+	// Either way the positions on them stay put
+	std::vector<uint64_t> edges;
+	edges.reserve(result.size());
+	for (size_t i = 0; i < result.size(); i += 3) {
+		for (int e = 0; e < 3; e++) {
+			uint32_t a = position_of[result[i + e]], b = position_of[result[i + (e + 1) % 3]];
+			if (a != b)
+				edges.push_back(((uint64_t)std::min(a, b) << 32) | std::max(a, b));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	std::vector<char> locked(num_positions, 0);
+	for (size_t i = 0; i < edges.size();) {
+		size_t j = i;
+		while (j < edges.size() && edges[j] == edges[i])
+			j++;
+		if (j - i != 2) {
+			locked[edges[i] >> 32] = 1;
+			locked[edges[i] & 0xFFFFFFFF] = 1;
+		}
+		i = j;
+	}
+
+	std::vector<quadric> quadrics(num_positions, quadric());
+	for (size_t i = 0; i < result.size(); i += 3) {
+		uint32_t p0 = position_of[result[i]], p1 = position_of[result[i + 1]], p2 = position_of[result[i + 2]];
+		quadric q = plane_quadric(positions[p0], positions[p1], positions[p2]);
+		quadrics[p0].add(q);
+		quadrics[p1].add(q);
+		quadrics[p2].add(q);
+	}
+
+	std::vector<uint32_t> first_face(num_positions + 1);
+	std::vector<uint32_t> position_faces;
+	std::vector<uint32_t> remap(num_vertices);
+	std::vector<char> touched(num_positions);
+	std::vector<lod_collapse> collapses;
+
+	while (result.size() / 3 > target_triangles) {
+		size_t num_triangles = result.size() / 3;
+
+		// Triangles around each position
+		std::fill(first_face.begin(), first_face.end(), 0);
+		for (size_t i = 0; i < result.size(); i++) {
+			first_face[position_of[result[i]] + 1]++;
+		}
+		for (size_t p = 0; p < num_positions; p++) {
+			first_face[p + 1] += first_face[p];
+		}
+		position_faces.resize(result.size());
+		std::vector<uint32_t> fill(first_face.begin(), first_face.end() - 1);
+		for (size_t i = 0; i < result.size(); i++) {
+			position_faces[fill[position_of[result[i]]]++] = (uint32_t)(i / 3);
+		}
+
+		// Cheaper direction of every edge, shared edges show up once per triangle
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int e = 0; e < 3; e++) {
+				uint32_t a = result[i + e], b = result[i + (e + 1) % 3];
+				uint32_t pa = position_of[a], pb = position_of[b];
+				if (pa == pb || (locked[pa] && locked[pb]))
+					continue;
+				quadric q = quadrics[pa];
+				q.add(quadrics[pb]);
+				float error_ab = locked[pa] ? FLT_MAX : (float)q.error(positions[pb]);
+				float error_ba = locked[pb] ? FLT_MAX : (float)q.error(positions[pa]);
+				lod_collapse collapse;
+				collapse.from = error_ab <= error_ba ? a : b;
+				collapse.to = error_ab <= error_ba ? b : a;
+				collapse.error = std::min(error_ab, error_ba);
+				collapses.push_back(collapse);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const lod_collapse& a, const lod_collapse& b) {
+			return a.error < b.error;
+		});
+
+		// Take the cheapest collapses whose neighbourhoods do not overlap, an interior collapse removes two triangles
+		for (uint32_t v = 0; v < num_vertices; v++) {
+			remap[v] = v;
+		}
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t triangles_left = num_triangles;
+		size_t applied = 0;
+		for (const lod_collapse& collapse : collapses) {
+			if (triangles_left <= target_triangles)
+				break;
+			uint32_t pu = position_of[collapse.from], pv = position_of[collapse.to];
+			if (touched[pu] || touched[pv])
+				continue;
+
+			// Every vertex at u needs a neighbour at v to move onto, which keeps seams intact
+			// Moving u must not flip or sharply turn any triangle that survives the collapse
+			bool valid = true;
+			size_t removed = 0;
+			for (uint32_t f = first_face[pu]; f < first_face[pu + 1] && valid; f++) {
+				const uint32_t* tri = &result[(size_t)position_faces[f] * 3];
+				int corner = position_of[tri[0]] == pu ? 0 : position_of[tri[1]] == pu ? 1 : 2;
+				int other = -1;
+				for (int c = 0; c < 3; c++) {
+					if (position_of[tri[c]] == pv)
+						other = c;
+				}
+				if (other >= 0) {
+					removed++;
+					continue;
+				}
+				glm::vec3 p1 = positions[position_of[tri[(corner + 1) % 3]]];
+				glm::vec3 p2 = positions[position_of[tri[(corner + 2) % 3]]];
+				glm::vec3 before = glm::cross(p1 - positions[pu], p2 - positions[pu]);
+				glm::vec3 after = glm::cross(p1 - positions[pv], p2 - positions[pv]);
+				// Reject flips, and turns of more than about 75 degrees which leave slivers standing on edge
+				if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+					valid = false;
+			}
+			for (uint32_t f = first_face[pu]; f < first_face[pu + 1] && valid; f++) {
+				const uint32_t* tri = &result[(size_t)position_faces[f] * 3];
+				for (int corner = 0; corner < 3; corner++) {
+					uint32_t wedge = tri[corner];
+					if (position_of[wedge] != pu || remap[wedge] != wedge)
+						continue;
+					// Find a triangle joining this vertex to position v
+					uint32_t target = wedge;
+					for (uint32_t g = first_face[pu]; g < first_face[pu + 1] && target == wedge; g++) {
+						const uint32_t* around = &result[(size_t)position_faces[g] * 3];
+						if (around[0] != wedge && around[1] != wedge && around[2] != wedge)
+							continue;
+						for (int c = 0; c < 3; c++) {
+							if (position_of[around[c]] == pv)
+								target = around[c];
+						}
+					}
+					if (target == wedge) {
+						valid = false;
+						break;
+					}
+					remap[wedge] = target;
+				}
+			}
+			if (!valid || removed == 0) {
+				// Undo any vertices already pointed at v
+				for (uint32_t f = first_face[pu]; f < first_face[pu + 1]; f++) {
+					const uint32_t* tri = &result[(size_t)position_faces[f] * 3];
+					for (int c = 0; c < 3; c++) {
+						if (position_of[tri[c]] == pu)
+							remap[tri[c]] = tri[c];
+					}
+				}
+				continue;
+			}
+
+			// Nothing around u may move again this pass, the flip test above relied on their positions
+			for (uint32_t f = first_face[pu]; f < first_face[pu + 1]; f++) {
+				const uint32_t* tri = &result[(size_t)position_faces[f] * 3];
+				for (int c = 0; c < 3; c++) {
+					touched[position_of[tri[c]]] = 1;
+				}
+			}
+			quadrics[pv].add(quadrics[pu]);
+			*out_error = std::max(*out_error, collapse.error);
+			triangles_left -= removed;
+			applied++;
+		}
+		if (applied == 0)
+			break;
+
+		// Apply the collapses and drop the triangles that became degenerate
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			uint32_t i0 = remap[result[i]], i1 = remap[result[i + 1]], i2 = remap[result[i + 2]];
+			uint32_t p0 = position_of[i0], p1 = position_of[i1], p2 = position_of[i2];
+			if (p0 == p1 || p1 == p2 || p0 == p2)
+				continue;
+			result[write++] = i0;
+			result[write++] = i1;
+			result[write++] = i2;
+		}
+		result.resize(write);
+	}
+
+	*out_error = sqrtf(*out_error);
+	return result;
+}
+
+// Bounding sphere and box of the vertices the mesh uses, for screen size LOD selection and culling
+// Call before pack_indexed_mesh, which drops the float vertices
+void compute_mesh_bounds(indexed_mesh* mesh)
+{
+	bounding_volume bounds = vertex_bounding_volume(mesh->vertices.data(), mesh->vertices.size() / mesh->floats_per_vertex, mesh->floats_per_vertex);
+	mesh->bounds_centre = bounds.centre;
+	mesh->bounds_radius = bounds.radius;
+	mesh->bounds_min = bounds.box_min;
+	mesh->bounds_max = bounds.box_max;
+}
+
+// Bounds of a mesh in the form the frustum tests take
+bounding_volume mesh_bounding_volume(const indexed_mesh& mesh)
+{
+	bounding_volume bounds;
+	bounds.box_min = mesh.bounds_min;
+	bounds.box_max = mesh.bounds_max;
+	bounds.centre = mesh.bounds_centre;
+	bounds.radius = mesh.bounds_radius;
+	return bounds;
+}
+
+void print_mesh_lods(const char* name, const std::vector<mesh_lod>& lods)
+{
+	printf("%s LODs:", name);
+	for (size_t i = 0; i < lods.size(); i++) {
+		printf(" %u (error %g)", lods[i].num_indices / 3, lods[i].error);
+	}
+	printf(" triangles\n");
+}
+
+// Simplify the optimized mesh into up to MAX_MESH_LODS levels appended to its index buffer
+// Run after optimize_indexed_mesh and before pack_indexed_mesh, every level shares the vertex buffer
+void build_mesh_lods(indexed_mesh* mesh, const char* name)
+{
+	compute_mesh_bounds(mesh);
+
+	mesh_lod full;
+	full.first_index = 0;
+	full.num_indices = (uint32_t)mesh->indices.size();
+	full.error = 0.f;
+	mesh->lods.assign(1, full);
+
+	std::vector<uint32_t> previous = mesh->indices;
+	size_t num_vertices = mesh->vertices.size() / mesh->floats_per_vertex;
+	while (mesh->lods.size() < MAX_MESH_LODS) {
+		size_t previous_triangles = previous.size() / 3;
+		float error;
+		std::vector<uint32_t> lod = simplify_mesh(mesh->vertices, mesh->floats_per_vertex, previous, (size_t)(previous_triangles * LOD_REDUCTION), &error);
+		if (lod.empty() || lod.size() / 3 > previous_triangles * LOD_MIN_REDUCTION)
+			break;
+		std::vector<size_t> cluster_starts;
+		optimize_vertex_cache(lod, num_vertices, &cluster_starts);
+
+		// Errors add up along the chain, so each level is measured against LOD 0
+		mesh_lod level;
+		level.first_index = (uint32_t)mesh->indices.size();
+		level.num_indices = (uint32_t)lod.size();
+		level.error = mesh->lods.back().error + error;
+		mesh->lods.push_back(level);
+		mesh->indices.insert(mesh->indices.end(), lod.begin(), lod.end());
+		previous.swap(lod);
+	}
+	mesh->num_indices = (uint32_t)mesh->indices.size();
+
+	print_mesh_lods(name, mesh->lods);
+}
+
+// Object space units to pixels at the nearest point of the mesh's bounding sphere, FLT_MAX when the eye is inside it
+// fov is the vertical field of view in degrees and viewport_height is in pixels
+float mesh_pixels_per_unit(const indexed_mesh& mesh, const glm::mat4& model, const glm::vec3& eye, float fov, float viewport_height)
+{
+	glm::vec3 centre = glm::vec3(model * glm::vec4(mesh.bounds_centre, 1.f));
+	float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	float distance = glm::length(centre - eye) - mesh.bounds_radius * scale;
+	if (distance <= 0.f)
+		return FLT_MAX;
+	return scale * viewport_height / (2.f * distance * tanf(glm::radians(fov) * 0.5f));
+}
+
+// Coarsest LOD whose error stays under LOD_PIXEL_ERROR at the projected size of the mesh
+int select_mesh_lod(const indexed_mesh& mesh, const glm::mat4& model, const glm::vec3& eye, float fov, float viewport_height)
+{
+	if (mesh.lods.size() <= 1)
+		return 0;
+
+	float pixels_per_unit = mesh_pixels_per_unit(mesh, model, eye, fov, viewport_height);
+	if (pixels_per_unit == FLT_MAX)
+		return 0;
+	int lod = 0;
+	while (lod + 1 < (int)mesh.lods.size() && mesh.lods[lod + 1].error * pixels_per_unit <= LOD_PIXEL_ERROR) {
+		lod++;
+	}
+	return lod;
+}
+
+// Indices of one level of a mesh, relative to the mesh's first index
+mesh_lod mesh_lod_range(const indexed_mesh& mesh, int lod)
+{
+	if (mesh.lods.empty())
+		return mesh_lod{ 0, mesh.num_indices, 0.f };
+	return mesh.lods[lod];
+}
+
+// Triangles drawn at the given LOD
+uint32_t mesh_lod_triangles(const indexed_mesh& mesh, int lod)
+{
+	return (mesh.lods.empty() ? mesh.num_indices : mesh.lods[lod].num_indices) / 3;
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+// Size of the post transform cache the triangle order is tuned for
+#define VERTEX_CACHE_SIZE 16
+// How much worse than its cluster's ACMR a split point may be when clustering for overdraw
+#define OVERDRAW_ACMR_THRESHOLD 1.05f
+
+// Average cache miss ratio (transformed vertices per triangle) and average transform to vertex ratio
+struct vertex_cache_stats
+{
+	float acmr = 0.f;
+	float atvr = 0.f;
+};
+
+// Before and after figures for one mesh, stored in the mesh cache so warm loads can report them too
+struct mesh_optimize_stats
+{
+	vertex_cache_stats before;
+	vertex_cache_stats after;
+};
+
+// Simulate a FIFO post transform cache over the index buffer
+vertex_cache_stats measure_vertex_cache(const std::vector<uint32_t>& indices, size_t num_vertices, int cache_size = VERTEX_CACHE_SIZE)
+{
+	vertex_cache_stats stats;
+	if (indices.empty() || num_vertices == 0)
+		return stats;
+
+	// Vertex is in the cache if it was loaded fewer than cache_size misses ago
+	std::vector<size_t> loaded_at(num_vertices, 0);
+	std::vector<bool> referenced(num_vertices, false);
+	size_t misses = 0;
+	size_t unique = 0;
+	for (uint32_t index : indices) {
+		if (!referenced[index]) {
+			referenced[index] = true;
+			unique++;
+		}
+		if (loaded_at[index] == 0 || misses - (loaded_at[index] - 1) >= (size_t)cache_size) {
+			misses++;
+			loaded_at[index] = misses;
+		}
+	}
+
+	stats.acmr = (float)misses / (indices.size() / 3);
+	stats.atvr = (float)misses / unique;
+	return stats;
+}
+
+// Tipsify (Sander, Nehab and Barczak 2007), reorders triangles to reuse the post transform cache
+// out_cluster_starts receives the first triangle of each run that starts from a cold cache
+void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t num_vertices, std::vector<size_t>* out_cluster_starts)
+{
+	size_t num_triangles = indices.size() / 3;
+	out_cluster_starts->clear();
+	if (num_triangles == 0)
+		return;
+
+	// Triangles around each vertex
+	std::vector<uint32_t> first_face(num_vertices + 1, 0);
+	for (uint32_t index : indices) {
+		first_face[index + 1]++;
+	}
+	for (size_t v = 0; v < num_vertices; v++) {
+		first_face[v + 1] += first_face[v];
+	}
+	std::vector<uint32_t> vertex_faces(indices.size());
+	std::vector<uint32_t> fill(first_face.begin(), first_face.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++) {
+		vertex_faces[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	// Triangles still to be emitted around each vertex
+	std::vector<uint32_t> live(num_vertices);
+	for (size_t v = 0; v < num_vertices; v++) {
+		live[v] = first_face[v + 1] - first_face[v];
+	}
+
+	std::vector<size_t> cache_time(num_vertices, 0);
+	std::vector<bool> emitted(num_triangles, false);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	size_t time = VERTEX_CACHE_SIZE + 1;
+	size_t cursor = 0;
+	int64_t fan = indices[0];
+	out_cluster_starts->push_back(0);
+
+	while (fan >= 0) {
+		candidates.clear();
+
+		// Emit every remaining triangle around the fanning vertex
+		for (uint32_t i = first_face[fan]; i < first_face[fan + 1]; i++) {
+			uint32_t t = vertex_faces[i];
+			if (emitted[t])
+				continue;
+			emitted[t] = true;
+			for (int c = 0; c < 3; c++) {
+				uint32_t v = indices[t * 3 + c];
+				output.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cache_time[v] > VERTEX_CACHE_SIZE) {
+					cache_time[v] = time;
+					time++;
+				}
+			}
+		}
+
+		// Pick the candidate that stays in the cache longest while its triangles are emitted
+		int64_t best = -1;
+		size_t best_priority = 0;
+		for (uint32_t v : candidates) {
+			if (live[v] == 0)
+				continue;
+			size_t priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= VERTEX_CACHE_SIZE) {
+				priority = time - cache_time[v];
+			}
+			if (best < 0 || priority > best_priority) {
+				best = v;
+				best_priority = priority;
+			}
+		}
+
+		if (best < 0) {
+			// Dead end, fall back to a recently used vertex or the next unfinished one
+			while (!dead_end.empty() && best < 0) {
+				uint32_t v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v] > 0)
+					best = v;
+			}
+			while (best < 0 && cursor < num_vertices) {
+				if (live[cursor] > 0)
+					best = (int64_t)cursor;
+				cursor++;
+			}
+			if (best >= 0) {
+				out_cluster_starts->push_back(output.size() / 3);
+			}
+		}
+		fan = best;
+	}
+
+	indices.swap(output);
+}
+
+// Split the cold cache runs from Tipsify into smaller clusters wherever the cache has just been well used
+// Each cluster starts from a cold cache, so the threshold bounds how much sorting them can cost
+std::vector<size_t> split_clusters(const std::vector<uint32_t>& indices, size_t num_vertices, const std::vector<size_t>& hard_starts, float threshold)
+{
+	size_t num_triangles = indices.size() / 3;
+	std::vector<size_t> loaded_at(num_vertices, 0);
+	size_t misses = 0;
+
+	// Misses of triangle t with a cache that starts cold at the beginning of the cluster
+	auto triangle_misses = [&](size_t t) {
+		size_t before = misses;
+		for (int c = 0; c < 3; c++) {
+			uint32_t v = indices[t * 3 + c];
+			if (loaded_at[v] == 0 || misses - (loaded_at[v] - 1) >= VERTEX_CACHE_SIZE) {
+				misses++;
+				loaded_at[v] = misses;
+			}
+		}
+		return misses - before;
+	};
+	// Moving far enough ahead empties the simulated cache
+	auto flush = [&]() { misses += VERTEX_CACHE_SIZE; };
+
+	std::vector<size_t> starts;
+	for (size_t h = 0; h < hard_starts.size(); h++) {
+		size_t begin = hard_starts[h];
+		size_t end = h + 1 < hard_starts.size() ? hard_starts[h + 1] : num_triangles;
+
+		flush();
+		size_t cluster_misses = 0;
+		for (size_t t = begin; t < end; t++) {
+			cluster_misses += triangle_misses(t);
+		}
+		float cluster_acmr = (float)cluster_misses / std::max<size_t>(end - begin, 1);
+
+		flush();
+		starts.push_back(begin);
+		size_t run_misses = 0, run_triangles = 0;
+		for (size_t t = begin; t < end; t++) {
+			run_misses += triangle_misses(t);
+			run_triangles++;
+			if (t + 1 < end && (float)run_misses / run_triangles <= threshold * cluster_acmr) {
+				starts.push_back(t + 1);
+				run_misses = 0;
+				run_triangles = 0;
+				flush();
+			}
+		}
+	}
+	return starts;
+}
+
+// Sort the clusters so outward facing ones draw first, which cuts overdraw from most view directions
+void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<GLfloat>& vertices, int floats_per_vertex, const std::vector<size_t>& cluster_starts)
+{
+	size_t num_triangles = indices.size() / 3;
+	size_t num_clusters = cluster_starts.size();
+	if (num_clusters < 2)
+		return;
+
+	auto position = [&](uint32_t index) {
+		const GLfloat* v = &vertices[(size_t)index * floats_per_vertex];
+		return glm::vec3(v[0], v[1], v[2]);
+	};
+
+	// Area weighted centre of the whole mesh
+	glm::vec3 mesh_centre(0.f);
+	float mesh_area = 0.f;
+	std::vector<glm::vec3> cluster_centre(num_clusters, glm::vec3(0.f));
+	std::vector<glm::vec3> cluster_normal(num_clusters, glm::vec3(0.f));
+	std::vector<float> cluster_area(num_clusters, 0.f);
+
+	for (size_t c = 0; c < num_clusters; c++) {
+		size_t end = c + 1 < num_clusters ? cluster_starts[c + 1] : num_triangles;
+		for (size_t t = cluster_starts[c]; t < end; t++) {
+			glm::vec3 p0 = position(indices[t * 3 + 0]);
+			glm::vec3 p1 = position(indices[t * 3 + 1]);
+			glm::vec3 p2 = position(indices[t * 3 + 2]);
+			glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(cross) * 0.5f;
+			glm::vec3 centre = (p0 + p1 + p2) / 3.f;
+
+			cluster_centre[c] += centre * area;
+			cluster_normal[c] += cross;
+			cluster_area[c] += area;
+		}
+		mesh_centre += cluster_centre[c];
+		mesh_area += cluster_area[c];
+	}
+	if (mesh_area > 0.f)
+		mesh_centre /= mesh_area;
+
+	// Clusters pointing away from the centre are likely to occlude the rest
+	std::vector<float> sort_key(num_clusters);
+	std::vector<size_t> order(num_clusters);
+	for (size_t c = 0; c < num_clusters; c++) {
+		glm::vec3 centre = cluster_area[c] > 0.f ? cluster_centre[c] / cluster_area[c] : mesh_centre;
+		float length = glm::length(cluster_normal[c]);
+		glm::vec3 normal = length > 0.f ? cluster_normal[c] / length : glm::vec3(0.f);
+		sort_key[c] = glm::dot(centre - mesh_centre, normal);
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sort_key[a] > sort_key[b]; });
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indices.size());
+	for (size_t c : order) {
+		size_t end = c + 1 < num_clusters ? cluster_starts[c + 1] : num_triangles;
+		sorted.insert(sorted.end(), indices.begin() + cluster_starts[c] * 3, indices.begin() + end * 3);
+	}
+	indices.swap(sorted);
+}
+
+// Renumber vertices in the order the index buffer first uses them so vertex fetches stream through memory
+void optimize_vertex_fetch(std::vector<uint32_t>& indices, std::vector<GLfloat>& vertices, int floats_per_vertex)
+{
+	size_t num_vertices = vertices.size() / floats_per_vertex;
+	std::vector<uint32_t> remap(num_vertices, UINT32_MAX);
+	std::vector<GLfloat> reordered;
+	reordered.reserve(vertices.size());
+
+	uint32_t next = 0;
+	for (uint32_t& index : indices) {
+		if (remap[index] == UINT32_MAX) {
+			remap[index] = next++;
+			const GLfloat* v = &vertices[(size_t)index * floats_per_vertex];
+			reordered.insert(reordered.end(), v, v + floats_per_vertex);
+		}
+		index = remap[index];
+	}
+	// Vertices no triangle uses are dropped
+	vertices.swap(reordered);
+}
+
+void print_optimize_stats(const char* name, const mesh_optimize_stats& stats)
+{
+	printf("%s vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name, stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr);
+}
+
+// Reorder triangles for the vertex cache and overdraw, then vertices for fetch locality
+mesh_optimize_stats optimize_indexed_mesh(indexed_mesh* mesh, const char* name)
+{
+	mesh_optimize_stats stats;
+	size_t num_vertices = mesh->vertices.size() / mesh->floats_per_vertex;
+	stats.before = measure_vertex_cache(mesh->indices, num_vertices);
+
+	std::vector<size_t> hard_starts;
+	optimize_vertex_cache(mesh->indices, num_vertices, &hard_starts);
+	std::vector<size_t> cluster_starts = split_clusters(mesh->indices, num_vertices, hard_starts, OVERDRAW_ACMR_THRESHOLD);
+	optimize_overdraw(mesh->indices, mesh->vertices, mesh->floats_per_vertex, cluster_starts);
+	optimize_vertex_fetch(mesh->indices, mesh->vertices, mesh->floats_per_vertex);
+
+	mesh->num_vertices = (uint32_t)(mesh->vertices.size() / mesh->floats_per_vertex);
+	mesh->num_indices = (uint32_t)mesh->indices.size();
+	stats.after = measure_vertex_cache(mesh->indices, mesh->num_vertices);
+
+	print_optimize_stats(name, stats);
+	return stats;
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+// SSE2 is always there on x64 builds, other targets use the plain float path
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MIP_SIMD 1
+#else
+#define MIP_SIMD 0
+#endif
+
+enum mip_filter
+{
+	// 2x2 average
+	MIP_FILTER_BOX,
+	// Kaiser windowed sinc, sharper than the box filter without its aliasing
+	MIP_FILTER_KAISER
+};
+
+// Filter baked mip chains are built with
+#define MIP_FILTER MIP_FILTER_KAISER
+// Kaiser support in destination texels each side and window shape
+#define KAISER_RADIUS 2.0f
+#define KAISER_ALPHA 4.0f
+
+// How to filter one image's mip chain
+struct mip_options
+{
+	// Colour data stored in sRGB, filtered in linear light
+	bool srgb = false;
+	// Tangent space normals, renormalized after filtering
+	bool normal = false;
+	// Repeating textures wrap at the edges, the rest clamp
+	bool wrap = true;
+	mip_filter filter = MIP_FILTER;
+};
+
+// Packed into baked caches so a change of options rebuilds them
+uint32_t mip_options_bits(const mip_options& options)
+{
+	return (options.srgb ? 1 : 0) | (options.normal ? 2 : 0) | (options.wrap ? 4 : 0) | ((uint32_t)options.filter << 3);
+}
+
+int mip_extent(int size, int level)
+{
+	return std::max(1, size >> level);
+}
+
+// Levels down to 1x1, the same chain glGenerateMipmap builds
+int full_mip_count(int width, int height)
+{
+	int levels = 1;
+	while ((std::max(width, height) >> levels) > 0)
+		levels++;
+	return levels;
+}
+
+// Expand 1 to 4 channel pixels to RGBA, grey images go to every colour channel
+std::vector<unsigned char> expand_to_rgba(const unsigned char* pixels, int width, int height, int channels)
+{
+	size_t count = (size_t)width * height;
+	std::vector<unsigned char> rgba(count * 4);
+	for (size_t i = 0; i < count; i++) {
+		const unsigned char* src = pixels + i * channels;
+		unsigned char* dst = &rgba[i * 4];
+		if (channels < 3) {
+			dst[0] = dst[1] = dst[2] = src[0];
+			dst[3] = channels == 2 ? src[1] : 255;
+		}
+		else {
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = channels == 4 ? src[3] : 255;
+		}
+	}
+	return rgba;
+}
+
+// 8 bit sRGB to linear
+const float* srgb_to_linear_table()
+{
+	static float table[256];
+	static bool built = [] {
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return true;
+	}();
+	(void)built;
+	return table;
+}
+
+// Linear in 1/65535 steps to 8 bit sRGB, fine enough that dark values do not band
+#define LINEAR_TO_SRGB_STEPS 65536
+const unsigned char* linear_to_srgb_table()
+{
+	static unsigned char table[LINEAR_TO_SRGB_STEPS];
+	static bool built = [] {
+		for (int i = 0; i < LINEAR_TO_SRGB_STEPS; i++) {
+			float c = i / (float)(LINEAR_TO_SRGB_STEPS - 1);
+			float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+			table[i] = (unsigned char)(s * 255.0f + 0.5f);
+		}
+		return true;
+	}();
+	(void)built;
+	return table;
+}
+
+// Zeroth order modified Bessel function for the Kaiser window
+float bessel_i0(float x)
+{
+	float sum = 1.0f, term = 1.0f;
+	for (int k = 1; k < 20; k++) {
+		term *= (x / (2.0f * k)) * (x / (2.0f * k));
+		sum += term;
+	}
+	return sum;
+}
+
+float mip_filter_weight(float t, mip_filter filter)
+{
+	if (filter == MIP_FILTER_BOX)
+		return fabsf(t) <= 0.5f ? 1.0f : 0.0f;
+	float x = t / KAISER_RADIUS;
+	if (fabsf(x) >= 1.0f)
+		return 0.0f;
+	float sinc = t == 0.0f ? 1.0f : sinf(3.14159265f * t) / (3.14159265f * t);
+	return sinc * bessel_i0(KAISER_ALPHA * sqrtf(1.0f - x * x)) / bessel_i0(KAISER_ALPHA);
+}
+
+// Source texels and weights for every texel along one axis of a downsample
+// Every destination texel has the same number of taps, unused ones weigh zero
+struct mip_taps
+{
+	int count = 0;
+	std::vector<int> index;
+	std::vector<float> weight;
+};
+
+mip_taps make_mip_taps(int src_size, int dst_size, const mip_options& options)
+{
+	float scale = (float)src_size / dst_size;
+	float support = (options.filter == MIP_FILTER_BOX ? 0.5f : KAISER_RADIUS) * scale;
+	mip_taps taps;
+	taps.count = (int)ceilf(support * 2.0f) + 1;
+	taps.index.assign((size_t)dst_size * taps.count, 0);
+	taps.weight.assign((size_t)dst_size * taps.count, 0.0f);
+	for (int x = 0; x < dst_size; x++) {
+		float centre = (x + 0.5f) * scale;
+		int first = (int)ceilf(centre - support - 0.5f);
+		float total = 0.0f;
+		for (int k = 0; k < taps.count; k++) {
+			int i = first + k;
+			float w = mip_filter_weight((i + 0.5f - centre) / scale, options.filter);
+			if (options.wrap)
+				i = ((i % src_size) + src_size) % src_size;
+			else
+				i = std::min(std::max(i, 0), src_size - 1);
+			taps.index[x * taps.count + k] = i;
+			taps.weight[x * taps.count + k] = w;
+			total += w;
+		}
+		for (int k = 0; k < taps.count; k++) {
+			taps.weight[x * taps.count + k] /= total;
+		}
+	}
+	return taps;
+}
+
+// Weighted sum of RGBA float pixels, out += src * w for each of count pixels
+void mip_accumulate(float* out, const float* src, float w, int count)
+{
+#if MIP_SIMD
+	__m128 weight = _mm_set1_ps(w);
+	for (int i = 0; i < count; i++) {
+		__m128 acc = _mm_loadu_ps(out + i * 4);
+		_mm_storeu_ps(out + i * 4, _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + i * 4), weight)));
+	}
+#else
+	for (int i = 0; i < count * 4; i++) {
+		out[i] += src[i] * w;
+	}
+#endif
+}
+
+// One source row in linear float RGBA, filtered horizontally to the destination width
+void filter_mip_row(const unsigned char* row, int width, const mip_taps& taps, int dst_width, const mip_options& options, float* linear, float* out)
+{
+	const float* to_linear = srgb_to_linear_table();
+	for (int x = 0; x < width; x++) {
+		const unsigned char* px = row + x * 4;
+		for (int c = 0; c < 3; c++) {
+			linear[x * 4 + c] = options.srgb ? to_linear[px[c]] : px[c] / 255.0f;
+		}
+		linear[x * 4 + 3] = px[3] / 255.0f;
+	}
+
+	for (int x = 0; x < dst_width; x++) {
+		const int* index = &taps.index[x * taps.count];
+		const float* weight = &taps.weight[x * taps.count];
+#if MIP_SIMD
+		__m128 acc = _mm_setzero_ps();
+		for (int k = 0; k < taps.count; k++) {
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(linear + index[k] * 4), _mm_set1_ps(weight[k])));
+		}
+		_mm_storeu_ps(out + x * 4, acc);
+#else
+		float acc[4] = { 0, 0, 0, 0 };
+		for (int k = 0; k < taps.count; k++) {
+			for (int c = 0; c < 4; c++) {
+				acc[c] += linear[index[k] * 4 + c] * weight[k];
+			}
+		}
+		memcpy(out + x * 4, acc, sizeof(acc));
+#endif
+	}
+}
+
+// Filtered linear RGBA back to 8 bits
+void store_mip_row(const float* row, int width, const mip_options& options, unsigned char* out)
+{
+	const unsigned char* to_srgb = linear_to_srgb_table();
+	for (int x = 0; x < width; x++) {
+		float px[4];
+#if MIP_SIMD
+		_mm_storeu_ps(px, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(row + x * 4), _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+#else
+		for (int c = 0; c < 4; c++) {
+			px[c] = std::min(std::max(row[x * 4 + c], 0.0f), 1.0f);
+		}
+#endif
+		if (options.normal) {
+			float n[3] = { px[0] * 2.0f - 1.0f, px[1] * 2.0f - 1.0f, px[2] * 2.0f - 1.0f };
+			float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length > 1e-6f) {
+				for (int c = 0; c < 3; c++) {
+					px[c] = (n[c] / length + 1.0f) * 0.5f;
+				}
+			}
+		}
+		for (int c = 0; c < 3; c++) {
+			out[x * 4 + c] = options.srgb ? to_srgb[(int)(px[c] * (LINEAR_TO_SRGB_STEPS - 1) + 0.5f)] : (unsigned char)(px[c] * 255.0f + 0.5f);
+		}
+		out[x * 4 + 3] = (unsigned char)(px[3] * 255.0f + 0.5f);
+	}
+}
+
+// Downsample one RGBA level to the next, separably: rows horizontally first, then columns
+// Horizontally filtered rows are kept in a ring so each source row is filtered once
+std::vector<unsigned char> downsample_mip(const std::vector<unsigned char>& src, int width, int height, const mip_options& options)
+{
+	int dst_width = std::max(1, width / 2), dst_height = std::max(1, height / 2);
+	mip_taps column_taps = make_mip_taps(width, dst_width, options);
+	mip_taps row_taps = make_mip_taps(height, dst_height, options);
+
+	int ring_size = row_taps.count + 2;
+	std::vector<float> ring((size_t)ring_size * dst_width * 4);
+	std::vector<int> ring_row(ring_size, -1);
+	std::vector<float> linear((size_t)width * 4);
+	std::vector<float> sum((size_t)dst_width * 4);
+	std::vector<unsigned char> dst((size_t)dst_width * dst_height * 4);
+
+	for (int y = 0; y < dst_height; y++) {
+		std::fill(sum.begin(), sum.end(), 0.0f);
+		for (int k = 0; k < row_taps.count; k++) {
+			float w = row_taps.weight[y * row_taps.count + k];
+			if (w == 0.0f)
+				continue;
+			int src_row = row_taps.index[y * row_taps.count + k];
+			int slot = src_row % ring_size;
+			float* filtered = &ring[(size_t)slot * dst_width * 4];
+			if (ring_row[slot] != src_row) {
+				filter_mip_row(&src[(size_t)src_row * width * 4], width, column_taps, dst_width, options, linear.data(), filtered);
+				ring_row[slot] = src_row;
+			}
+			mip_accumulate(sum.data(), filtered, w, dst_width);
+		}
+		store_mip_row(sum.data(), dst_width, options, &dst[(size_t)y * dst_width * 4]);
+	}
+	return dst;
+}
+
+// Hand every level of an RGBA image's full mip chain to emit, largest first
+// Only the current level is held, so big images never need the whole chain in memory
+void generate_mips(const unsigned char* pixels, int width, int height, int channels, const mip_options& options,
+	const std::function<void(int level, const std::vector<unsigned char>& rgba, int width, int height)>& emit)
+{
+	std::vector<unsigned char> level = expand_to_rgba(pixels, width, height, channels);
+	int num_levels = full_mip_count(width, height);
+	for (int i = 0; i < num_levels; i++) {
+		if (i > 0)
+			level = downsample_mip(level, mip_extent(width, i - 1), mip_extent(height, i - 1), options);
+		emit(i, level, mip_extent(width, i), mip_extent(height, i));
+	}
+}
@@ -0,0 +1,460 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+#include "file.h"
+#include "object_parser.h"
+#include "thread_pool.h"
+
+// OBJ files at least this big are parsed with obj_parse_parallel
+#define PARALLEL_OBJ_MIN_BYTES (4 * 1024 * 1024)
+// Smallest slice of the file handed to one worker
+#define PARALLEL_OBJ_MIN_CHUNK (1024 * 1024)
+
+// Everything parsed from one line aligned slice of the OBJ file
+struct obj_chunk
+{
+	const char* begin = nullptr;
+	const char* end = nullptr;
+
+	std::vector<float> positions;
+	std::vector<float> texcoords;
+	std::vector<float> normals;
+
+	// Corner count of each face and its (v, vt, vn) indices, -1 when missing
+	std::vector<int> face_sizes;
+	std::vector<int> corners;
+	// Positions in corners holding a negative OBJ index, stored relative to the start of the chunk
+	std::vector<size_t> relative_corners;
+
+	// Index into material_names for each face, -1 keeps the material from the previous chunk
+	std::vector<int> face_materials;
+	std::vector<std::string> material_names;
+	std::vector<std::string> material_libraries;
+
+	size_t num_triangles = 0;
+};
+
+bool obj_is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char* obj_skip_space(const char* p, const char* end)
+{
+	while (p < end && obj_is_space(*p))
+		p++;
+	return p;
+}
+
+// Rest of the line with surrounding whitespace trimmed
+std::string obj_read_name(const char* p, const char* end)
+{
+	p = obj_skip_space(p, end);
+	const char* name_end = p;
+	while (name_end < end && *name_end != '\n')
+		name_end++;
+	while (name_end > p && obj_is_space(name_end[-1]))
+		name_end--;
+	return std::string(p, name_end);
+}
+
+// Parse a decimal float with optional exponent, much faster than strtod as it ignores the locale
+float obj_parse_float(const char*& p, const char* end)
+{
+	p = obj_skip_space(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+
+	double value = 0.0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10.0 + (*p - '0');
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		double scale = 0.1;
+		while (p < end && *p >= '0' && *p <= '9') {
+			value += (*p - '0') * scale;
+			scale *= 0.1;
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negative_exponent = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative_exponent = *p == '-';
+			p++;
+		}
+		int exponent = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			exponent = exponent * 10 + (*p - '0');
+			p++;
+		}
+		double base = negative_exponent ? 0.1 : 10.0;
+		while (exponent > 0) {
+			if (exponent & 1)
+				value *= base;
+			base *= base;
+			exponent >>= 1;
+		}
+	}
+	return (float)(negative ? -value : value);
+}
+
+int obj_parse_int(const char*& p, const char* end)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	int value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	return negative ? -value : value;
+}
+
+// Convert one OBJ index to zero based, remembering negative ones so they can be offset after the merge
+void obj_push_index(obj_chunk* chunk, int index, size_t count_in_chunk)
+{
+	if (index > 0) {
+		chunk->corners.push_back(index - 1);
+	}
+	else if (index < 0) {
+		chunk->relative_corners.push_back(chunk->corners.size());
+		chunk->corners.push_back((int)count_in_chunk + index);
+	}
+	else {
+		chunk->corners.push_back(-1);
+	}
+}
+
+void obj_parse_chunk(obj_chunk* chunk)
+{
+	const char* p = chunk->begin;
+	const char* end = chunk->end;
+	int current_material = -1;
+
+	while (p < end) {
+		p = obj_skip_space(p, end);
+		const char* line = p;
+		while (p < end && *p != '\n')
+			p++;
+		const char* line_end = p;
+		p++;
+
+		if (line_end - line < 2)
+			continue;
+
+		if (line[0] == 'v' && obj_is_space(line[1])) {
+			const char* c = line + 2;
+			chunk->positions.push_back(obj_parse_float(c, line_end));
+			chunk->positions.push_back(obj_parse_float(c, line_end));
+			chunk->positions.push_back(obj_parse_float(c, line_end));
+		}
+		else if (line[0] == 'v' && line[1] == 't') {
+			const char* c = line + 2;
+			chunk->texcoords.push_back(obj_parse_float(c, line_end));
+			chunk->texcoords.push_back(obj_parse_float(c, line_end));
+		}
+		else if (line[0] == 'v' && line[1] == 'n') {
+			const char* c = line + 2;
+			chunk->normals.push_back(obj_parse_float(c, line_end));
+			chunk->normals.push_back(obj_parse_float(c, line_end));
+			chunk->normals.push_back(obj_parse_float(c, line_end));
+		}
+		else if (line[0] == 'f' && obj_is_space(line[1])) {
+			size_t num_positions = chunk->positions.size() / 3;
+			size_t num_texcoords = chunk->texcoords.size() / 2;
+			size_t num_normals = chunk->normals.size() / 3;
+
+			int face_size = 0;
+			const char* c = obj_skip_space(line + 1, line_end);
+			while (c < line_end) {
+				// Corner is v, v/vt, v//vn or v/vt/vn
+				int v = obj_parse_int(c, line_end);
+				int vt = 0, vn = 0;
+				if (c < line_end && *c == '/') {
+					c++;
+					if (c < line_end && *c != '/')
+						vt = obj_parse_int(c, line_end);
+					if (c < line_end && *c == '/') {
+						c++;
+						vn = obj_parse_int(c, line_end);
+					}
+				}
+				obj_push_index(chunk, v, num_positions);
+				obj_push_index(chunk, vt, num_texcoords);
+				obj_push_index(chunk, vn, num_normals);
+				face_size++;
+
+				// Skip anything unexpected so a bad token cannot stall the loop
+				while (c < line_end && !obj_is_space(*c))
+					c++;
+				c = obj_skip_space(c, line_end);
+			}
+
+			if (face_size < 3) {
+				// Degenerate face, drop its corners
+				chunk->corners.resize(chunk->corners.size() - face_size * 3);
+				while (!chunk->relative_corners.empty() && chunk->relative_corners.back() >= chunk->corners.size())
+					chunk->relative_corners.pop_back();
+				continue;
+			}
+			chunk->face_sizes.push_back(face_size);
+			chunk->face_materials.push_back(current_material);
+			chunk->num_triangles += face_size - 2;
+		}
+		else if (line_end - line > 7 && strncmp(line, "usemtl", 6) == 0 && obj_is_space(line[6])) {
+			chunk->material_names.push_back(obj_read_name(line + 6, line_end));
+			current_material = (int)chunk->material_names.size() - 1;
+		}
+		else if (line_end - line > 7 && strncmp(line, "mtllib", 6) == 0 && obj_is_space(line[6])) {
+			chunk->material_libraries.push_back(obj_read_name(line + 6, line_end));
+		}
+	}
+}
+
+// Multithreaded replacement for obj_parse on large files
+// Slices the file on line boundaries, parses every slice on the worker pool and merges the results into io_tris
+int obj_parse_parallel(const char* filename, std::vector<triangle>* io_tris, const char* base_folder, std::vector<tinyobj::material_t>* io_materials = nullptr)
+{
+	mapped_file map;
+	if (!map_file(filename, &map)) {
+		throw std::runtime_error(std::string("Failed to open ") + filename);
+	}
+
+	thread_pool& pool = worker_pool();
+	const char* data = (const char*)map.data;
+	const char* data_end = data + map.size;
+
+	// Slice the file into roughly equal chunks, each ending just after a newline
+	size_t num_chunks = std::max<size_t>(1, std::min<size_t>(map.size / PARALLEL_OBJ_MIN_CHUNK, pool.size() * 4));
+	std::vector<obj_chunk> chunks(num_chunks);
+	const char* chunk_begin = data;
+	for (size_t i = 0; i < num_chunks; i++) {
+		const char* chunk_end = (i + 1 == num_chunks) ? data_end : data + map.size * (i + 1) / num_chunks;
+		if (chunk_end < chunk_begin)
+			chunk_end = chunk_begin;
+		while (chunk_end < data_end && chunk_end[-1] != '\n')
+			chunk_end++;
+		chunks[i].begin = chunk_begin;
+		chunks[i].end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+
+	pool.parallel_for(num_chunks, 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			obj_parse_chunk(&chunks[i]);
+		}
+	});
+	unmap_file(&map);
+
+	// Materials come from every mtllib in file order, like tinyobj
+	std::vector<tinyobj::material_t> materials;
+	std::map<std::string, int> material_map;
+	tinyobj::MaterialFileReader material_reader(base_folder ? base_folder : "");
+	for (const obj_chunk& chunk : chunks) {
+		for (const std::string& library : chunk.material_libraries) {
+			std::string warn, err;
+			if (!material_reader(library, &materials, &material_map, &warn, &err)) {
+				std::cerr << "Failed to load material library " << library << ": " << warn << err << std::endl;
+			}
+		}
+	}
+
+	// Running totals give each chunk its offset into the merged arrays
+	std::vector<size_t> position_base(num_chunks), texcoord_base(num_chunks), normal_base(num_chunks), triangle_base(num_chunks);
+	std::vector<int> inherited_material(num_chunks);
+	size_t num_positions = 0, num_texcoords = 0, num_normals = 0;
+	size_t num_triangles = io_tris->size();
+	int material = -1;
+	for (size_t i = 0; i < num_chunks; i++) {
+		position_base[i] = num_positions;
+		texcoord_base[i] = num_texcoords;
+		normal_base[i] = num_normals;
+		triangle_base[i] = num_triangles;
+		inherited_material[i] = material;
+
+		num_positions += chunks[i].positions.size() / 3;
+		num_texcoords += chunks[i].texcoords.size() / 2;
+		num_normals += chunks[i].normals.size() / 3;
+		num_triangles += chunks[i].num_triangles;
+		// The last usemtl of a chunk carries on into the next one
+		if (!chunks[i].material_names.empty()) {
+			auto found = material_map.find(chunks[i].material_names.back());
+			material = found != material_map.end() ? found->second : -1;
+		}
+	}
+
+	// Gather the attribute arrays so faces can index across chunk boundaries
+	std::vector<float> positions(num_positions * 3), texcoords(num_texcoords * 2), normals(num_normals * 3);
+	pool.parallel_for(num_chunks, 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const obj_chunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + position_base[i] * 3);
+			std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + texcoord_base[i] * 2);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + normal_base[i] * 3);
+		}
+	});
+
+	size_t first_triangle = io_tris->size();
+	io_tris->resize(num_triangles);
+	std::atomic<bool> bad_index(false);
+
+	pool.parallel_for(num_chunks, 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			obj_chunk& chunk = chunks[i];
+			size_t bases[3] = { position_base[i], texcoord_base[i], normal_base[i] };
+			size_t counts[3] = { num_positions, num_texcoords, num_normals };
+
+			// Negative indices were stored relative to the chunk, make them absolute
+			for (size_t corner : chunk.relative_corners) {
+				chunk.corners[corner] += (int)bases[corner % 3];
+			}
+
+			// Resolve this chunk's usemtl names to material ids
+			std::vector<int> material_ids(chunk.material_names.size());
+			for (size_t m = 0; m < chunk.material_names.size(); m++) {
+				auto found = material_map.find(chunk.material_names[m]);
+				material_ids[m] = found != material_map.end() ? found->second : -1;
+			}
+
+			size_t out = triangle_base[i];
+			const int* corner = chunk.corners.data();
+			vertex face_verts[4];
+
+			for (size_t f = 0; f < chunk.face_sizes.size(); f++) {
+				int face_size = chunk.face_sizes[f];
+				int mat_id = chunk.face_materials[f] >= 0 ? material_ids[chunk.face_materials[f]] : inherited_material[i];
+				glm::vec3 colour = glm::vec3(1.0f);
+				if (mat_id >= 0 && mat_id < (int)materials.size()) {
+					colour = glm::vec3(materials[mat_id].diffuse[0], materials[mat_id].diffuse[1], materials[mat_id].diffuse[2]);
+				}
+
+				// Build one corner of the face, false if an index is out of range
+				auto read_corner = [&](int c, vertex* vert) {
+					const int* idx = corner + c * 3;
+					for (int a = 0; a < 3; a++) {
+						// Only the position is required
+						if ((idx[a] < 0 && a == 0) || (idx[a] >= 0 && (size_t)idx[a] >= counts[a]))
+							return false;
+					}
+					*vert = vertex{};
+					vert->pos = glm::vec4(positions[idx[0] * 3 + 0], positions[idx[0] * 3 + 1], positions[idx[0] * 3 + 2], 1.f);
+					if (idx[1] >= 0)
+						vert->tex = glm::vec2(texcoords[idx[1] * 2 + 0], texcoords[idx[1] * 2 + 1]);
+					if (idx[2] >= 0)
+						vert->nor = glm::vec3(normals[idx[2] * 3 + 0], normals[idx[2] * 3 + 1], normals[idx[2] * 3 + 2]);
+					vert->col = colour;
+					vert->mat = mat_id;
+					return true;
+				};
+
+				auto emit = [&](const vertex& a, const vertex& b, const vertex& c) {
+					triangle& tri = (*io_tris)[out];
+					tri.v1 = a;
+					tri.v2 = b;
+					tri.v3 = c;
+					tri.reflect = false;
+					tri.primID = (int)out;
+					out++;
+				};
+
+				bool ok = true;
+				for (int c = 0; c < std::min(face_size, 3); c++)
+					ok = ok && read_corner(c, &face_verts[c]);
+
+				if (face_size == 4 && ok && read_corner(3, &face_verts[3])) {
+					// Split quads along the shorter diagonal, matching tinyobj
+					glm::vec3 d02 = glm::vec3(face_verts[2].pos - face_verts[0].pos);
+					glm::vec3 d13 = glm::vec3(face_verts[3].pos - face_verts[1].pos);
+					if (glm::dot(d02, d02) < glm::dot(d13, d13)) {
+						emit(face_verts[0], face_verts[1], face_verts[2]);
+						emit(face_verts[0], face_verts[2], face_verts[3]);
+					}
+					else {
+						emit(face_verts[0], face_verts[1], face_verts[3]);
+						emit(face_verts[1], face_verts[2], face_verts[3]);
+					}
+				}
+				else if (ok && face_size != 4) {
+					// Fan out larger polygons from the first corner
+					emit(face_verts[0], face_verts[1], face_verts[2]);
+					for (int c = 3; c < face_size && ok; c++) {
+						face_verts[1] = face_verts[2];
+						ok = read_corner(c, &face_verts[2]);
+						if (ok)
+							emit(face_verts[0], face_verts[1], face_verts[2]);
+					}
+				}
+				else {
+					ok = false;
+				}
+
+				if (!ok) {
+					bad_index = true;
+					break;
+				}
+				corner += face_size * 3;
+			}
+		}
+	});
+
+	if (bad_index) {
+		io_tris->resize(first_triangle);
+		throw std::runtime_error(std::string("Face with invalid vertex index found in ") + filename);
+	}
+
+	// Hand back the material table if the caller wants it
+	if (io_materials) {
+		*io_materials = materials;
+	}
+
+	printf("Successfully parsed %s on %u threads and read %zu triangles.\n", filename, pool.size(), io_tris->size() - first_triangle);
+	return 0;
+}
+
+// Parse the same OBJ with obj_parse and obj_parse_parallel and print the throughput of each
+void benchmark_obj_parse(const char* filename, const char* base_folder)
+{
+	int64_t mtime;
+	uint64_t size;
+	if (!get_file_stamp(filename, &mtime, &size)) {
+		std::cerr << "Benchmark could not find " << filename << std::endl;
+		return;
+	}
+	double megabytes = size / (1024.0 * 1024.0);
+
+	std::vector<triangle> serial_tris, parallel_tris;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	obj_parse(filename, &serial_tris, base_folder);
+	double serial_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	obj_parse_parallel(filename, &parallel_tris, base_folder);
+	double parallel_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	printf("OBJ parse benchmark: %s (%.1f MB)\n", filename, megabytes);
+	printf("  tinyobj:  %8.3f s  %8.1f MB/s  %12.0f triangles/s\n", serial_seconds, megabytes / serial_seconds, serial_tris.size() / serial_seconds);
+	printf("  parallel: %8.3f s  %8.1f MB/s  %12.0f triangles/s  (%.1fx)\n", parallel_seconds, megabytes / parallel_seconds, parallel_tris.size() / parallel_seconds, serial_seconds / parallel_seconds);
+	if (serial_tris.size() != parallel_tris.size()) {
+		printf("  Triangle counts differ: %zu vs %zu\n", serial_tris.size(), parallel_tris.size());
+	}
+}
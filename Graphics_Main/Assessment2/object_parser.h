@@ -35,6 +35,8 @@ struct vertex
 	glm::vec2 tex;
 	glm::vec3 tangent;   
 	glm::vec3 bitangent;  
+	// Material id from the .mtl file, -1 if none
+	int mat;
 };
 
 struct triangle
@@ -45,66 +47,7 @@ public:
 	int primID;
 };
 
-// Function to calculate tangent and bitangent vectors
-void calculateTangentSpace(vertex& v1, vertex& v2, vertex& v3)
-{
-	// Positions
-	glm::vec3 pos1(v1.pos.x, v1.pos.y, v1.pos.z);
-	glm::vec3 pos2(v2.pos.x, v2.pos.y, v2.pos.z);
-	glm::vec3 pos3(v3.pos.x, v3.pos.y, v3.pos.z);
-
-	// Texture coordinates
-	glm::vec2 uv1 = v1.tex;
-	glm::vec2 uv2 = v2.tex;
-	glm::vec2 uv3 = v3.tex;
-
-	// Edges of the triangle in 3D space
-	glm::vec3 edge1 = pos2 - pos1;
-	glm::vec3 edge2 = pos3 - pos1;
-
-	// Texture space differences
-	glm::vec2 deltaUV1 = uv2 - uv1;
-	glm::vec2 deltaUV2 = uv3 - uv1;
-
-	// Avoid division by zero
-	float denominator = (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
-	if (abs(denominator) < 0.0001f) {
-		v1.tangent = v2.tangent = v3.tangent = glm::normalize(glm::vec3(1.0f, 0.0f, 0.0f));
-		v1.bitangent = v2.bitangent = v3.bitangent = glm::normalize(glm::vec3(0.0f, 1.0f, 0.0f));
-		return;
-	}
-
-	float f = 1.0f / denominator;
-
-	// Calculate tangent and bitangent vectors
-	// tangent = (edge1 * deltaUV2.y - edge2 * deltaUV1.y) / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y)
-	// bitangent = (edge2 * deltaUV1.x - edge1 * deltaUV2.x) / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y)
-	glm::vec3 tangent, bitangent;
-	tangent.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
-	tangent.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
-	tangent.z = f * (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z);
-
-	bitangent.x = f * (deltaUV1.x * edge2.x - deltaUV2.x * edge1.x);
-	bitangent.y = f * (deltaUV1.x * edge2.y - deltaUV2.x * edge1.y);
-	bitangent.z = f * (deltaUV1.x * edge2.z - deltaUV2.x * edge1.z);
-
-	// Normalize
-	tangent = glm::normalize(tangent);
-	bitangent = glm::normalize(bitangent);
-
-	glm::vec3 normal1 = glm::vec3(v1.nor);
-	glm::vec3 normal2 = glm::vec3(v2.nor);
-	glm::vec3 normal3 = glm::vec3(v3.nor);
-
-	tangent = glm::normalize(tangent - normal1 * glm::dot(normal1, tangent));
-
-	bitangent = glm::normalize(bitangent - normal1 * glm::dot(normal1, bitangent) - tangent * glm::dot(tangent, bitangent));
-
-	v1.tangent = v2.tangent = v3.tangent = tangent;
-	v1.bitangent = v2.bitangent = v3.bitangent = bitangent;
-}
-
-int obj_parse(const char* filename, std::vector<triangle>* io_tris, const char* base_folder)
+int obj_parse(const char* filename, std::vector<triangle>* io_tris, const char* base_folder, std::vector<tinyobj::material_t>* io_materials = nullptr)
 {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -118,8 +61,9 @@ int obj_parse(const char* filename, std::vector<triangle>* io_tris, const char*
 
 
 
-	std::vector<vertex> vertices;
-	std::vector<uint32_t> indices;
+	// Reused for every face to avoid an allocation per face
+	std::vector<vertex> face_verts;
+	face_verts.reserve(3);
 
 	for (const auto& shape : shapes)
 	{
@@ -130,7 +74,7 @@ int obj_parse(const char* filename, std::vector<triangle>* io_tris, const char*
 			int fv = shape.mesh.num_face_vertices[f];
 			int mat_id = shape.mesh.material_ids[f];
 
-			std::vector<vertex> face_verts;
+			face_verts.clear();
 
 			for (size_t v = 0; v < fv; v++)
 			{
@@ -168,11 +112,13 @@ int obj_parse(const char* filename, std::vector<triangle>* io_tris, const char*
 					vert.tex = glm::vec2(0.0f); 
 				}
 
-				// Initialize tangent and bitangent to zero 
+				// Initialize tangent and bitangent to zero
+				// The tangent frame is generated per welded vertex, see generate_tangent_space
 				vert.tangent = glm::vec3(0.0f);
 				vert.bitangent = glm::vec3(0.0f);
 
 				// Materials
+				vert.mat = mat_id;
 				if (mat_id >= 0 && mat_id < static_cast<int>(materials.size())) {
 					const auto& mat = materials[mat_id];
 					vert.col = {
@@ -199,9 +145,6 @@ int obj_parse(const char* filename, std::vector<triangle>* io_tris, const char*
 				tri.v2 = face_verts[1];
 				tri.v3 = face_verts[2];
 
-				// Calculate tangent and bitangent for triangle
-				calculateTangentSpace(tri.v1, tri.v2, tri.v3);
-
 				tri.reflect = false;
 				tri.primID = io_tris->size();				
 
@@ -210,56 +153,11 @@ int obj_parse(const char* filename, std::vector<triangle>* io_tris, const char*
 		}
 	}
 
+	// Hand back the material table if the caller wants it
+	if (io_materials) {
+		*io_materials = materials;
+	}
+
 	printf("Successfully parsed %s and read %d triangles.\n", filename, io_tris->size());
 	return 0;
 }
-
-vector<GLfloat> tri_to_fl_array(const std::vector<triangle>& triangles, bool uses_normal) {
-	// Each triangle has 3 vertices
-	// Each vertex has 17 floats: (x,y,z,r,g,b,s,t,nx,ny,nz,tx,ty,tz,bx,by,bz)
-	std::vector<GLfloat> tri_array;
-	tri_array.reserve(triangles.size() * 3 * 17); 
-
-	for (const triangle& tri : triangles) {
-		const vertex* verts[3] = { &tri.v1, &tri.v2, &tri.v3 };
-
-		for (int i = 0; i < 3; ++i) {
-			const vertex& v = *verts[i];
-			// Position
-			tri_array.push_back(v.pos.x);
-			tri_array.push_back(v.pos.y);
-			tri_array.push_back(v.pos.z);
-
-			// Colour
-			tri_array.push_back(v.col.r);
-			tri_array.push_back(v.col.g);
-			tri_array.push_back(v.col.b);
-
-			// Texture coordinates
-			tri_array.push_back(v.tex.x);
-			tri_array.push_back(v.tex.y);
-
-			// Normal
-			tri_array.push_back(v.nor.x);
-			tri_array.push_back(v.nor.y);
-			tri_array.push_back(v.nor.z);
-			// For objects that use normal mapping.
-			if (uses_normal) {
-				// Tangent
-				tri_array.push_back(v.tangent.x);
-				tri_array.push_back(v.tangent.y);
-				tri_array.push_back(v.tangent.z);
-
-				// Bitangent
-				tri_array.push_back(v.bitangent.x);
-				tri_array.push_back(v.bitangent.y);
-				tri_array.push_back(v.bitangent.z);
-				
-			}
-		}
-	}
-	
-	
-
-	return tri_array;
-}
\ No newline at end of file
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+#include "shader.h"
+#include "uniforms.h"
+#include "render_queue.h"
+
+// Two phase Hi-Z occlusion culling of the render queue's opaque items, run on the GPU between sorting and drawing
+// Early phase: the items visible last frame are drawn into a small camera depth buffer
+// The depth buffer is reduced into a pyramid of furthest depths, and every item's world box is tested against it
+// Late phase: items the pyramid shows are visible get drawn by the main pass too, and become next frame's early set
+// Hidden items are dropped by writing 0 to the instance count of their indirect command, so the CPU never waits on the result
+
+// Set to 0 to draw every opaque item the frustum keeps
+#define USE_OCCLUSION_CULLING 1
+// Shader storage bindings, must match occlusion_cull.comp
+#define OCCLUSION_COMMAND_BINDING 8
+#define OCCLUSION_VISIBILITY_BINDING 9
+#define OCCLUSION_COUNTER_BINDING 10
+// Texture unit the compute shaders sample from, above the material arrays
+#define OCCLUSION_TEXTURE_UNIT 15
+// Must match local_size_x of occlusion_cull.comp and the local size of hiz_reduce.comp
+#define OCCLUSION_GROUP_SIZE 64
+#define HIZ_GROUP_SIZE 8
+
+// Items the compute shader let through in each phase, must match OcclusionCounters in occlusion_cull.comp
+struct occlusion_counters
+{
+	uint32_t early_draws = 0;
+	uint32_t late_draws = 0;
+	uint32_t occluded = 0;
+};
+
+struct occlusion_culler
+{
+	bool enabled = false;
+	// Whether the programs have been checked, culling starts once the driver has built them
+	bool checked = false;
+	GLuint cull_program = 0;
+	GLuint reduce_program = 0;
+	// Camera depth of the early draws, drawn with the shadow shader's CAMERA_DEPTH variant
+	GLuint depth_program = 0;
+	GLuint depth_fbo = 0;
+	GLuint depth_texture = 0;
+	int depth_width = 0;
+	int depth_height = 0;
+	// R32F pyramid, the first level is the depth buffer rounded down to a power of two
+	GLuint hiz_texture = 0;
+	int hiz_width = 0;
+	int hiz_height = 0;
+	int hiz_levels = 0;
+	// One flag per opaque object of the render queue, whether the late phase saw it last frame
+	GLuint visibility_buffer = 0;
+	size_t visibility_capacity = 0;
+	GLuint counter_buffer = 0;
+};
+
+// Largest power of two not above value
+int floor_power_of_two(int value)
+{
+	int power = 1;
+	while (power * 2 <= value)
+		power *= 2;
+	return power;
+}
+
+// Submit the compute shaders, call once after gl3wInit and init_render_queue
+// Drivers without GL 4.3 compute shaders, or shaders that fail to build, leave culling off and every item drawn
+void init_occlusion_culler(occlusion_culler& culler, const render_queue& queue)
+{
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (!USE_OCCLUSION_CULLING || major * 10 + minor < 43) {
+		printf("Occlusion culling: off.\n");
+		culler.checked = true;
+		return;
+	}
+
+	std::string depth_defines = std::string(render_queue_shader_defines(queue)) + "#define CAMERA_DEPTH 1\n";
+	culler.cull_program = BeginCompileComputeShader("occlusion_cull.comp");
+	culler.reduce_program = BeginCompileComputeShader("hiz_reduce.comp");
+	culler.depth_program = BeginCompileShader("shadow.vert", "shadow.frag", depth_defines.c_str());
+
+	glCreateFramebuffers(1, &culler.depth_fbo);
+	glCreateBuffers(1, &culler.visibility_buffer);
+	glCreateBuffers(1, &culler.counter_buffer);
+	glNamedBufferData(culler.counter_buffer, sizeof(occlusion_counters), NULL, GL_DYNAMIC_READ);
+}
+
+// Make the depth buffer and pyramid fit the window, recreating them when its size changed
+// The depth is drawn at full size, a smaller raster would mark texels covered that the occluders only partly cover
+// and cull geometry just past their silhouettes, the pyramid's max reduction does the downsampling conservatively
+void resize_occlusion_targets(occlusion_culler& culler, int window_width, int window_height)
+{
+	int width = std::max(window_width, 1);
+	int height = std::max(window_height, 1);
+	if (width == culler.depth_width && height == culler.depth_height)
+		return;
+	glDeleteTextures(1, &culler.depth_texture);
+	glDeleteTextures(1, &culler.hiz_texture);
+	culler.depth_width = width;
+	culler.depth_height = height;
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &culler.depth_texture);
+	glTextureStorage2D(culler.depth_texture, 1, GL_DEPTH_COMPONENT32F, width, height);
+	glTextureParameteri(culler.depth_texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(culler.depth_texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glNamedFramebufferTexture(culler.depth_fbo, GL_DEPTH_ATTACHMENT, culler.depth_texture, 0);
+	glNamedFramebufferDrawBuffer(culler.depth_fbo, GL_NONE);
+	glNamedFramebufferReadBuffer(culler.depth_fbo, GL_NONE);
+
+	culler.hiz_width = floor_power_of_two(width);
+	culler.hiz_height = floor_power_of_two(height);
+	culler.hiz_levels = 1;
+	while ((culler.hiz_width >> culler.hiz_levels) > 0 || (culler.hiz_height >> culler.hiz_levels) > 0)
+		culler.hiz_levels++;
+	glCreateTextures(GL_TEXTURE_2D, 1, &culler.hiz_texture);
+	glTextureStorage2D(culler.hiz_texture, culler.hiz_levels, GL_R32F, culler.hiz_width, culler.hiz_height);
+	glTextureParameteri(culler.hiz_texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTextureParameteri(culler.hiz_texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+// Make room for every opaque object of the frame, objects new to the buffer start out visible
+void reserve_occlusion_visibility(occlusion_culler& culler, size_t objects)
+{
+	if (objects <= culler.visibility_capacity)
+		return;
+	size_t capacity = std::max(objects, culler.visibility_capacity * 2);
+	GLuint buffer;
+	glCreateBuffers(1, &buffer);
+	glNamedBufferData(buffer, (GLsizeiptr)(capacity * sizeof(uint32_t)), NULL, GL_DYNAMIC_COPY);
+	uint32_t visible = 1;
+	glClearNamedBufferData(buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &visible);
+	if (culler.visibility_capacity > 0)
+		glCopyNamedBufferSubData(culler.visibility_buffer, buffer, 0, 0, (GLsizeiptr)(culler.visibility_capacity * sizeof(uint32_t)));
+	glDeleteBuffers(1, &culler.visibility_buffer);
+	culler.visibility_buffer = buffer;
+	culler.visibility_capacity = capacity;
+}
+
+void dispatch_occlusion_phase(occlusion_culler& culler, int items, bool late_phase)
+{
+	glUseProgram(culler.cull_program);
+	set_uniform(culler.cull_program, "numItems", items);
+	set_uniform(culler.cull_program, "latePhase", late_phase);
+	set_uniform(culler.cull_program, "hiz", OCCLUSION_TEXTURE_UNIT);
+	set_uniform(culler.cull_program, "hizLevels", culler.hiz_levels);
+	glDispatchCompute((GLuint)((items + OCCLUSION_GROUP_SIZE - 1) / OCCLUSION_GROUP_SIZE), 1, 1);
+	// The next draws read the instance counts as indirect commands
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Reduce the depth buffer into every level of the pyramid, one dispatch per level
+void build_hiz_pyramid(occlusion_culler& culler)
+{
+	glUseProgram(culler.reduce_program);
+	set_uniform(culler.reduce_program, "source", OCCLUSION_TEXTURE_UNIT);
+	for (int level = 0; level < culler.hiz_levels; level++) {
+		// The first level reads the depth buffer, the others the level above them
+		glBindTextureUnit(OCCLUSION_TEXTURE_UNIT, level == 0 ? culler.depth_texture : culler.hiz_texture);
+		set_uniform(culler.reduce_program, "sourceLevel", level == 0 ? 0 : level - 1);
+		glBindImageTexture(0, culler.hiz_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		int width = std::max(culler.hiz_width >> level, 1);
+		int height = std::max(culler.hiz_height >> level, 1);
+		glDispatchCompute((GLuint)((width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE), (GLuint)((height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE), 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+}
+
+// Set the instance count of every opaque item's command to whether it can be seen
+// Call after sort_render_queue and before the opaque pass, with the frame uniforms uploaded
+// Leaves the default framebuffer bound with the window's viewport
+void cull_occluded_items(occlusion_culler& culler, render_queue& queue, int window_width, int window_height)
+{
+	if (!culler.checked) {
+		// Draw everything until the compute shaders have built rather than waiting for them
+		if (!ProgramBuildComplete(culler.cull_program) || !ProgramBuildComplete(culler.reduce_program) || !ProgramBuildComplete(culler.depth_program))
+			return;
+		culler.checked = true;
+		bool cull_linked = FinishProgram(culler.cull_program);
+		bool reduce_linked = FinishProgram(culler.reduce_program);
+		bool depth_linked = FinishProgram(culler.depth_program);
+		culler.enabled = cull_linked && reduce_linked && depth_linked;
+		printf("Occlusion culling: %s.\n", culler.enabled ? "two phase Hi-Z on the GPU" : "off, the compute shaders did not build");
+	}
+	int items = (int)queue.occlusion.size();
+	if (!culler.enabled || items == 0)
+		return;
+	resize_occlusion_targets(culler, window_width, window_height);
+	reserve_occlusion_visibility(culler, (size_t)queue.culling[RENDER_PASS_OPAQUE].objects);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_COMMAND_BINDING, queue.command_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_VISIBILITY_BINDING, culler.visibility_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_COUNTER_BINDING, culler.counter_buffer);
+	uint32_t zero = 0;
+	glClearNamedBufferData(culler.counter_buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	// Early phase, last frame's visible set drawn as depth only
+	dispatch_occlusion_phase(culler, items, false);
+	glBindFramebuffer(GL_FRAMEBUFFER, culler.depth_fbo);
+	glViewport(0, 0, culler.depth_width, culler.depth_height);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	// The prepass is not part of the queue's draw counts
+	render_counters counted = queue.frame;
+	draw_render_pass(queue, RENDER_PASS_OPAQUE, false, culler.depth_program);
+	queue.frame = counted;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, window_width, window_height);
+
+	// Late phase against the pyramid of the early draws
+	build_hiz_pyramid(culler);
+	glBindTextureUnit(OCCLUSION_TEXTURE_UNIT, culler.hiz_texture);
+	dispatch_occlusion_phase(culler, items, true);
+}
+
+// Counts of the last culled frame, read back from the GPU so only call it now and then
+void print_occlusion_counters(const occlusion_culler& culler)
+{
+	if (!culler.enabled)
+		return;
+	occlusion_counters counters;
+	glGetNamedBufferSubData(culler.counter_buffer, 0, sizeof(counters), &counters);
+	printf("Occlusion culling last frame: %u early draws, %u disoccluded late draws, %u items occluded.\n",
+		counters.early_draws, counters.late_draws, counters.occluded);
+}
+
+void delete_occlusion_culler(occlusion_culler& culler)
+{
+	if (culler.cull_program) {
+		DeleteProgram(culler.cull_program);
+		DeleteProgram(culler.reduce_program);
+		DeleteProgram(culler.depth_program);
+	}
+	glDeleteFramebuffers(1, &culler.depth_fbo);
+	glDeleteTextures(1, &culler.depth_texture);
+	glDeleteTextures(1, &culler.hiz_texture);
+	glDeleteBuffers(1, &culler.visibility_buffer);
+	glDeleteBuffers(1, &culler.counter_buffer);
+	culler = occlusion_culler();
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+
+#include "file.h"
+
+// Linked program binaries cached next to the last shader of each program as <name>.<hash>.progbin
+// The hash covers the shader file names and defines, so each program and shader variant keeps one file
+// The key in the header hashes the shader sources, the defines and the driver's vendor, renderer and version strings,
+// a binary with another key is stale and overwritten by the next save instead of piling up next to it
+// A binary the driver rejects is deleted and the program compiled from source again
+#define PROGRAM_CACHE_MAGIC 0x47525050
+// Bump whenever the header changes so old caches are rebuilt
+#define PROGRAM_CACHE_VERSION 1
+// Set to 0 to always compile from source
+#define USE_PROGRAM_CACHE 1
+
+struct program_cache_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	// Driver specific format glGetProgramBinary returned
+	uint32_t binary_format;
+	uint32_t binary_size;
+};
+
+// Programs built this launch and the time spent on each kind
+struct program_cache_counters
+{
+	int loaded = 0;
+	int compiled = 0;
+	// Binaries found with an old key, version or a damaged header, also counted as compiled
+	int stale = 0;
+	// Binaries with a good header refused by the driver, also counted as compiled
+	int rejected = 0;
+	double load_ms = 0.0;
+	double compile_ms = 0.0;
+};
+
+program_cache_counters& program_cache_stats()
+{
+	static program_cache_counters counters;
+	return counters;
+}
+
+// FNV-1a over a string, continuing from hash
+uint64_t program_cache_hash(uint64_t hash, const char* text)
+{
+	for (const char* c = text ? text : ""; *c; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= 1099511628211ULL;
+	}
+	// Separator so "ab" + "c" and "a" + "bc" differ
+	return (hash ^ 0xff) * 1099511628211ULL;
+}
+
+// Whether the driver can hand out program binaries at all, call with a context current
+bool program_cache_supported()
+{
+	static int supported = -1;
+	if (supported < 0) {
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		supported = USE_PROGRAM_CACHE && formats > 0;
+	}
+	return supported != 0;
+}
+
+// Key of a program built from these sources and defines by the current driver
+uint64_t program_cache_key(const char* const* sources, int num_sources, const char* defines)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (int i = 0; i < num_sources; i++) {
+		hash = program_cache_hash(hash, sources[i]);
+	}
+	hash = program_cache_hash(hash, defines);
+	hash = program_cache_hash(hash, (const char*)glGetString(GL_VENDOR));
+	hash = program_cache_hash(hash, (const char*)glGetString(GL_RENDERER));
+	hash = program_cache_hash(hash, (const char*)glGetString(GL_VERSION));
+	return hash;
+}
+
+// Cache file of the program built from these shader files and defines, whatever the sources and driver
+std::string program_cache_path(const char* const* filenames, int num_shaders, const char* defines)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (int i = 0; i < num_shaders; i++) {
+		hash = program_cache_hash(hash, filenames[i]);
+	}
+	hash = program_cache_hash(hash, defines);
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%016llx.progbin", (unsigned long long)hash);
+	return std::string(filenames[num_shaders - 1]) + suffix;
+}
+
+// A linked program from the cache, 0 if there is no usable binary
+GLuint load_program_binary(const std::string& cache_path, uint64_t key)
+{
+	if (!program_cache_supported())
+		return 0;
+	mapped_file map;
+	if (!map_file(cache_path.c_str(), &map))
+		return 0;
+
+	const program_cache_header* header = (const program_cache_header*)map.data;
+	bool valid = map.size >= sizeof(program_cache_header) && header->magic == PROGRAM_CACHE_MAGIC && header->version == PROGRAM_CACHE_VERSION
+		&& header->key == key && sizeof(program_cache_header) + (uint64_t)header->binary_size <= map.size;
+	if (!valid) {
+		// Left in place, saving the rebuilt program replaces it
+		unmap_file(&map);
+		program_cache_stats().stale++;
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header->binary_format, map.data + sizeof(program_cache_header), (GLsizei)header->binary_size);
+	GLint success = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	unmap_file(&map);
+	if (!success) {
+		glDeleteProgram(program);
+		remove(cache_path.c_str());
+		program_cache_stats().rejected++;
+		return 0;
+	}
+	return program;
+}
+
+// Store a linked program, call after linking with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+bool save_program_binary(GLuint program, const std::string& cache_path, uint64_t key)
+{
+	if (!program_cache_supported())
+		return false;
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return false;
+	std::vector<unsigned char> binary((size_t)length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(program, length, &written, &format, binary.data());
+	if (written <= 0)
+		return false;
+
+	program_cache_header header = {};
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	header.binary_format = format;
+	header.binary_size = (uint32_t)written;
+
+	// Write to a temporary file first so a crash never leaves a half written cache
+	std::string temp_path = cache_path + ".tmp";
+	FILE* f;
+	fopen_s(&f, temp_path.c_str(), "wb");
+	if (f == NULL)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(binary.data(), 1, (size_t)written, f) == (size_t)written;
+	fclose(f);
+
+	if (!ok) {
+		remove(temp_path.c_str());
+		return false;
+	}
+	// Rename does not overwrite on Windows
+	remove(cache_path.c_str());
+	return rename(temp_path.c_str(), cache_path.c_str()) == 0;
+}
+
+// Cold launches compile everything, warm ones should load every program
+void print_program_cache()
+{
+	const program_cache_counters& counters = program_cache_stats();
+	if (!program_cache_supported()) {
+		printf("Program cache: off, %d programs compiled in %.1f ms.\n", counters.compiled, counters.compile_ms);
+		return;
+	}
+	printf("Program cache: %d programs loaded in %.1f ms, %d compiled in %.1f ms (%d stale binaries, %d rejected by the driver), %s start.\n",
+		counters.loaded, counters.load_ms, counters.compiled, counters.compile_ms, counters.stale, counters.rejected,
+		counters.compiled == 0 ? "warm" : counters.loaded == 0 ? "cold" : "partly warm");
+}
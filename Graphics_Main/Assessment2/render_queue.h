@@ -0,0 +1,607 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "uniforms.h"
+#include "mesh.h"
+#include "mesh_lod.h"
+#include "geometry_arena.h"
+#include "bindless.h"
+#include "frustum.h"
+
+// Draws of a frame collected as render items, sorted so items sharing a program and geometry arena are drawn together
+// Each item's transform and material go into a draw table, and a run of items in one arena is one glMultiDrawElementsIndirect
+// The shaders find their entry as drawBase + gl_DrawIDARB, drivers without ARB_shader_draw_parameters draw one command at a time
+// Items outside the frustum of their pass are dropped as they are submitted
+
+// Shader storage bindings, must match the vertex and fragment shaders
+#define DRAW_TABLE_BINDING 4
+#define MATERIAL_TABLE_BINDING 5
+#define PALETTE_TABLE_BINDING 6
+#define OCCLUSION_TABLE_BINDING 7
+// Defines the shaders are compiled with when gl_DrawIDARB is available
+#define MULTI_DRAW_SHADER_DEFINES "#define MULTI_DRAW 1\n"
+
+// Must match the MATERIAL_USES_ defines in lighting_fragment.frag
+#define MATERIAL_USES_TEXTURE 1
+#define MATERIAL_USES_GLOW 2
+#define MATERIAL_USES_NORMAL 4
+#define MATERIAL_USES_SPECULAR 8
+#define MATERIAL_USES_PBR 16
+#define MATERIAL_USES_PARRALLAX 32
+
+enum render_pass
+{
+	RENDER_PASS_SHADOW,
+	RENDER_PASS_OPAQUE,
+	// Drawn back to front after the opaque pass
+	RENDER_PASS_TRANSPARENT,
+	NUM_RENDER_PASSES
+};
+
+static const char* render_pass_names[NUM_RENDER_PASSES] = { "shadow", "opaque", "transparent" };
+
+// Per object settings of the lighting shader
+struct render_material
+{
+	// Entry of the texture table, -1 for none
+	int textures = -1;
+	// Layer of the PBR material arrays, -1 for none
+	int pbr_material = -1;
+	bool uses_texture = true;
+	bool uses_glow = false;
+	bool uses_normal = false;
+	bool uses_specular = false;
+	bool uses_pbr = false;
+	bool uses_parrallax = false;
+	float shininess = 64.f;
+	float uv_scale = 1.f;
+	float bump_scale = 0.f;
+	float height_scale = 0.f;
+};
+
+// Range of a geometry arena one piece of geometry is drawn from
+struct render_geometry
+{
+	geometry_arena* arena = nullptr;
+	// Packed mesh drawn at the item's LOD, its range is read when drawn as it may still be streaming in
+	// Null for float vertices, drawn whole from the range below
+	const indexed_mesh* mesh = nullptr;
+	int32_t base_vertex = 0;
+	uint32_t first_index = 0;
+	uint32_t count = 0;
+	// First entry of the mesh's palette in the palette table, -1 until the mesh has one
+	int palette = -1;
+	// Object space bounds of float vertices, meshes carry their own
+	bounding_volume bounds;
+};
+
+// Entry of the draw table, must match DrawData in the shaders
+struct draw_data
+{
+	glm::mat4 model;
+	glm::vec4 pos_offset;
+	glm::vec4 pos_scale;
+	// Render material, 1 for packed vertices, first palette entry
+	glm::ivec4 info;
+};
+
+// Entry of the material table, must match MaterialData in lighting_fragment.frag
+struct material_data
+{
+	// Texture table entry, material array layer or -1, MATERIAL_USES_ bits
+	glm::ivec4 info;
+	// Shininess, texture scale, bump scale, parallax height scale
+	glm::vec4 params;
+};
+
+// Layout glMultiDrawElementsIndirect reads
+struct draw_elements_command
+{
+	uint32_t count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	int32_t base_vertex;
+	uint32_t base_instance;
+};
+
+// World space box of an opaque draw for occlusion culling, must match OcclusionData in occlusion_cull.comp
+struct occlusion_data
+{
+	glm::vec4 box_min;
+	glm::vec4 box_max;
+	// Indirect command, object the draw belongs to across frames
+	glm::ivec4 info;
+};
+
+static_assert(sizeof(draw_data) == 112 && sizeof(material_data) == 32 && sizeof(occlusion_data) == 48, "Table entries do not match the std430 structs");
+static_assert(sizeof(draw_elements_command) == 20, "draw_elements_command does not match the indirect layout");
+
+struct render_item
+{
+	uint64_t key;
+	render_pass pass;
+	GLuint program;
+	// Index into the queue's materials, -1 for programs without material settings such as the shadow shader
+	int material;
+	int geometry;
+	int lod;
+	// Order the item was submitted to its pass in, culled items included
+	// A scene submitting its objects in the same order every frame keeps their numbers across frames
+	int object;
+	glm::mat4 model;
+};
+
+// Items drawn and the state changes made for them
+struct render_counters
+{
+	int items = 0;
+	int draw_calls = 0;
+	int programs = 0;
+	int arenas = 0;
+	// Texture unit changes, only made without bindless textures
+	int textures = 0;
+};
+
+// Items submitted to a pass and those its frustum culled
+struct cull_counters
+{
+	int objects = 0;
+	int triangles = 0;
+	int culled_objects = 0;
+	int culled_triangles = 0;
+};
+
+struct render_queue
+{
+	std::vector<render_material> materials;
+	std::vector<render_geometry> geometries;
+	// Table the material texture entries refer to
+	const texture_table* textures = nullptr;
+	// Whether the shaders were compiled with MULTI_DRAW_SHADER_DEFINES
+	bool multi_draw = false;
+
+	// Items of the current frame, in submission order until sort_render_queue
+	std::vector<render_item> items;
+	// Camera the transparent items are sorted away from
+	glm::vec3 eye = glm::vec3(0.f);
+	// Frustum each pass culls its items against, set every frame after begin_render_frame
+	frustum frustums[NUM_RENDER_PASSES];
+	bool culls[NUM_RENDER_PASSES] = {};
+
+	// Draw table and indirect commands of the sorted items, one entry per item in the same order
+	std::vector<draw_data> draws;
+	std::vector<draw_elements_command> commands;
+	// Colours of every packed mesh, appended as meshes finish streaming
+	std::vector<glm::vec4> palettes;
+	// Boxes of the opaque items, for occlusion.h
+	std::vector<occlusion_data> occlusion;
+	bool materials_dirty = true;
+	bool palettes_dirty = true;
+	GLuint draw_buffer = 0;
+	GLuint command_buffer = 0;
+	GLuint material_buffer = 0;
+	GLuint palette_buffer = 0;
+	GLuint occlusion_buffer = 0;
+	size_t draw_capacity = 0;
+	size_t palette_capacity = 0;
+	size_t occlusion_capacity = 0;
+
+	render_counters frame;
+	render_counters last_frame;
+	// Changes the same items would have needed in the order they were submitted
+	render_counters unsorted;
+	render_counters last_unsorted;
+	cull_counters culling[NUM_RENDER_PASSES];
+	cull_counters last_culling[NUM_RENDER_PASSES];
+};
+
+// Create the table buffers and check for gl_DrawIDARB, call once after gl3wInit and before compiling the shaders
+void init_render_queue(render_queue& queue)
+{
+	queue.multi_draw = has_gl_extension("GL_ARB_shader_draw_parameters");
+	glCreateBuffers(1, &queue.draw_buffer);
+	glCreateBuffers(1, &queue.command_buffer);
+	glCreateBuffers(1, &queue.material_buffer);
+	glCreateBuffers(1, &queue.palette_buffer);
+	glCreateBuffers(1, &queue.occlusion_buffer);
+	printf("Render queue: %s.\n", queue.multi_draw ? "multi draw indirect with gl_DrawIDARB" : "one indirect draw per item");
+}
+
+// Defines the lighting and shadow shaders are compiled with
+const char* render_queue_shader_defines(const render_queue& queue)
+{
+	return queue.multi_draw ? MULTI_DRAW_SHADER_DEFINES : "";
+}
+
+int add_render_material(render_queue& queue, const render_material& material)
+{
+	queue.materials.push_back(material);
+	queue.materials_dirty = true;
+	return (int)queue.materials.size() - 1;
+}
+
+// A packed mesh in an arena, drawn at the LOD of each item
+int add_mesh_geometry(render_queue& queue, geometry_arena& arena, const indexed_mesh& mesh)
+{
+	render_geometry geometry;
+	geometry.arena = &arena;
+	geometry.mesh = &mesh;
+	queue.geometries.push_back(geometry);
+	return (int)queue.geometries.size() - 1;
+}
+
+// Float vertices in an arena, drawn whole
+int add_arena_range_geometry(render_queue& queue, geometry_arena& arena, const arena_range& range, uint32_t count, const bounding_volume& bounds)
+{
+	render_geometry geometry;
+	geometry.arena = &arena;
+	geometry.base_vertex = range.base_vertex;
+	geometry.first_index = range.first_index;
+	geometry.count = count;
+	geometry.bounds = bounds;
+	queue.geometries.push_back(geometry);
+	return (int)queue.geometries.size() - 1;
+}
+
+// Start collecting a frame's items, closing the counters of the frame before
+void begin_render_frame(render_queue& queue, const glm::vec3& eye)
+{
+	queue.last_frame = queue.frame;
+	queue.last_unsorted = queue.unsorted;
+	queue.frame = render_counters();
+	queue.unsorted = render_counters();
+	for (int pass = 0; pass < NUM_RENDER_PASSES; pass++) {
+		queue.last_culling[pass] = queue.culling[pass];
+		queue.culling[pass] = cull_counters();
+		queue.culls[pass] = false;
+	}
+	queue.items.clear();
+	queue.eye = eye;
+}
+
+// Cull the pass's items against the clip space of a view projection matrix, a pass without one keeps every item
+void set_render_frustum(render_queue& queue, render_pass pass, const glm::mat4& view_projection)
+{
+	queue.frustums[pass] = make_frustum(view_projection);
+	queue.culls[pass] = true;
+}
+
+// Triangles an item draws, zero for a mesh still streaming in
+int render_item_triangles(const render_geometry& geometry, int lod)
+{
+	if (!geometry.mesh)
+		return (int)geometry.count / 3;
+	return (int)mesh_lod_range(*geometry.mesh, lod).num_indices / 3;
+}
+
+// Pass in the top bits, then program, arena, textures and geometry, so items that can share a draw call end up next to each other
+// Transparent items put their distance from the camera after the pass instead, farthest first
+uint64_t render_sort_key(const render_queue& queue, const render_item& item)
+{
+	uint64_t key = (uint64_t)item.pass << 62;
+	uint64_t geometry = (uint64_t)item.geometry & 0xffff;
+	if (item.pass == RENDER_PASS_TRANSPARENT) {
+		// Positive floats order the same as their bits
+		float distance = glm::length(glm::vec3(item.model[3]) - queue.eye);
+		uint32_t bits;
+		memcpy(&bits, &distance, sizeof(bits));
+		return key | (uint64_t)~bits << 30 | geometry;
+	}
+	uint64_t program = (uint64_t)item.program & 0x3fff;
+	uint64_t arena = (uint64_t)queue.geometries[item.geometry].arena->vao & 0xff;
+	uint64_t textures = item.material >= 0 ? (uint64_t)(queue.materials[item.material].textures + 1) & 0xff : 0;
+	return key | program << 48 | arena << 40 | textures << 32 | geometry << 16 | ((uint64_t)item.lod & 0xffff);
+}
+
+void submit_render_item(render_queue& queue, render_pass pass, GLuint program, int material, int geometry, int lod, const glm::mat4& model)
+{
+	const render_geometry& draw = queue.geometries[geometry];
+	cull_counters& culling = queue.culling[pass];
+	int triangles = render_item_triangles(draw, lod);
+	int object = culling.objects;
+	culling.objects++;
+	culling.triangles += triangles;
+	if (queue.culls[pass] && triangles > 0) {
+		const bounding_volume bounds = draw.mesh ? mesh_bounding_volume(*draw.mesh) : draw.bounds;
+		if (!bounds_in_frustum(queue.frustums[pass], model, bounds)) {
+			culling.culled_objects++;
+			culling.culled_triangles += triangles;
+			return;
+		}
+	}
+
+	render_item item;
+	item.pass = pass;
+	item.program = program;
+	item.material = material;
+	item.geometry = geometry;
+	item.lod = lod;
+	item.object = object;
+	item.model = model;
+	item.key = render_sort_key(queue, item);
+	queue.items.push_back(item);
+}
+
+// Texture table entry an item needs bound to units, -1 when bindless or when it samples none
+int item_bound_textures(const render_queue& queue, const render_item& item)
+{
+	if (item.material < 0 || queue.textures->bindless)
+		return -1;
+	return queue.materials[item.material].textures;
+}
+
+// Whether an item can join the draw call of the one before it
+// Materials without textures leave the last ones bound, they do not sample them
+bool same_render_batch(const render_queue& queue, const render_item& previous, const render_item& item)
+{
+	if (item.program != previous.program || queue.geometries[item.geometry].arena != queue.geometries[previous.geometry].arena)
+		return false;
+	int textures = item_bound_textures(queue, item);
+	return textures < 0 || textures == item_bound_textures(queue, previous);
+}
+
+// Draw calls and state changes drawing each pass's items in their current order would make
+void count_render_changes(const render_queue& queue, render_counters& counters)
+{
+	for (int pass = 0; pass < NUM_RENDER_PASSES; pass++) {
+		// Every pass starts from nothing, see draw_render_pass
+		const render_item* previous = nullptr;
+		for (const render_item& item : queue.items) {
+			if (item.pass != pass)
+				continue;
+			if (!previous || item.program != previous->program)
+				counters.programs++;
+			if (!previous || queue.geometries[item.geometry].arena != queue.geometries[previous->geometry].arena)
+				counters.arenas++;
+			int textures = item_bound_textures(queue, item);
+			if (textures >= 0 && (!previous || textures != item_bound_textures(queue, *previous)))
+				counters.textures++;
+			if (!queue.multi_draw || !previous || !same_render_batch(queue, *previous, item))
+				counters.draw_calls++;
+			counters.items++;
+			previous = &item;
+		}
+	}
+}
+
+// MATERIAL_USES_ bits of a material, also the feature mask of its lighting shader variant
+int render_material_features(const render_material& material)
+{
+	int flags = 0;
+	flags |= material.uses_texture ? MATERIAL_USES_TEXTURE : 0;
+	flags |= material.uses_glow ? MATERIAL_USES_GLOW : 0;
+	flags |= material.uses_normal ? MATERIAL_USES_NORMAL : 0;
+	flags |= material.uses_specular ? MATERIAL_USES_SPECULAR : 0;
+	flags |= material.uses_pbr ? MATERIAL_USES_PBR : 0;
+	flags |= material.uses_parrallax ? MATERIAL_USES_PARRALLAX : 0;
+	return flags;
+}
+
+// A material's settings in the layout of the material table
+material_data make_material_data(const render_material& material)
+{
+	material_data data;
+	data.info = glm::ivec4(std::max(material.textures, 0), material.pbr_material, render_material_features(material), 0);
+	data.params = glm::vec4(material.shininess, material.uv_scale, material.bump_scale, material.height_scale);
+	return data;
+}
+
+// Upload a table, growing its buffer when it no longer fits
+void upload_render_table(GLuint buffer, size_t& capacity, const void* data, size_t bytes)
+{
+	if (bytes == 0)
+		return;
+	if (bytes > capacity) {
+		capacity = std::max(bytes, capacity * 2);
+		glNamedBufferData(buffer, (GLsizeiptr)capacity, NULL, GL_DYNAMIC_DRAW);
+	}
+	glNamedBufferSubData(buffer, 0, (GLsizeiptr)bytes, data);
+}
+
+// Write the draw table and indirect commands of the sorted items and upload them
+void build_render_draws(render_queue& queue)
+{
+	queue.draws.resize(queue.items.size());
+	queue.commands.resize(queue.items.size());
+	for (size_t i = 0; i < queue.items.size(); i++) {
+		const render_item& item = queue.items[i];
+		render_geometry& geometry = queue.geometries[item.geometry];
+		draw_data& draw = queue.draws[i];
+		draw_elements_command& command = queue.commands[i];
+		draw.model = item.model;
+		draw.info = glm::ivec4(std::max(item.material, 0), 0, 0, 0);
+		command.instance_count = 1;
+		command.base_instance = 0;
+
+		if (!geometry.mesh) {
+			draw.pos_offset = glm::vec4(0.f);
+			draw.pos_scale = glm::vec4(1.f);
+			command.count = geometry.count;
+			command.first_index = geometry.first_index;
+			command.base_vertex = geometry.base_vertex;
+			continue;
+		}
+		const indexed_mesh& mesh = *geometry.mesh;
+		// Copy the palette once the mesh has streamed in
+		if (geometry.palette < 0 && !mesh.palette.empty()) {
+			geometry.palette = (int)queue.palettes.size();
+			for (const glm::vec3& colour : mesh.palette) {
+				queue.palettes.push_back(glm::vec4(colour, 1.f));
+			}
+			queue.palettes_dirty = true;
+		}
+		draw.pos_offset = glm::vec4(mesh.pos_offset, 0.f);
+		draw.pos_scale = glm::vec4(mesh.pos_scale, 0.f);
+		draw.info.y = 1;
+		draw.info.z = std::max(geometry.palette, 0);
+		// A mesh still streaming in has no indices and draws nothing
+		mesh_lod level = mesh_lod_range(mesh, item.lod);
+		command.count = level.num_indices;
+		command.first_index = mesh.first_index + level.first_index;
+		command.base_vertex = mesh.base_vertex;
+	}
+
+	// World boxes of the opaque draws, tested against the depth pyramid by occlusion.h
+	queue.occlusion.clear();
+	for (size_t i = 0; i < queue.items.size(); i++) {
+		const render_item& item = queue.items[i];
+		if (item.pass != RENDER_PASS_OPAQUE || queue.commands[i].count == 0)
+			continue;
+		const render_geometry& geometry = queue.geometries[item.geometry];
+		glm::vec3 centre, extent;
+		world_box(item.model, geometry.mesh ? mesh_bounding_volume(*geometry.mesh) : geometry.bounds, centre, extent);
+		occlusion_data box;
+		box.box_min = glm::vec4(centre - extent, 1.f);
+		box.box_max = glm::vec4(centre + extent, 1.f);
+		box.info = glm::ivec4((int)i, item.object, 0, 0);
+		queue.occlusion.push_back(box);
+	}
+
+	if (queue.materials_dirty) {
+		std::vector<material_data> materials;
+		for (const render_material& material : queue.materials) {
+			materials.push_back(make_material_data(material));
+		}
+		if (materials.empty())
+			materials.push_back(make_material_data(render_material()));
+		glNamedBufferData(queue.material_buffer, materials.size() * sizeof(material_data), materials.data(), GL_STATIC_DRAW);
+		queue.materials_dirty = false;
+	}
+	if (queue.palettes_dirty) {
+		if (queue.palettes.empty())
+			queue.palettes.push_back(glm::vec4(1.f));
+		upload_render_table(queue.palette_buffer, queue.palette_capacity, queue.palettes.data(), queue.palettes.size() * sizeof(glm::vec4));
+		queue.palettes_dirty = false;
+	}
+	size_t capacity = queue.draw_capacity;
+	upload_render_table(queue.draw_buffer, queue.draw_capacity, queue.draws.data(), queue.draws.size() * sizeof(draw_data));
+	// The command buffer grows with the draw table
+	if (queue.draw_capacity != capacity)
+		glNamedBufferData(queue.command_buffer, (GLsizeiptr)(queue.draw_capacity / sizeof(draw_data) * sizeof(draw_elements_command)), NULL, GL_DYNAMIC_DRAW);
+	if (!queue.commands.empty())
+		glNamedBufferSubData(queue.command_buffer, 0, queue.commands.size() * sizeof(draw_elements_command), queue.commands.data());
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_TABLE_BINDING, queue.draw_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_TABLE_BINDING, queue.material_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PALETTE_TABLE_BINDING, queue.palette_buffer);
+	upload_render_table(queue.occlusion_buffer, queue.occlusion_capacity, queue.occlusion.data(), queue.occlusion.size() * sizeof(occlusion_data));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_TABLE_BINDING, queue.occlusion_buffer);
+}
+
+// Order the frame's items for drawing and upload their draws, call once every item is submitted
+void sort_render_queue(render_queue& queue)
+{
+	count_render_changes(queue, queue.unsorted);
+	std::stable_sort(queue.items.begin(), queue.items.end(), [](const render_item& a, const render_item& b) { return a.key < b.key; });
+	build_render_draws(queue);
+}
+
+// Draw the commands of items first to first + count - 1, which share a program and arena
+void flush_render_batch(render_queue& queue, GLuint program, size_t first, size_t count)
+{
+	if (count == 0)
+		return;
+	if (queue.multi_draw) {
+		set_uniform(program, "drawBase", (int)first);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(first * sizeof(draw_elements_command)), (GLsizei)count, 0);
+		queue.frame.draw_calls++;
+		return;
+	}
+	for (size_t i = first; i < first + count; i++) {
+		const draw_elements_command& command = queue.commands[i];
+		if (command.count == 0)
+			continue;
+		set_uniform(program, "drawBase", (int)i);
+		// Drawn from the command buffer too, so instance counts written by the occlusion culling hold
+		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(i * sizeof(draw_elements_command)));
+		queue.frame.draw_calls++;
+	}
+}
+
+// Draw the sorted items of one pass, with the pass's framebuffer and depth state already set
+// pbr_only keeps to the items sampling the material arrays, for benchmark_material_layouts
+// A program_override draws every item with that program and no textures, as for a depth prepass
+void draw_render_pass(render_queue& queue, render_pass pass, bool pbr_only = false, GLuint program_override = 0)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, queue.command_buffer);
+	GLuint program = 0;
+	const geometry_arena* arena = nullptr;
+	int textures = -1;
+	size_t first = 0, count = 0;
+	for (size_t i = 0; i < queue.items.size(); i++) {
+		const render_item& item = queue.items[i];
+		if (item.pass != pass)
+			continue;
+		if (pbr_only && (item.material < 0 || queue.materials[item.material].pbr_material < 0))
+			continue;
+
+		// A batch is a run of adjacent commands, so a skipped item ends it too
+		const geometry_arena* item_arena = queue.geometries[item.geometry].arena;
+		GLuint item_program = program_override ? program_override : item.program;
+		int item_textures = program_override ? -1 : item_bound_textures(queue, item);
+		bool batched = count > 0 && first + count == i && item_program == program && item_arena == arena && (item_textures < 0 || item_textures == textures);
+		if (batched) {
+			count++;
+			queue.frame.items++;
+			continue;
+		}
+		flush_render_batch(queue, program, first, count);
+		first = i;
+		count = 1;
+
+		if (item_program != program) {
+			program = item_program;
+			// Programs still building are checked on their first draw
+			FinishProgram(program);
+			glUseProgram(program);
+			queue.frame.programs++;
+		}
+		if (item_arena != arena) {
+			arena = item_arena;
+			glBindVertexArray(arena->vao);
+			queue.frame.arenas++;
+		}
+		if (item_textures >= 0 && item_textures != textures) {
+			textures = item_textures;
+			use_texture_material(*queue.textures, textures);
+			queue.frame.textures++;
+		}
+		queue.frame.items++;
+	}
+	flush_render_batch(queue, program, first, count);
+}
+
+// Draw calls and state changes of the last complete frame, against drawing the items in submission order
+void print_render_counters(const render_queue& queue)
+{
+	const render_counters& sorted = queue.last_frame;
+	const render_counters& unsorted = queue.last_unsorted;
+	printf("Render queue last frame: %d items in %d draw calls, %d program, %d arena and %d texture changes.\n",
+		sorted.items, sorted.draw_calls, sorted.programs, sorted.arenas, sorted.textures);
+	printf("  In submission order: %d draw calls, %d program, %d arena and %d texture changes.\n",
+		unsorted.draw_calls, unsorted.programs, unsorted.arenas, unsorted.textures);
+	for (int pass = 0; pass < NUM_RENDER_PASSES; pass++) {
+		const cull_counters& culling = queue.last_culling[pass];
+		printf("  %s pass culled %d of %d objects and %d of %d triangles.\n", render_pass_names[pass],
+			culling.culled_objects, culling.objects, culling.culled_triangles, culling.triangles);
+	}
+}
+
+void delete_render_queue(render_queue& queue)
+{
+	glDeleteBuffers(1, &queue.draw_buffer);
+	glDeleteBuffers(1, &queue.command_buffer);
+	glDeleteBuffers(1, &queue.material_buffer);
+	glDeleteBuffers(1, &queue.palette_buffer);
+	glDeleteBuffers(1, &queue.occlusion_buffer);
+	queue.draw_buffer = queue.command_buffer = queue.material_buffer = queue.palette_buffer = queue.occlusion_buffer = 0;
+}
@@ -1,68 +1,313 @@
 #pragma once
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <GL/gl3w.h>
 #include <GLFW/glfw3.h>
 #include "shader.h"
 #include "file.h"
+#include "uniforms.h"
+#include "program_cache.h"
 
+// Hand a shader its source with extra lines such as #defines inserted after the #version line
+void SetShaderSource(GLuint shader, const char* source, const char* defines)
+{
+	if (!source)
+		source = "";
+	// Blank lines and comments may come before #version
+	const char* version = strstr(source, "#version");
+	const char* body = strchr(version ? version : source, '\n');
+	body = body ? body + 1 : source + strlen(source);
+	// Keep the line numbers of compile errors matching the file
+	int line = 1;
+	for (const char* c = source; c < body; c++) {
+		if (*c == '\n')
+			line++;
+	}
+	char line_directive[32];
+	snprintf(line_directive, sizeof(line_directive), "#line %d\n", line);
+	const char* parts[4] = { source, defines, line_directive, body };
+	GLint lengths[4] = { (GLint)(body - source), (GLint)strlen(defines), -1, -1 };
+	glShaderSource(shader, 4, parts, lengths);
+}
 
-GLuint CompileShader(const char* vsFilename, const char* fsFilename)
+bool ShaderLinked(GLuint program)
 {
-	// Create a program from the given shader filenames.
 	int success;
-	char infoLog[512];
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	return success != 0;
+}
 
-	// Compile Vertex Shader.
-	// Create a shader and return handle for referencing it.
-	unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	// Reads a shader from a file.
-	char* vertexShaderSource = read_file(vsFilename);
-	// Sets the shader source as specified in the string to the shader.
-	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-	// Compiles the shader.
-	glCompileShader(vertexShader);
-
-	// Checks for compilation errors in shader, store result in success.
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		// Queries info log of shader, specifies an array of characters used to return the information log.
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-		fprintf(stderr, "Vertex Shader Compilation Fail - %s\n", infoLog);
+bool has_gl_extension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0)
+			return true;
 	}
+	return false;
+}
 
-	// Compile Fragment Shader.
-	unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	char* fragmentShaderSource = read_file(fsFilename);
-	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-	glCompileShader(fragmentShader);
+// Programs are built in two steps so the driver can compile several at once
+// BeginCompileShader submits the sources and links without asking for the result, which would wait on the driver
+// FinishProgram checks the result once the program is first used, PumpProgramBuilds finishes the ones already done
+// CompileShader does both steps at once for programs needed straight away
+// With KHR_parallel_shader_compile the driver compiles on its own threads and reports when a program is done
 
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-		fprintf(stderr, "Fragment Shader Compilation Fail -%s\n", infoLog);
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP max_shader_compiler_threads_proc)(GLuint count);
+// Called with each program that links once FinishProgram has reflected it, to set the uniforms it shares with others
+typedef void (*program_finished_proc)(GLuint program);
+
+// A submitted program whose compile and link status has not been checked yet
+struct pending_program
+{
+	GLuint shaders[2] = {};
+	int num_shaders = 0;
+	// Shader named in build errors
+	std::string cache_name;
+	// Binary cache file and the key it must hold
+	std::string cache_path;
+	uint64_t key = 0;
+};
+
+struct program_builds
+{
+	// Whether the driver reports GL_COMPLETION_STATUS_KHR
+	bool parallel = false;
+	std::unordered_map<GLuint, pending_program> pending;
+	// Checked programs that did not link, until they are deleted through DeleteProgram
+	std::unordered_set<GLuint> failed;
+	std::vector<program_finished_proc> finished_hooks;
+};
+
+program_builds& program_build_state()
+{
+	static program_builds state;
+	return state;
+}
+
+// Let the driver use all of its compiler threads, call once after gl3wInit and before the first BeginCompileShader
+void InitParallelShaderCompile()
+{
+	program_builds& state = program_build_state();
+	max_shader_compiler_threads_proc max_threads = nullptr;
+	if (has_gl_extension("GL_KHR_parallel_shader_compile"))
+		max_threads = (max_shader_compiler_threads_proc)gl3wGetProcAddress("glMaxShaderCompilerThreadsKHR");
+	else if (has_gl_extension("GL_ARB_parallel_shader_compile"))
+		max_threads = (max_shader_compiler_threads_proc)gl3wGetProcAddress("glMaxShaderCompilerThreadsARB");
+	state.parallel = max_threads != nullptr;
+	if (max_threads)
+		max_threads(0xFFFFFFFF);
+	printf("Shader compilation: %s.\n", state.parallel ? "parallel on the driver's threads" : "on the driver's own schedule, one program checked a frame");
+}
+
+// Register a hook for programs finished from now on, programs already checked must be set up by the caller
+void AddProgramFinishedHook(program_finished_proc hook)
+{
+	program_build_state().finished_hooks.push_back(hook);
+}
+
+bool ProgramPending(GLuint program)
+{
+	const program_builds& state = program_build_state();
+	return !state.pending.empty() && state.pending.count(program) != 0;
+}
+
+// Whether checking the program would not wait on the driver
+bool ProgramBuildComplete(GLuint program)
+{
+	if (!ProgramPending(program))
+		return true;
+	// Without the extension there is no way to ask, so only finishing tells
+	if (!program_build_state().parallel)
+		return false;
+	GLint complete = 0;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+	return complete != 0;
+}
+
+// Compile and link the shaders without waiting for the results, a program the binary cache holds is ready at once
+GLuint BeginProgram(const char* const* filenames, const GLenum* stages, int num_shaders, const char* defines)
+{
+	double start = glfwGetTime();
+
+	// Reads the shaders from their files.
+	char* sources[2] = {};
+	for (int i = 0; i < num_shaders; i++) {
+		sources[i] = read_file(filenames[i]);
+	}
+
+	// Load the program linked on an earlier launch if the sources and driver are the same.
+	const char* cache_name = filenames[num_shaders - 1];
+	std::string cache_path = program_cache_path(filenames, num_shaders, defines);
+	uint64_t key = program_cache_key(sources, num_shaders, defines);
+	GLuint cached = load_program_binary(cache_path, key);
+	if (cached) {
+		// Resolve every uniform location once for the setters in uniforms.h
+		reflect_uniforms(cached);
+		for (int i = 0; i < num_shaders; i++) {
+			free(sources[i]);
+		}
+		program_cache_stats().loaded++;
+		program_cache_stats().load_ms += (glfwGetTime() - start) * 1000.0;
+		return cached;
 	}
 
-	// Link Program.
 	// Create shader program
 	unsigned int program = glCreateProgram();
-	// Attach shaders to program, turns attached shaders into executable code.
-	glAttachShader(program, vertexShader);
-	glAttachShader(program, fragmentShader);
+	pending_program pending;
+	pending.num_shaders = num_shaders;
+	pending.cache_name = cache_name;
+	pending.cache_path = cache_path;
+	pending.key = key;
+	for (int i = 0; i < num_shaders; i++) {
+		// Create a shader and return handle for referencing it.
+		unsigned int shader = glCreateShader(stages[i]);
+		// Sets the shader source as specified in the string to the shader.
+		SetShaderSource(shader, sources[i], defines);
+		// Compiles the shader, the status is checked in FinishProgram.
+		glCompileShader(shader);
+		// Attach shaders to program, turns attached shaders into executable code.
+		glAttachShader(program, shader);
+		pending.shaders[i] = shader;
+		free(sources[i]);
+	}
+	// Keep the linked binary available for the program cache
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	// Link the program
 	glLinkProgram(program);
 
+	program_build_state().pending[program] = pending;
+	program_cache_stats().compile_ms += (glfwGetTime() - start) * 1000.0;
+	return program;
+}
+
+GLuint BeginCompileShader(const char* vsFilename, const char* fsFilename, const char* defines = "")
+{
+	const char* filenames[2] = { vsFilename, fsFilename };
+	const GLenum stages[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	return BeginProgram(filenames, stages, 2, defines);
+}
+
+GLuint BeginCompileComputeShader(const char* csFilename, const char* defines = "")
+{
+	const GLenum stage = GL_COMPUTE_SHADER;
+	return BeginProgram(&csFilename, &stage, 1, defines);
+}
+
+// Check a submitted program's compile and link status, waiting for the driver if it is still building
+// Call before the first use of the program, programs already checked return their earlier result
+bool FinishProgram(GLuint program)
+{
+	program_builds& state = program_build_state();
+	auto found = state.pending.find(program);
+	if (found == state.pending.end())
+		return state.failed.empty() || state.failed.count(program) == 0;
+	double start = glfwGetTime();
+	pending_program pending = found->second;
+	state.pending.erase(found);
+
+	int success;
+	char infoLog[512];
+	for (int i = 0; i < pending.num_shaders; i++) {
+		// Checks for compilation errors in shader, store result in success.
+		glGetShaderiv(pending.shaders[i], GL_COMPILE_STATUS, &success);
+		if (!success) {
+			// Queries info log of shader, specifies an array of characters used to return the information log.
+			glGetShaderInfoLog(pending.shaders[i], 512, NULL, infoLog);
+			fprintf(stderr, "%s Shader Compilation Fail - %s\n", pending.cache_name.c_str(), infoLog);
+		}
+	}
+
 	// Checks for errors in program, store in success.
 	glGetProgramiv(program, GL_LINK_STATUS, &success);
 	if (!success) {
 		// Queries log of program and return information as list of chars.
 		glGetProgramInfoLog(program, 512, NULL, infoLog);
 		fprintf(stderr, "Shader Program Link Fail - %s\n", infoLog);
+		state.failed.insert(program);
+	}
+	else {
+		// Resolve every uniform location once for the setters in uniforms.h
+		reflect_uniforms(program);
+		save_program_binary(program, pending.cache_path, pending.key);
+		for (program_finished_proc hook : state.finished_hooks) {
+			hook(program);
+		}
+	}
+
+	for (int i = 0; i < pending.num_shaders; i++) {
+		glDetachShader(program, pending.shaders[i]);
+		glDeleteShader(pending.shaders[i]);
 	}
+	program_cache_stats().compiled++;
+	program_cache_stats().compile_ms += (glfwGetTime() - start) * 1000.0;
+	return success != 0;
+}
+
+// Whether the program can be drawn with now, finishing it if the driver is done and never waiting for it
+// False while it builds and when it failed to link
+bool ProgramReady(GLuint program)
+{
+	return ProgramBuildComplete(program) && FinishProgram(program);
+}
+
+// Finish the programs the driver is done with, call once a frame while programs are pending
+// Without KHR_parallel_shader_compile there is no way to ask, so one program is finished a frame to spread the waits
+void PumpProgramBuilds()
+{
+	program_builds& state = program_build_state();
+	if (state.pending.empty())
+		return;
+	if (!state.parallel) {
+		FinishProgram(state.pending.begin()->first);
+		return;
+	}
+	std::vector<GLuint> complete;
+	for (const auto& pending : state.pending) {
+		if (ProgramBuildComplete(pending.first))
+			complete.push_back(pending.first);
+	}
+	for (GLuint program : complete) {
+		FinishProgram(program);
+	}
+}
 
-	free(fragmentShaderSource);
-	free(vertexShaderSource);
+// Delete a program built here, whether or not it has been checked, and forget everything known about it
+void DeleteProgram(GLuint program)
+{
+	program_builds& state = program_build_state();
+	auto found = state.pending.find(program);
+	if (found != state.pending.end()) {
+		for (int i = 0; i < found->second.num_shaders; i++) {
+			glDeleteShader(found->second.shaders[i]);
+		}
+		state.pending.erase(found);
+	}
+	state.failed.erase(program);
+	forget_uniforms(program);
+	glDeleteProgram(program);
+}
 
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
+GLuint CompileShader(const char* vsFilename, const char* fsFilename, const char* defines = "")
+{
+	// Create a program from the given shader filenames.
+	GLuint program = BeginCompileShader(vsFilename, fsFilename, defines);
+	FinishProgram(program);
+	return program;
+}
 
+GLuint CompileComputeShader(const char* csFilename, const char* defines = "")
+{
+	GLuint program = BeginCompileComputeShader(csFilename, defines);
+	FinishProgram(program);
 	return program;
 }
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+#include "shader.h"
+#include "uniforms.h"
+
+// Programs of one vertex and fragment shader pair, specialized for each combination of features asked for
+// A variant is compiled with "#define <feature_define> <mask>" after the shared defines, so the shaders can make their feature checks constant
+// Variants are submitted on first request and cached by their mask, the generic program stands in until a variant has built
+// One that fails to build falls back to the generic program for good
+
+struct shader_variants
+{
+	std::string vs_filename;
+	std::string fs_filename;
+	// Defines every variant is compiled with, such as the bindless and multi draw switches
+	std::string defines;
+	// Name of the define holding the mask
+	std::string feature_define;
+	// Compiled without the feature define, reading the features at runtime
+	GLuint generic = 0;
+	std::unordered_map<uint32_t, GLuint> programs;
+};
+
+// Take over a generic program built from the same files and defines, variants are deleted along with it
+void init_shader_variants(shader_variants& variants, const char* vsFilename, const char* fsFilename, const char* defines, const char* feature_define, GLuint generic)
+{
+	variants.vs_filename = vsFilename;
+	variants.fs_filename = fsFilename;
+	variants.defines = defines;
+	variants.feature_define = feature_define;
+	variants.generic = generic;
+}
+
+// Shared defines followed by the feature mask of one variant
+std::string shader_variant_defines(const shader_variants& variants, uint32_t features)
+{
+	char line[96];
+	snprintf(line, sizeof(line), "#define %s %u\n", variants.feature_define.c_str(), features);
+	return variants.defines + line;
+}
+
+// Submit the variant for a feature mask without waiting for the driver, so several can compile at once
+void begin_shader_variant(shader_variants& variants, uint32_t features)
+{
+	if (variants.programs.count(features))
+		return;
+	std::string defines = shader_variant_defines(variants, features);
+	variants.programs[features] = BeginCompileShader(variants.vs_filename.c_str(), variants.fs_filename.c_str(), defines.c_str());
+}
+
+// The program to draw a feature mask with this frame, never waiting for the driver
+// Submits the variant the first time the mask is asked for and returns the generic program until it has built
+GLuint shader_variant(shader_variants& variants, uint32_t features)
+{
+	begin_shader_variant(variants, features);
+	GLuint& program = variants.programs[features];
+	if (program == variants.generic)
+		return program;
+	if (!ProgramBuildComplete(program))
+		return variants.generic;
+	if (!FinishProgram(program)) {
+		fprintf(stderr, "%s variant 0x%x failed to build, using the generic program.\n", variants.fs_filename.c_str(), features);
+		DeleteProgram(program);
+		program = variants.generic;
+	}
+	return program;
+}
+
+// The generic program and every variant, each once
+std::vector<GLuint> shader_variant_programs(const shader_variants& variants)
+{
+	std::vector<GLuint> programs = { variants.generic };
+	for (const auto& variant : variants.programs) {
+		if (std::find(programs.begin(), programs.end(), variant.second) == programs.end())
+			programs.push_back(variant.second);
+	}
+	return programs;
+}
+
+// The programs that have finished building, for setting the uniforms they share without waiting on the rest
+// Set the same uniforms from a program finished hook so variants finishing later pick them up
+std::vector<GLuint> finished_shader_variant_programs(const shader_variants& variants)
+{
+	std::vector<GLuint> programs;
+	for (GLuint program : shader_variant_programs(variants)) {
+		if (!ProgramPending(program))
+			programs.push_back(program);
+	}
+	return programs;
+}
+
+bool is_shader_variant(const shader_variants& variants, GLuint program)
+{
+	if (program == variants.generic)
+		return true;
+	for (const auto& variant : variants.programs) {
+		if (variant.second == program)
+			return true;
+	}
+	return false;
+}
+
+void print_shader_variants(const shader_variants& variants)
+{
+	printf("%s: %d specialized variants besides the generic program.\n", variants.fs_filename.c_str(), (int)shader_variant_programs(variants).size() - 1);
+}
+
+void delete_shader_variants(shader_variants& variants)
+{
+	for (GLuint program : shader_variant_programs(variants)) {
+		DeleteProgram(program);
+	}
+	variants = shader_variants();
+}
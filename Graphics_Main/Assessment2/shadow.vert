@@ -1,10 +1,51 @@
 #version 450 core
+#ifdef MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 
 layout(location = 0) in vec3 vPos;
 
-uniform mat4 projectedLightSpaceMatrix;
-uniform mat4 model;
+// Camera values of the frame, must match frame_data in frame_uniforms.h
+layout(std140, binding = 0) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	mat4 projectedLightSpaceMatrix;
+	vec3 camPos;
+	float time;
+};
+
+// Per draw values written by the render queue, must match draw_data in render_queue.h
+struct DrawData
+{
+	mat4 model;
+	// Packed meshes dequantize positions from their bounds
+	vec4 posOffset;
+	vec4 posScale;
+	// Render material, 1 for packed vertices, first palette entry
+	ivec4 info;
+};
+layout(std430, binding = 4) readonly buffer DrawTable
+{
+	DrawData draws[];
+};
+
+// Draw table entry of the first draw in the batch
+uniform int drawBase;
+#ifdef MULTI_DRAW
+#define DRAW_INDEX (drawBase + gl_DrawIDARB)
+#else
+#define DRAW_INDEX drawBase
+#endif
 
 void main(){
-	gl_Position = projectedLightSpaceMatrix * model * vec4(vPos, 1.0);
-}
\ No newline at end of file
+	DrawData draw = draws[DRAW_INDEX];
+	// Packed meshes store positions normalized to their bounds
+	vec3 position = draw.info.y != 0 ? draw.posOffset.xyz + vPos * draw.posScale.xyz : vPos;
+#ifdef CAMERA_DEPTH
+	// Depth of the occlusion culling pass, seen from the camera
+	gl_Position = projection * view * draw.model * vec4(position, 1.0);
+#else
+	gl_Position = projectedLightSpaceMatrix * draw.model * vec4(position, 1.0);
+#endif
+}
@@ -6,11 +6,19 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+// Camera values of the frame, must match frame_data in frame_uniforms.h
+layout(std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 projectedLightSpaceMatrix;
+    vec3 camPos;
+    float time;
+};
 
 void main()
 {
     TexCoords = aPos;
-    gl_Position = projection * view * vec4(aPos, 1.0);
+    // Rotation only, the skybox stays centred on the camera
+    gl_Position = projection * mat4(mat3(view)) * vec4(aPos, 1.0);
 }  
\ No newline at end of file
@@ -4,8 +4,16 @@ layout(location = 0) in vec4 vPos;
 layout(location = 1) in vec3 vCol;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// Camera values of the frame, must match frame_data in frame_uniforms.h
+layout(std140, binding = 0) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	mat4 projectedLightSpaceMatrix;
+	vec3 camPos;
+	float time;
+};
 
 out vec3 col;
 
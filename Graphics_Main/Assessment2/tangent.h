@@ -1,56 +1,168 @@
 #pragma once
 
+#include <vector>
+#include <stdint.h>
+#include <math.h>
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+
+#include "thread_pool.h"
+
 const int floatsPerInputVertex = 11;
 const int floatsPerOutputVertex = 17;
 
+// Meshes with fewer vertices than this are not worth splitting across threads
+#define TANGENT_PARALLEL_BATCH 8192
+
+// Per vertex attributes as separate arrays so the inner loops vectorize
+struct tangent_space_input
+{
+    std::vector<float> pos_x, pos_y, pos_z;
+    std::vector<float> nor_x, nor_y, nor_z;
+    std::vector<float> tex_u, tex_v;
+
+    void resize(size_t num_vertices)
+    {
+        pos_x.resize(num_vertices); pos_y.resize(num_vertices); pos_z.resize(num_vertices);
+        nor_x.resize(num_vertices); nor_y.resize(num_vertices); nor_z.resize(num_vertices);
+        tex_u.resize(num_vertices); tex_v.resize(num_vertices);
+    }
+
+    size_t size() const
+    {
+        return pos_x.size();
+    }
+};
+
+// Unit tangent per vertex and the handedness of the bitangent, cross(normal, tangent) * sign
+struct tangent_space_output
+{
+    std::vector<float> tan_x, tan_y, tan_z;
+    std::vector<float> sign;
+};
+
+// Run body over [0, count) on the pool, or on this thread when pool is null
+void tangent_for(thread_pool* pool, size_t count, const std::function<void(size_t begin, size_t end)>& body)
+{
+    if (pool)
+        pool->parallel_for(count, TANGENT_PARALLEL_BATCH, body);
+    else if (count > 0)
+        body(0, count);
+}
+
+// Smooth tangent frame per vertex of an indexed triangle mesh
+// Every triangle using a vertex adds its UV derived frame, the sum is then made orthogonal to the vertex normal
+// Mirrored UVs flip the bitangent of a triangle, which shows up as a negative sign
+void generate_tangent_space(const tangent_space_input& in, const uint32_t* indices, size_t num_indices, tangent_space_output* out, thread_pool* pool = &worker_pool())
+{
+    size_t num_vertices = in.size();
+    size_t num_triangles = num_indices / 3;
+
+    // Frame of each triangle, left unnormalized so larger triangles count for more
+    std::vector<float> face_tx(num_triangles), face_ty(num_triangles), face_tz(num_triangles);
+    std::vector<float> face_bx(num_triangles), face_by(num_triangles), face_bz(num_triangles);
+
+    tangent_for(pool, num_triangles, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++) {
+            uint32_t i0 = indices[t * 3 + 0], i1 = indices[t * 3 + 1], i2 = indices[t * 3 + 2];
+
+            float e1x = in.pos_x[i1] - in.pos_x[i0], e1y = in.pos_y[i1] - in.pos_y[i0], e1z = in.pos_z[i1] - in.pos_z[i0];
+            float e2x = in.pos_x[i2] - in.pos_x[i0], e2y = in.pos_y[i2] - in.pos_y[i0], e2z = in.pos_z[i2] - in.pos_z[i0];
+            float du1 = in.tex_u[i1] - in.tex_u[i0], dv1 = in.tex_v[i1] - in.tex_v[i0];
+            float du2 = in.tex_u[i2] - in.tex_u[i0], dv2 = in.tex_v[i2] - in.tex_v[i0];
+
+            // Triangles without usable UVs add nothing
+            float denominator = du1 * dv2 - du2 * dv1;
+            float f = fabsf(denominator) < 1e-12f ? 0.f : 1.f / denominator;
+
+            face_tx[t] = f * (dv2 * e1x - dv1 * e2x);
+            face_ty[t] = f * (dv2 * e1y - dv1 * e2y);
+            face_tz[t] = f * (dv2 * e1z - dv1 * e2z);
+            face_bx[t] = f * (du1 * e2x - du2 * e1x);
+            face_by[t] = f * (du1 * e2y - du2 * e1y);
+            face_bz[t] = f * (du1 * e2z - du2 * e1z);
+        }
+    });
+
+    // Triangles around each vertex, so vertices can be summed in parallel without atomics
+    std::vector<uint32_t> first_face(num_vertices + 1, 0);
+    for (size_t i = 0; i < num_triangles * 3; i++) {
+        first_face[indices[i] + 1]++;
+    }
+    for (size_t v = 0; v < num_vertices; v++) {
+        first_face[v + 1] += first_face[v];
+    }
+    std::vector<uint32_t> vertex_faces(num_triangles * 3);
+    std::vector<uint32_t> fill(first_face.begin(), first_face.end() - 1);
+    for (size_t i = 0; i < num_triangles * 3; i++) {
+        vertex_faces[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    out->tan_x.resize(num_vertices);
+    out->tan_y.resize(num_vertices);
+    out->tan_z.resize(num_vertices);
+    out->sign.resize(num_vertices);
+
+    tangent_for(pool, num_vertices, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            glm::vec3 tangent(0.f), bitangent(0.f);
+            for (uint32_t i = first_face[v]; i < first_face[v + 1]; i++) {
+                uint32_t t = vertex_faces[i];
+                tangent += glm::vec3(face_tx[t], face_ty[t], face_tz[t]);
+                bitangent += glm::vec3(face_bx[t], face_by[t], face_bz[t]);
+            }
+
+            glm::vec3 normal(in.nor_x[v], in.nor_y[v], in.nor_z[v]);
+            float normal_length = glm::length(normal);
+            normal = normal_length > 0.f ? normal / normal_length : glm::vec3(0.f, 0.f, 1.f);
+
+            // Gram-Schmidt against the normal
+            tangent -= normal * glm::dot(normal, tangent);
+            if (glm::dot(tangent, tangent) < 1e-20f) {
+                // No UV gradient, any direction in the surface will do
+                glm::vec3 axis = fabsf(normal.x) < 0.9f ? glm::vec3(1.f, 0.f, 0.f) : glm::vec3(0.f, 1.f, 0.f);
+                tangent = glm::cross(axis, normal);
+            }
+            tangent = glm::normalize(tangent);
+
+            out->tan_x[v] = tangent.x;
+            out->tan_y[v] = tangent.y;
+            out->tan_z[v] = tangent.z;
+            out->sign[v] = glm::dot(glm::cross(normal, tangent), bitangent) < 0.f ? -1.f : 1.f;
+        }
+    });
+}
+
 // Function to generate tangents and bitangents for a mesh
+// Every input vertex is treated as unique, so flat shaded input keeps one frame per face
 void generateTangentsAndBitangents(const GLfloat* inputVertices, size_t numVertices, std::vector<GLfloat>& outputVertices) {
-    for (size_t i = 0; i < numVertices; i += 3) {
-        // Load input triangle vertices
-        const GLfloat* v0 = &inputVertices[(i + 0) * floatsPerInputVertex];
-        const GLfloat* v1 = &inputVertices[(i + 1) * floatsPerInputVertex];
-        const GLfloat* v2 = &inputVertices[(i + 2) * floatsPerInputVertex];
-
-        // Positions
-        glm::vec3 pos1(v0[0], v0[1], v0[2]);
-        glm::vec3 pos2(v1[0], v1[1], v1[2]);
-        glm::vec3 pos3(v2[0], v2[1], v2[2]);
-
-        // UVs
-        glm::vec2 uv1(v0[6], v0[7]);
-        glm::vec2 uv2(v1[6], v1[7]);
-        glm::vec2 uv3(v2[6], v2[7]);
-
-        // Edge vectors
-        glm::vec3 edge1 = pos2 - pos1;
-        glm::vec3 edge2 = pos3 - pos1;
-        glm::vec2 deltaUV1 = uv2 - uv1;
-        glm::vec2 deltaUV2 = uv3 - uv1;
-
-        float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
-
-        glm::vec3 tangent, bitangent;
-
-        tangent.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
-        tangent.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
-        tangent.z = f * (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z);
-        tangent = glm::normalize(tangent);
-
-        bitangent.x = f * (-deltaUV2.x * edge1.x + deltaUV1.x * edge2.x);
-        bitangent.y = f * (-deltaUV2.x * edge1.y + deltaUV1.x * edge2.y);
-        bitangent.z = f * (-deltaUV2.x * edge1.z + deltaUV1.x * edge2.z);
-        bitangent = glm::normalize(bitangent);
+    tangent_space_input input;
+    input.resize(numVertices);
+    std::vector<uint32_t> indices(numVertices);
+    for (size_t i = 0; i < numVertices; ++i) {
+        const GLfloat* vin = &inputVertices[i * floatsPerInputVertex];
+        input.pos_x[i] = vin[0]; input.pos_y[i] = vin[1]; input.pos_z[i] = vin[2];
+        input.tex_u[i] = vin[6]; input.tex_v[i] = vin[7];
+        input.nor_x[i] = vin[8]; input.nor_y[i] = vin[9]; input.nor_z[i] = vin[10];
+        indices[i] = (uint32_t)i;
+    }
+
+    tangent_space_output frames;
+    generate_tangent_space(input, indices.data(), indices.size(), &frames);
+
+    for (size_t i = 0; i < numVertices; ++i) {
+        const GLfloat* vin = &inputVertices[i * floatsPerInputVertex];
+        glm::vec3 normal = glm::normalize(glm::vec3(vin[8], vin[9], vin[10]));
+        glm::vec3 tangent(frames.tan_x[i], frames.tan_y[i], frames.tan_z[i]);
+        glm::vec3 bitangent = glm::cross(normal, tangent) * frames.sign[i];
 
         // Append each vertex with full attributes (17 floats)
-        for (int j = 0; j < 3; ++j) {
-            const GLfloat* vin = &inputVertices[(i + j) * floatsPerInputVertex];
-            outputVertices.insert(outputVertices.end(), vin, vin + floatsPerInputVertex); 
-            outputVertices.push_back(tangent.x);
-            outputVertices.push_back(tangent.y);
-            outputVertices.push_back(tangent.z);
-            outputVertices.push_back(bitangent.x);
-            outputVertices.push_back(bitangent.y);
-            outputVertices.push_back(bitangent.z);
-        }
+        outputVertices.insert(outputVertices.end(), vin, vin + floatsPerInputVertex);
+        outputVertices.push_back(tangent.x);
+        outputVertices.push_back(tangent.y);
+        outputVertices.push_back(tangent.z);
+        outputVertices.push_back(bitangent.x);
+        outputVertices.push_back(bitangent.y);
+        outputVertices.push_back(bitangent.z);
     }
-}
\ No newline at end of file
+}
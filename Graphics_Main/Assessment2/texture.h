@@ -4,6 +4,13 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include "texture_cache.h"
+#include "texture_registry.h"
+#include "thread_pool.h"
 
 
 struct Texture {
@@ -12,8 +19,283 @@ struct Texture {
 	std::string path;
 };
 
+// Pixels of one image file, freed with free_decoded_image
+struct decoded_image
+{
+	std::string filename;
+	// Flip so the first row is the bottom of the image, as OpenGL expects
+	bool flip = true;
+	int width = 0, height = 0, channels = 0;
+	unsigned char* pixels = nullptr;
+
+	// Bake the full mip chain through the texture cache instead of keeping the pixels
+	bool bake = false;
+	texture_compression compression = COMPRESS_NONE;
+	bool is_srgb = false;
+	mip_options mips;
+	baked_texture baked;
+
+	// Time decode_image took, including any encode
+	double decode_seconds = 0;
+
+	bool loaded() const
+	{
+		return pixels != nullptr || baked.num_levels > 0;
+	}
+};
 
-GLuint setup_texture(const char* filename)
+// Colour a texture shows until it has loaded, used by asset_stream.h
+enum texture_placeholder
+{
+	PLACEHOLDER_GREY,
+	PLACEHOLDER_WHITE,
+	PLACEHOLDER_BLACK,
+	PLACEHOLDER_NORMAL,
+	NUM_PLACEHOLDERS
+};
+
+enum texture_kind
+{
+	// Options of setup_texture
+	TEXTURE_PLAIN,
+	// Options of setup_texture_pbr
+	TEXTURE_PBR,
+	// One file per mip level like setup_mipmaps
+	TEXTURE_MIPMAPS,
+	// Six faces like setup_cubemap
+	TEXTURE_CUBEMAP
+};
+
+// One texture to load, the finished texture object is written to target
+struct texture_request
+{
+	texture_kind kind;
+	std::vector<std::string> files;
+	bool is_srgb;
+	texture_compression compression;
+	texture_placeholder placeholder;
+	GLuint* target;
+};
+
+texture_request texture_plain(GLuint* target, const char* filename, texture_compression compression, texture_placeholder placeholder)
+{
+	return texture_request{ TEXTURE_PLAIN, { filename }, false, compression, placeholder, target };
+}
+
+texture_request texture_pbr(GLuint* target, const char* filename, bool is_srgb, texture_compression compression, texture_placeholder placeholder)
+{
+	return texture_request{ TEXTURE_PBR, { filename }, is_srgb, compression, placeholder, target };
+}
+
+texture_request texture_mipmaps(GLuint* target, const char* filename[], int n, texture_placeholder placeholder)
+{
+	return texture_request{ TEXTURE_MIPMAPS, std::vector<std::string>(filename, filename + n), false, COMPRESS_NONE, placeholder, target };
+}
+
+texture_request texture_cubemap(GLuint* target, const std::vector<std::string>& faces)
+{
+	return texture_request{ TEXTURE_CUBEMAP, faces, false, COMPRESS_NONE, PLACEHOLDER_BLACK, target };
+}
+
+// Images a request decodes, cubemap faces are stored top row first
+// Every image except hand made mip levels is baked with its whole mip chain
+std::vector<decoded_image> request_images(const texture_request& request)
+{
+	std::vector<decoded_image> images(request.files.size());
+	for (size_t i = 0; i < images.size(); i++) {
+		decoded_image& image = images[i];
+		image.filename = request.files[i];
+		image.flip = request.kind != TEXTURE_CUBEMAP;
+		image.bake = request.kind != TEXTURE_MIPMAPS;
+		image.compression = COMPRESS_TEXTURES ? request.compression : COMPRESS_NONE;
+		image.is_srgb = request.kind == TEXTURE_PBR && request.is_srgb;
+		// Colour is averaged in linear light whether or not the GL format is sRGB
+		image.mips.srgb = request.is_srgb || request.compression == COMPRESS_COLOUR || request.kind == TEXTURE_CUBEMAP;
+		// The compression mode names what the texture holds even when COMPRESS_TEXTURES stores it uncompressed
+		image.mips.normal = request.compression == COMPRESS_NORMAL;
+		image.mips.wrap = request.kind != TEXTURE_CUBEMAP;
+	}
+	return images;
+}
+
+// Baked images come from the texture cache, or are baked from the source and cached on first use
+bool decode_image_file(decoded_image* image)
+{
+	const char* filename = image->filename.c_str();
+	if (image->bake && read_texture_cache(filename, image->compression, image->is_srgb, image->mips, &image->baked)) {
+		image->width = image->baked.width;
+		image->height = image->baked.height;
+		return true;
+	}
+
+	// The thread local flag keeps decodes on other threads from flipping each other's images
+	stbi_set_flip_vertically_on_load_thread(image->flip);
+	image->pixels = stbi_load(filename, &image->width, &image->height, &image->channels, 0);
+	if (image->bake && image->pixels) {
+		bake_texture(image->pixels, image->width, image->height, image->channels, image->compression, image->is_srgb, image->mips, &image->baked);
+		// An unwritable cache only costs the bake again next run
+		if (write_texture_cache(filename, image->baked, image->mips))
+			printf("Wrote texture cache %s.\n", texture_cache_path(filename).c_str());
+		else
+			std::cerr << "Failed to write texture cache: " << texture_cache_path(filename) << std::endl;
+		stbi_image_free(image->pixels);
+		image->pixels = nullptr;
+	}
+	return image->loaded();
+}
+
+// Decode one image, safe to call from any thread
+bool decode_image(decoded_image* image)
+{
+	auto start = std::chrono::steady_clock::now();
+	bool loaded = decode_image_file(image);
+	image->decode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return loaded;
+}
+
+void free_decoded_image(decoded_image* image)
+{
+	stbi_image_free(image->pixels);
+	image->pixels = nullptr;
+	image->baked = baked_texture();
+}
+
+// Upload every level of a baked chain into the bound texture's immutable storage
+// target is GL_TEXTURE_2D or one cubemap face
+void upload_baked_levels(GLenum target, const baked_texture& texture)
+{
+	// Uncompressed rows are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int level = 0; level < texture.num_levels; level++) {
+		int width = mip_extent(texture.width, level), height = mip_extent(texture.height, level);
+		const unsigned char* data = &texture.data[baked_level_offset(texture, level)];
+		if (is_compressed_format(texture.format))
+			glCompressedTexSubImage2D(target, level, 0, 0, width, height, texture.format, (GLsizei)baked_level_size(texture.format, width, height), data);
+		else
+			glTexSubImage2D(target, level, 0, 0, width, height, baked_upload_format(texture.format), GL_UNSIGNED_BYTE, data);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// One mip level of one image, uploaded a few rows at a time
+// Rows of a block compressed level are rows of 4x4 blocks
+struct stream_slice
+{
+	const unsigned char* data;
+	GLint level;
+	// Cubemap face or array layer, zero for 2D textures
+	GLint face;
+	int width, height;
+	size_t row_bytes;
+	int rows;
+};
+
+// List levels first_level to end_level - 1 of a baked chain, as levels of a texture whose level 0 is base_level
+// layer is the cubemap face or array layer they go into
+void add_baked_slices(std::vector<stream_slice>& slices, const baked_texture& baked, int base_level, int first_level, int end_level, GLint layer)
+{
+	bool compressed = is_compressed_format(baked.format);
+	for (int level = first_level; level < end_level; level++) {
+		int width = mip_extent(baked.width, level), height = mip_extent(baked.height, level);
+		size_t row_bytes = compressed ? (size_t)((width + 3) / 4) * compressed_block_bytes(baked.format) : (size_t)width * baked_pixel_bytes(baked.format);
+		slices.push_back(stream_slice{ &baked.data[baked_level_offset(baked, level)], level - base_level, layer, width, height, row_bytes, compressed ? (height + 3) / 4 : height });
+	}
+}
+
+// Copy data into the pixel unpack buffer, orphaning the last copy so the driver never waits on it
+void fill_unpack_buffer(GLuint pbo, const unsigned char* data, size_t bytes)
+{
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped) {
+		memcpy(mapped, data, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+}
+
+// Upload up to budget bytes of a slice from offset on through pbo, returns the bytes used
+// At least one row is always uploaded so a row bigger than the budget still makes progress
+// format is the texture's, upload_format the client format of uncompressed rows
+// Cubemap faces and array layers are layered, uploaded as slices of a 3D image
+size_t upload_slice_rows(GLuint pbo, GLuint texture, bool layered, GLenum format, GLenum upload_format, const stream_slice& slice, size_t offset, size_t budget)
+{
+	int row = (int)(offset / slice.row_bytes);
+	int rows = (int)std::min((size_t)(slice.rows - row), std::max((size_t)1, budget / slice.row_bytes));
+	size_t bytes = rows * slice.row_bytes;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	fill_unpack_buffer(pbo, slice.data + offset, bytes);
+	if (is_compressed_format(format)) {
+		// Only the last row of blocks may run past the level's height
+		int y = row * 4;
+		int height = std::min(rows * 4, slice.height - y);
+		if (layered)
+			glCompressedTextureSubImage3D(texture, slice.level, 0, y, slice.face, slice.width, height, 1, format, (GLsizei)bytes, (void*)0);
+		else
+			glCompressedTextureSubImage2D(texture, slice.level, 0, y, slice.width, height, format, (GLsizei)bytes, (void*)0);
+	}
+	else {
+		// Rows are tightly packed
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		if (layered)
+			glTextureSubImage3D(texture, slice.level, 0, row, slice.face, slice.width, rows, 1, upload_format, GL_UNSIGNED_BYTE, (void*)0);
+		else
+			glTextureSubImage2D(texture, slice.level, 0, row, slice.width, rows, upload_format, GL_UNSIGNED_BYTE, (void*)0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return bytes;
+}
+
+// Wrapping and filtering of a streamed 2D texture with num_levels levels
+// Textures the level streamer manages always filter between levels, GL_TEXTURE_MIN_LOD fades in new detail only through the mipmap filter
+void set_texture_sampling(GLuint texture, texture_kind kind, int num_levels, bool streamed_levels = false)
+{
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// setup_texture has mipmaps but only samples the top level
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, kind == TEXTURE_PLAIN && !streamed_levels ? GL_LINEAR : GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(texture, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+}
+
+// Number of leading levels that form a proper chain, each half the size of the one before with the same channels
+int valid_mip_levels(const std::vector<decoded_image>& levels)
+{
+	if (levels.empty() || !levels[0].pixels)
+		return 0;
+	const decoded_image& top = levels[0];
+	int max_levels = full_mip_count(top.width, top.height);
+	for (size_t c = 1; c < levels.size(); c++) {
+		if ((int)c >= max_levels) {
+			std::cerr << "Mipmap texture has more levels than " << top.width << "x" << top.height << " allows, ignoring " << levels[c].filename << " onwards." << std::endl;
+			return (int)c;
+		}
+		int width = mip_extent(top.width, (int)c), height = mip_extent(top.height, (int)c);
+		if (!levels[c].pixels || levels[c].width != width || levels[c].height != height || levels[c].channels != top.channels) {
+			std::cerr << "Mipmap level " << c << " " << levels[c].filename << " is not a " << width << "x" << height << " image like "
+				<< top.filename << ", the chain stops at level " << c - 1 << "." << std::endl;
+			return (int)c;
+		}
+	}
+	return (int)levels.size();
+}
+
+// Decode a batch of images across the pool, or one after another on this thread when pool is null
+void decode_images(const std::vector<decoded_image*>& images, thread_pool* pool)
+{
+	auto decode_range = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			decode_image(images[i]);
+		}
+	};
+	if (pool)
+		pool->parallel_for(images.size(), 1, decode_range);
+	else
+		decode_range(0, images.size());
+}
+
+GLuint upload_texture(const decoded_image& image)
 {
 	// Enable textures
 	glEnable(GL_TEXTURE_2D);
@@ -34,43 +316,26 @@ GLuint setup_texture(const char* filename)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-	int w, h, chan;
-	// Load image at filename, x pixels wide and y pixels high
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char* pxls = stbi_load(filename, &w, &h, &chan, 0);
-
-	// Check pxls colour data ia loaded correctly
-	if (pxls) {
-		// Decide which image format to use.
-		GLenum format;
-		if (chan == 1) format = GL_RED;
-		else if (chan == 3) format = GL_RGB;
-		else if (chan == 4) format = GL_RGBA;
-		else {
-			std::cerr << "Unsupported number of channels in texture: " << filename << std::endl;
-			stbi_image_free(pxls);
-			glDisable(GL_TEXTURE_2D);
-			glDisable(GL_BLEND);
-			return 0; 
-		}
-
-		glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, pxls);
-		// Free the image data after uploading
-		stbi_image_free(pxls); 
+	// Check the baked chain loaded correctly, it already carries every mip level
+	if (image.baked.num_levels > 0) {
+		glTexStorage2D(GL_TEXTURE_2D, image.baked.num_levels, image.baked.format, image.width, image.height);
+		upload_baked_levels(GL_TEXTURE_2D, image.baked);
 	}
 	else {
-		std::cerr << "Failed to load texture: " << filename << std::endl;
+		std::cerr << "Failed to load texture: " << image.filename << std::endl;
 	}
-	glGenerateMipmap(GL_TEXTURE_2D);
-	
-	printf("Successfully loaded texture %s.\n", filename);
+
+	printf("Successfully loaded texture %s.\n", image.filename.c_str());
+	if (image.baked.num_levels > 0)
+		print_baked_texture(image.baked);
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_BLEND);
 
 	return texObject;
 }
 
-GLuint setup_texture_pbr(const char* filename, bool is_srgb)
+// The image was baked in an sRGB format if its request asked for one
+GLuint upload_texture_pbr(const decoded_image& image)
 {
 	// Enable textures
 	glEnable(GL_TEXTURE_2D);
@@ -87,52 +352,22 @@ GLuint setup_texture_pbr(const char* filename, bool is_srgb)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
-	int w, h, chan;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char* pxls = stbi_load(filename, &w, &h, &chan, 0);
-
-	if (pxls) {
-		// Decide which image format to use.
-		GLenum format;
-		GLenum internalFormat;
-
-		if (chan == 1) {
-			format = GL_RED;
-			internalFormat = GL_R8;
-		}
-		else if (chan == 3) {
-			format = GL_RGB;
-			// Use sRGB for color textures 
-			internalFormat = is_srgb ? GL_SRGB8 : GL_RGB8;
-		}
-		else if (chan == 4) {
-			format = GL_RGBA;
-			internalFormat = is_srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
-		}
-		else {
-			std::cerr << "Unsupported number of channels in texture: " << filename << std::endl;
-			stbi_image_free(pxls);
-			glDisable(GL_TEXTURE_2D);
-			glDisable(GL_BLEND);
-			return 0;
-		}
-
-		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, GL_UNSIGNED_BYTE, pxls);
-		stbi_image_free(pxls);
-
-		// Generate mipmaps for better quality
-		glGenerateMipmap(GL_TEXTURE_2D);
+	if (image.baked.num_levels > 0) {
+		glTexStorage2D(GL_TEXTURE_2D, image.baked.num_levels, image.baked.format, image.width, image.height);
+		upload_baked_levels(GL_TEXTURE_2D, image.baked);
 	}
 	else {
-		std::cerr << "Failed to load texture: " << filename << std::endl;
+		std::cerr << "Failed to load texture: " << image.filename << std::endl;
 	}
-	printf("Successfully loaded PBR texture %s.\n", filename);
+	printf("Successfully loaded PBR texture %s.\n", image.filename.c_str());
+	if (image.baked.num_levels > 0)
+		print_baked_texture(image.baked);
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_BLEND);
 	return texObject;
 }
 
-GLuint setup_mipmaps(const char* filename[], int n)
+GLuint upload_mipmaps(const std::vector<decoded_image>& levels)
 {
 	// Enable textures
 	glEnable(GL_TEXTURE_2D);
@@ -147,59 +382,56 @@ GLuint setup_mipmaps(const char* filename[], int n)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
-	int w[16], h[16], chan[16];
-	unsigned char* pxls[16];
-	// Load image at filename, x pixels wide and y pixels high
-	stbi_set_flip_vertically_on_load(true);
-	for (int c = 0; c < n; c++) {
-		pxls[c] = stbi_load(filename[c], &w[c], &h[c], &chan[c], 0);
-		if (pxls[c]) {
-			GLenum format = (chan[c] == 4) ? GL_RGBA : GL_RGB;
-			glTexImage2D(GL_TEXTURE_2D, c, format, w[c], h[c], 0, format, GL_UNSIGNED_BYTE, pxls[c]);
+	// Only the levels forming a proper chain are kept, the texture stays complete with fewer levels
+	int num_levels = valid_mip_levels(levels);
+	if (num_levels > 0) {
+		const decoded_image& top = levels[0];
+		GLenum format = (top.channels == 4) ? GL_RGBA : GL_RGB;
+		glTexStorage2D(GL_TEXTURE_2D, num_levels, top.channels == 4 ? GL_RGBA8 : GL_RGB8, top.width, top.height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+		// BMP rows are tightly packed once decoded
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int c = 0; c < num_levels; c++) {
+			glTexSubImage2D(GL_TEXTURE_2D, c, 0, 0, levels[c].width, levels[c].height, format, GL_UNSIGNED_BYTE, levels[c].pixels);
 		}
-
-		stbi_image_free(pxls[c]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	else {
+		std::cerr << "Failed to load texture: " << levels.front().filename << std::endl;
 	}
 
 	// Check pxls colour data ia loaded correctly
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_BLEND);
-	printf("Successfully loaded mipmap texture %s to %s.\n", filename[0], filename[n-1]);
+	printf("Successfully loaded mipmap texture %s to %s.\n", levels.front().filename.c_str(), levels.back().filename.c_str());
 	return texObject;
 }
 
-GLuint setup_cubemap(std::vector<std::string> faces)
+GLuint upload_cubemap(const std::vector<decoded_image>& faces)
 {
-	// Set up a texture with a cubemap
-	if (faces.size() != 6) {
-		std::cerr << "Error: Cubemap requires exactly 6 faces." << std::endl;
-		return 0;
-	}
-
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-	int width, height, nrChannels;
+	// Every face shares the storage of the first one that loaded
+	const baked_texture* first = nullptr;
+	for (const decoded_image& face : faces) {
+		if (!first && face.baked.num_levels > 0)
+			first = &face.baked;
+	}
+	if (first)
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, first->num_levels, first->format, first->width, first->height);
+
 	for (unsigned int i = 0; i < faces.size(); i++)
 	{
-		unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
+		const baked_texture& face = faces[i].baked;
+		if (face.num_levels > 0 && face.format == first->format && face.width == first->width && face.height == first->height)
 		{
-			GLenum format = GL_RGB;
-			if (nrChannels == 1)
-				format = GL_RED;
-			else if (nrChannels == 4)
-				format = GL_RGBA;
-
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-				0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
+			upload_baked_levels(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, face);
 		}
 		else
 		{
-			std::cerr << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
+			std::cerr << "Cubemap tex failed to load at path: " << faces[i].filename << std::endl;
 		}
 	}
 
@@ -210,10 +442,175 @@ GLuint setup_cubemap(std::vector<std::string> faces)
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	// Generate mipmaps for the cubemap texture
-	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
 	printf("Successfully applied cubemap.\n");
 
 	return textureID;
 }
+
+// Upload a decoded request the same way its setup_ function does
+GLuint upload_texture_request(const texture_request& request, const std::vector<decoded_image>& images)
+{
+	switch (request.kind) {
+	case TEXTURE_PLAIN:
+		return upload_texture(images[0]);
+	case TEXTURE_PBR:
+		return upload_texture_pbr(images[0]);
+	case TEXTURE_MIPMAPS:
+		return upload_mipmaps(images);
+	default:
+		if (images.size() != 6) {
+			std::cerr << "Error: Cubemap requires exactly 6 faces." << std::endl;
+			return 0;
+		}
+		return upload_cubemap(images);
+	}
+}
+
+// Key of everything that decides a request's texture object, zero if a file cannot be read
+uint64_t texture_request_key(const texture_request& request)
+{
+	texture_compression compression = COMPRESS_TEXTURES ? request.compression : COMPRESS_NONE;
+	// Normal maps are mipped differently, also when they are stored uncompressed
+	uint32_t options = (uint32_t)request.kind | (request.compression == COMPRESS_NORMAL ? 0x8 : 0) | (request.is_srgb ? 0x10 : 0) | ((uint32_t)compression << 5);
+	return texture_registry_key(request.files, options);
+}
+
+// Video memory of an uploaded request, baked images include their mip chains
+size_t texture_gpu_bytes(const texture_request& request, const std::vector<decoded_image>& images)
+{
+	size_t bytes = 0;
+	for (const decoded_image& image : images) {
+		if (image.baked.num_levels > 0)
+			bytes += image.baked.data.size();
+		else
+			bytes += (size_t)image.width * image.height * image.channels;
+	}
+	return bytes;
+}
+
+double texture_decode_seconds(const std::vector<decoded_image>& images)
+{
+	double seconds = 0;
+	for (const decoded_image& image : images) {
+		seconds += image.decode_seconds;
+	}
+	return seconds;
+}
+
+// Load a batch of textures, decoding every file across the pool and then uploading on this (the GL) thread
+// A null pool decodes one file after another, like calling the setup_ functions in turn
+// Requests matching an already loaded texture by path or contents share it through the texture registry, unless share is false
+void load_textures(const std::vector<texture_request>& requests, thread_pool* pool = &worker_pool(), bool share = true)
+{
+	// Hashing reads every file, so it is spread over the pool like the decode
+	std::vector<uint64_t> keys(requests.size(), 0);
+	if (share) {
+		auto key_range = [&](size_t begin, size_t end) {
+			for (size_t r = begin; r < end; r++) {
+				keys[r] = texture_request_key(requests[r]);
+			}
+		};
+		if (pool)
+			pool->parallel_for(requests.size(), 1, key_range);
+		else
+			key_range(0, requests.size());
+	}
+
+	std::vector<bool> owned(requests.size(), true);
+	std::vector<std::vector<decoded_image>> images(requests.size());
+	std::vector<decoded_image*> all_images;
+	for (size_t r = 0; r < requests.size(); r++) {
+		if (share)
+			owned[r] = claim_texture(keys[r], requests[r].files[0]);
+		if (!owned[r])
+			continue;
+		images[r] = request_images(requests[r]);
+		for (decoded_image& image : images[r]) {
+			all_images.push_back(&image);
+		}
+	}
+
+	decode_images(all_images, pool);
+
+	for (size_t r = 0; r < requests.size(); r++) {
+		if (!owned[r])
+			continue;
+		*requests[r].target = upload_texture_request(requests[r], images[r]);
+		if (share) {
+			// Failed loads are not shared, a later request tries the files again
+			bool loaded = std::all_of(images[r].begin(), images[r].end(), [](const decoded_image& image) { return image.loaded(); });
+			register_texture(keys[r], loaded ? *requests[r].target : 0, texture_gpu_bytes(requests[r], images[r]), texture_decode_seconds(images[r]));
+		}
+	}
+	for (size_t r = 0; r < requests.size(); r++) {
+		if (!owned[r])
+			resolve_texture(keys[r], requests[r].target);
+	}
+	for (decoded_image* image : all_images) {
+		free_decoded_image(image);
+	}
+}
+
+GLuint setup_texture(const char* filename)
+{
+	GLuint texObject = 0;
+	load_textures({ texture_plain(&texObject, filename, COMPRESS_NONE, PLACEHOLDER_GREY) }, nullptr);
+	return texObject;
+}
+
+GLuint setup_texture_pbr(const char* filename, bool is_srgb)
+{
+	GLuint texObject = 0;
+	load_textures({ texture_pbr(&texObject, filename, is_srgb, COMPRESS_NONE, PLACEHOLDER_GREY) }, nullptr);
+	return texObject;
+}
+
+GLuint setup_mipmaps(const char* filename[], int n)
+{
+	GLuint texObject = 0;
+	load_textures({ texture_mipmaps(&texObject, filename, n, PLACEHOLDER_GREY) }, nullptr);
+	return texObject;
+}
+
+GLuint setup_cubemap(std::vector<std::string> faces)
+{
+	// Set up a texture with a cubemap
+	if (faces.size() != 6) {
+		std::cerr << "Error: Cubemap requires exactly 6 faces." << std::endl;
+		return 0;
+	}
+	GLuint textureID = 0;
+	load_textures({ texture_cubemap(&textureID, faces) }, nullptr);
+	return textureID;
+}
+
+// Time loading the same textures serially and across the pool
+// The textures are created into scratch handles and deleted again, the requests' targets are left alone
+void benchmark_texture_loading(const std::vector<texture_request>& requests)
+{
+	std::vector<GLuint> scratch(requests.size());
+	std::vector<texture_request> batch = requests;
+	for (size_t r = 0; r < batch.size(); r++) {
+		batch[r].target = &scratch[r];
+	}
+
+	size_t num_files = 0;
+	for (const texture_request& request : requests) {
+		num_files += request.files.size();
+	}
+
+	double seconds[2];
+	for (int parallel = 0; parallel < 2; parallel++) {
+		glFinish();
+		auto start = std::chrono::steady_clock::now();
+		// Skip the registry so both runs really load every texture
+		load_textures(batch, parallel ? &worker_pool() : nullptr, false);
+		glFinish();
+		seconds[parallel] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		glDeleteTextures((GLsizei)scratch.size(), scratch.data());
+	}
+
+	printf("Texture benchmark: %zu textures from %zu files\n", requests.size(), num_files);
+	printf("  serial:   %8.1f ms\n", seconds[0] * 1000.0);
+	printf("  %u threads: %8.1f ms  (%.1fx)\n", worker_pool().size(), seconds[1] * 1000.0, seconds[0] / seconds[1]);
+}
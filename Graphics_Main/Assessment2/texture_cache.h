@@ -0,0 +1,325 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+#include "file.h"
+#include "mip_generator.h"
+#include "texture_compress.h"
+
+// Baked texture cache written next to each image as <name>.dds
+// Holds the complete mip chain, block compressed or as plain 8 bit channels, ready for glTexSubImage2D
+// The DDS files use the DX10 extended header, the source stamp lives in the reserved words
+#define TEXTURE_CACHE_MAGIC 0x43584554
+// Bump whenever the encoders or mip filter change so old caches are rebuilt
+#define TEXTURE_CACHE_VERSION 2
+// Set to 0 to bake every texture uncompressed
+#define COMPRESS_TEXTURES 1
+
+#define DDS_MAGIC 0x20534444
+#define DDS_FOURCC_DX10 0x30315844
+#define DXGI_FORMAT_R8G8B8A8_UNORM 28
+#define DXGI_FORMAT_R8G8B8A8_UNORM_SRGB 29
+#define DXGI_FORMAT_R8G8_UNORM 49
+#define DXGI_FORMAT_R8_UNORM 61
+#define DXGI_FORMAT_BC4_UNORM 80
+#define DXGI_FORMAT_BC5_UNORM 83
+#define DXGI_FORMAT_BC7_UNORM 98
+#define DXGI_FORMAT_BC7_UNORM_SRGB 99
+
+// Complete mip chain of one image in its GPU format, levels are stored largest first
+struct baked_texture
+{
+	GLenum format = 0;
+	int width = 0, height = 0;
+	int num_levels = 0;
+	std::vector<unsigned char> data;
+};
+
+struct dds_pixel_format
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourcc;
+	uint32_t rgb_bit_count;
+	uint32_t masks[4];
+};
+
+struct dds_header
+{
+	uint32_t magic;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitch_or_linear_size;
+	uint32_t depth;
+	uint32_t mip_count;
+	// Unused by DDS readers, holds the cache tag, version, mip options and source stamp
+	uint32_t reserved[11];
+	dds_pixel_format pixel_format;
+	uint32_t caps[4];
+	uint32_t reserved2;
+	// DX10 extension
+	uint32_t dxgi_format;
+	uint32_t dimension;
+	uint32_t misc_flags;
+	uint32_t array_size;
+	uint32_t misc_flags2;
+};
+
+bool is_compressed_format(GLenum format)
+{
+	return format == GL_COMPRESSED_RGBA_BPTC_UNORM || format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+		|| format == GL_COMPRESSED_RG_RGTC2 || format == GL_COMPRESSED_RED_RGTC1;
+}
+
+// Uncompressed storage of a source image, three channel images are padded to RGBA like most drivers do anyway
+GLenum uncompressed_texture_format(int channels, bool is_srgb)
+{
+	if (channels == 1)
+		return GL_R8;
+	if (channels == 2)
+		return GL_RG8;
+	return is_srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+}
+
+int baked_pixel_bytes(GLenum format)
+{
+	switch (format) {
+	case GL_R8:
+		return 1;
+	case GL_RG8:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+// Client format glTexSubImage2D takes the uncompressed levels in
+GLenum baked_upload_format(GLenum format)
+{
+	switch (format) {
+	case GL_R8:
+		return GL_RED;
+	case GL_RG8:
+		return GL_RG;
+	default:
+		return GL_RGBA;
+	}
+}
+
+const char* baked_format_name(GLenum format)
+{
+	switch (format) {
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		return "BC7";
+	case GL_COMPRESSED_RG_RGTC2:
+		return "BC5";
+	case GL_COMPRESSED_RED_RGTC1:
+		return "BC4";
+	case GL_R8:
+		return "R8";
+	case GL_RG8:
+		return "RG8";
+	default:
+		return "RGBA8";
+	}
+}
+
+// Bytes of one level, compressed levels are whole 4x4 blocks
+size_t baked_level_size(GLenum format, int width, int height)
+{
+	if (is_compressed_format(format))
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * compressed_block_bytes(format);
+	return (size_t)width * height * baked_pixel_bytes(format);
+}
+
+size_t baked_level_offset(const baked_texture& texture, int level)
+{
+	size_t offset = 0;
+	for (int i = 0; i < level; i++) {
+		offset += baked_level_size(texture.format, mip_extent(texture.width, i), mip_extent(texture.height, i));
+	}
+	return offset;
+}
+
+// Build the full mip chain of an image and store every level in the GPU format
+void bake_texture(const unsigned char* pixels, int width, int height, int channels, texture_compression compression, bool is_srgb,
+	const mip_options& options, baked_texture* out)
+{
+	out->format = compression != COMPRESS_NONE ? compressed_texture_format(compression, is_srgb) : uncompressed_texture_format(channels, is_srgb);
+	out->width = width;
+	out->height = height;
+	out->num_levels = full_mip_count(width, height);
+	out->data.resize(baked_level_offset(*out, out->num_levels));
+
+	generate_mips(pixels, width, height, channels, options, [&](int level, const std::vector<unsigned char>& rgba, int level_width, int level_height) {
+		unsigned char* dst = &out->data[baked_level_offset(*out, level)];
+		if (compression != COMPRESS_NONE) {
+			encode_compressed_level(rgba, level_width, level_height, out->format, dst);
+			return;
+		}
+		int bytes = baked_pixel_bytes(out->format);
+		size_t count = (size_t)level_width * level_height;
+		for (size_t i = 0; i < count; i++) {
+			// Grey and grey alpha images were spread over RGB, take them back from red and alpha
+			dst[i * bytes] = rgba[i * 4];
+			if (bytes == 2)
+				dst[i * 2 + 1] = rgba[i * 4 + 3];
+			else if (bytes == 4)
+				memcpy(&dst[i * 4], &rgba[i * 4], 4);
+		}
+	});
+}
+
+// Size against the same chain as RGBA8
+void print_baked_texture(const baked_texture& texture)
+{
+	double mb = texture.data.size() / (1024.0 * 1024.0);
+	double rgba_mb = baked_level_offset(baked_texture{ GL_RGBA8, texture.width, texture.height, texture.num_levels }, texture.num_levels) / (1024.0 * 1024.0);
+	printf("  %s %dx%d, %d levels, %.1f MB (%.1f MB as RGBA8).\n", baked_format_name(texture.format), texture.width, texture.height,
+		texture.num_levels, mb, rgba_mb);
+}
+
+std::string texture_cache_path(const char* filename)
+{
+	return std::string(filename) + ".dds";
+}
+
+uint32_t dxgi_format(GLenum format)
+{
+	switch (format) {
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+		return DXGI_FORMAT_BC7_UNORM;
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		return DXGI_FORMAT_BC7_UNORM_SRGB;
+	case GL_COMPRESSED_RG_RGTC2:
+		return DXGI_FORMAT_BC5_UNORM;
+	case GL_COMPRESSED_RED_RGTC1:
+		return DXGI_FORMAT_BC4_UNORM;
+	case GL_R8:
+		return DXGI_FORMAT_R8_UNORM;
+	case GL_RG8:
+		return DXGI_FORMAT_R8G8_UNORM;
+	case GL_SRGB8_ALPHA8:
+		return DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+	default:
+		return DXGI_FORMAT_R8G8B8A8_UNORM;
+	}
+}
+
+// Whether a cached format is what a load with these options would bake, the channel count is only known after decoding
+bool baked_format_matches(GLenum format, texture_compression compression, bool is_srgb)
+{
+	if (compression != COMPRESS_NONE)
+		return format == compressed_texture_format(compression, is_srgb);
+	return format == GL_R8 || format == GL_RG8 || format == uncompressed_texture_format(4, is_srgb);
+}
+
+bool write_texture_cache(const char* filename, const baked_texture& texture, const mip_options& options)
+{
+	int64_t mtime;
+	uint64_t size;
+	if (!get_file_stamp(filename, &mtime, &size))
+		return false;
+
+	bool compressed = is_compressed_format(texture.format);
+	dds_header header = {};
+	header.magic = DDS_MAGIC;
+	header.size = 124;
+	// Caps, height, width, pixel format, mip count and linear size or pitch
+	header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | (compressed ? 0x80000 : 0x8);
+	header.height = texture.height;
+	header.width = texture.width;
+	header.pitch_or_linear_size = compressed ? (uint32_t)baked_level_size(texture.format, texture.width, texture.height) : texture.width * baked_pixel_bytes(texture.format);
+	header.mip_count = texture.num_levels;
+	header.reserved[0] = TEXTURE_CACHE_MAGIC;
+	header.reserved[1] = TEXTURE_CACHE_VERSION;
+	header.reserved[2] = mip_options_bits(options);
+	memcpy(&header.reserved[3], &mtime, sizeof(mtime));
+	memcpy(&header.reserved[5], &size, sizeof(size));
+	header.pixel_format.size = sizeof(dds_pixel_format);
+	header.pixel_format.flags = 0x4;
+	header.pixel_format.fourcc = DDS_FOURCC_DX10;
+	// Texture, mipmap and complex
+	header.caps[0] = 0x1000 | 0x400000 | 0x8;
+	header.dxgi_format = dxgi_format(texture.format);
+	// Texture 2D
+	header.dimension = 3;
+	header.array_size = 1;
+
+	// Write to a temporary file first so a crash never leaves a half written cache
+	std::string cache_path = texture_cache_path(filename);
+	std::string temp_path = cache_path + ".tmp";
+	FILE* f;
+	fopen_s(&f, temp_path.c_str(), "wb");
+	if (f == NULL)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(texture.data.data(), 1, texture.data.size(), f) == texture.data.size();
+	fclose(f);
+
+	if (!ok) {
+		remove(temp_path.c_str());
+		return false;
+	}
+	remove(cache_path.c_str());
+	return rename(temp_path.c_str(), cache_path.c_str()) == 0;
+}
+
+// Load the cached chain if it was baked from this source with the wanted format and mip options
+// A cache without its source image is used as is, so the source can be left out of a build
+bool read_texture_cache(const char* filename, texture_compression compression, bool is_srgb, const mip_options& options, baked_texture* out)
+{
+	mapped_file map;
+	if (!map_file(texture_cache_path(filename).c_str(), &map))
+		return false;
+
+	static const GLenum formats[] = {
+		GL_COMPRESSED_RGBA_BPTC_UNORM, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, GL_COMPRESSED_RG_RGTC2, GL_COMPRESSED_RED_RGTC1,
+		GL_R8, GL_RG8, GL_RGBA8, GL_SRGB8_ALPHA8,
+	};
+	GLenum format = 0;
+	bool ok = map.size >= sizeof(dds_header);
+	const dds_header* header = (const dds_header*)map.data;
+	ok = ok && header->magic == DDS_MAGIC && header->pixel_format.fourcc == DDS_FOURCC_DX10;
+	ok = ok && header->reserved[0] == TEXTURE_CACHE_MAGIC && header->reserved[1] == TEXTURE_CACHE_VERSION;
+	ok = ok && header->reserved[2] == mip_options_bits(options);
+	if (ok) {
+		for (GLenum candidate : formats) {
+			if (dxgi_format(candidate) == header->dxgi_format)
+				format = candidate;
+		}
+	}
+	ok = ok && baked_format_matches(format, compression, is_srgb);
+	ok = ok && header->width > 0 && header->height > 0 && header->mip_count == (uint32_t)full_mip_count(header->width, header->height);
+
+	int64_t mtime;
+	uint64_t size;
+	if (ok && get_file_stamp(filename, &mtime, &size)) {
+		ok = memcmp(&header->reserved[3], &mtime, sizeof(mtime)) == 0 && memcmp(&header->reserved[5], &size, sizeof(size)) == 0;
+	}
+
+	if (ok) {
+		out->format = format;
+		out->width = header->width;
+		out->height = header->height;
+		out->num_levels = header->mip_count;
+		size_t bytes = baked_level_offset(*out, out->num_levels);
+		ok = map.size >= sizeof(dds_header) + bytes;
+		if (ok)
+			out->data.assign(map.data + sizeof(dds_header), map.data + sizeof(dds_header) + bytes);
+		else
+			*out = baked_texture();
+	}
+	unmap_file(&map);
+	return ok;
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+// BC4, BC5 and BC7 block encoders for baked textures, see texture_cache.h
+
+// How a texture is stored on the GPU, chosen by what the shader reads from it
+enum texture_compression
+{
+	// Uncompressed source pixels
+	COMPRESS_NONE,
+	// BC7, RGBA colour such as albedo and glow maps
+	COMPRESS_COLOUR,
+	// BC5, tangent space normal maps, the shader rebuilds z from x and y
+	COMPRESS_NORMAL,
+	// BC4, single channel maps read from .r such as roughness, metallic, AO and depth
+	COMPRESS_MASK,
+	// BC7 without sRGB, RGBA data such as packed material masks
+	COMPRESS_DATA
+};
+
+GLenum compressed_texture_format(texture_compression compression, bool is_srgb)
+{
+	switch (compression) {
+	case COMPRESS_COLOUR:
+		return is_srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+	case COMPRESS_NORMAL:
+		return GL_COMPRESSED_RG_RGTC2;
+	case COMPRESS_MASK:
+		return GL_COMPRESSED_RED_RGTC1;
+	case COMPRESS_DATA:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default:
+		return 0;
+	}
+}
+
+// Bytes in one 4x4 block
+int compressed_block_bytes(GLenum format)
+{
+	return format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+}
+
+// Gather the 4x4 block at (bx, by), blocks over the edge repeat the last row or column
+void fetch_block(const std::vector<unsigned char>& rgba, int width, int height, int bx, int by, unsigned char block[64])
+{
+	for (int y = 0; y < 4; y++) {
+		int sy = std::min(by * 4 + y, height - 1);
+		for (int x = 0; x < 4; x++) {
+			int sx = std::min(bx * 4 + x, width - 1);
+			memcpy(&block[(y * 4 + x) * 4], &rgba[((size_t)sy * width + sx) * 4], 4);
+		}
+	}
+}
+
+// BC4 block of one channel, taken from every 4th byte of values
+void encode_bc4_block(const unsigned char* values, unsigned char out[8])
+{
+	int lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++) {
+		lo = std::min(lo, (int)values[i * 4]);
+		hi = std::max(hi, (int)values[i * 4]);
+	}
+
+	// Eight value mode, endpoint 0 is the larger so codes 2 to 7 step from it towards endpoint 1
+	out[0] = (unsigned char)hi;
+	out[1] = (unsigned char)lo;
+	uint64_t bits = 0;
+	if (hi > lo) {
+		for (int i = 0; i < 16; i++) {
+			int step = ((values[i * 4] - lo) * 7 * 2 + (hi - lo)) / ((hi - lo) * 2);
+			uint64_t code = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+			bits |= code << (i * 3);
+		}
+	}
+	for (int i = 0; i < 6; i++) {
+		out[2 + i] = (unsigned char)(bits >> (i * 8));
+	}
+}
+
+// Little endian bit writer for BC7 blocks
+struct block_bits
+{
+	unsigned char* out;
+	int position;
+
+	void write(uint32_t value, int count)
+	{
+		for (int i = 0; i < count; i++, position++) {
+			if (value & (1u << i))
+				out[position / 8] |= (unsigned char)(1 << (position % 8));
+		}
+	}
+};
+
+static const int bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Endpoints of a BC7 mode 6 block, 7 bits per channel plus one shared p-bit per endpoint
+struct bc7_mode6_endpoints
+{
+	int colour[2][4];
+	int pbit[2];
+};
+
+// Quantize float endpoints with the given p-bits, pick each pixel's index and return the squared error
+int bc7_mode6_fit(const unsigned char block[64], const float ends[2][4], int p0, int p1, bc7_mode6_endpoints* out, int indices[16])
+{
+	int e[2][4];
+	out->pbit[0] = p0;
+	out->pbit[1] = p1;
+	for (int s = 0; s < 2; s++) {
+		int p = s == 0 ? p0 : p1;
+		for (int c = 0; c < 4; c++) {
+			int q = (int)floorf((ends[s][c] - p) * 0.5f + 0.5f);
+			q = std::min(127, std::max(0, q));
+			out->colour[s][c] = q;
+			e[s][c] = (q << 1) | p;
+		}
+	}
+
+	int palette[16][4];
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			palette[i][c] = ((64 - bc7_weights4[i]) * e[0][c] + bc7_weights4[i] * e[1][c] + 32) >> 6;
+		}
+	}
+
+	// Project onto the endpoint line for a first guess, then check the neighbouring indices
+	int axis[4], axis_length = 0;
+	for (int c = 0; c < 4; c++) {
+		axis[c] = e[1][c] - e[0][c];
+		axis_length += axis[c] * axis[c];
+	}
+	int error = 0;
+	for (int i = 0; i < 16; i++) {
+		const unsigned char* px = &block[i * 4];
+		int guess = 0;
+		if (axis_length > 0) {
+			int dot = 0;
+			for (int c = 0; c < 4; c++) {
+				dot += (px[c] - e[0][c]) * axis[c];
+			}
+			guess = std::min(15, std::max(0, (int)floorf(dot * 15.0f / axis_length + 0.5f)));
+		}
+		int best = -1, best_error = 0;
+		for (int index = std::max(0, guess - 1); index <= std::min(15, guess + 1); index++) {
+			int d = 0;
+			for (int c = 0; c < 4; c++) {
+				int diff = px[c] - palette[index][c];
+				d += diff * diff;
+			}
+			if (best < 0 || d < best_error) {
+				best = index;
+				best_error = d;
+			}
+		}
+		indices[i] = best;
+		error += best_error;
+	}
+	return error;
+}
+
+// Best p-bit pair for a pair of float endpoints
+int bc7_mode6_fit_best(const unsigned char block[64], const float ends[2][4], bc7_mode6_endpoints* out, int indices[16])
+{
+	int best_error = -1;
+	for (int p = 0; p < 4; p++) {
+		bc7_mode6_endpoints candidate;
+		int candidate_indices[16];
+		int error = bc7_mode6_fit(block, ends, p & 1, p >> 1, &candidate, candidate_indices);
+		if (best_error < 0 || error < best_error) {
+			best_error = error;
+			*out = candidate;
+			memcpy(indices, candidate_indices, sizeof(candidate_indices));
+		}
+	}
+	return best_error;
+}
+
+// BC7 block using mode 6 only: one subset, RGBA endpoints and 4 bit indices
+// Endpoints start along the principal axis of the block and are refined once by least squares
+void encode_bc7_block(const unsigned char block[64], unsigned char out[16])
+{
+	float mean[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			mean[c] += block[i * 4 + c] / 16.0f;
+		}
+	}
+	float cov[4][4] = {};
+	for (int i = 0; i < 16; i++) {
+		float d[4];
+		for (int c = 0; c < 4; c++) {
+			d[c] = block[i * 4 + c] - mean[c];
+		}
+		for (int a = 0; a < 4; a++) {
+			for (int b = 0; b < 4; b++) {
+				cov[a][b] += d[a] * d[b];
+			}
+		}
+	}
+
+	// Power iteration for the principal axis
+	float axis[4] = { 1, 1, 1, 1 };
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = { 0, 0, 0, 0 };
+		float length = 0;
+		for (int a = 0; a < 4; a++) {
+			for (int b = 0; b < 4; b++) {
+				next[a] += cov[a][b] * axis[b];
+			}
+			length = std::max(length, fabsf(next[a]));
+		}
+		if (length < 1e-6f)
+			break;
+		for (int a = 0; a < 4; a++) {
+			axis[a] = next[a] / length;
+		}
+	}
+
+	float t_min = 0, t_max = 0;
+	float axis_length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3];
+	for (int i = 0; i < 16; i++) {
+		float t = 0;
+		for (int c = 0; c < 4; c++) {
+			t += (block[i * 4 + c] - mean[c]) * axis[c];
+		}
+		t /= axis_length;
+		t_min = std::min(t_min, t);
+		t_max = std::max(t_max, t);
+	}
+	float ends[2][4];
+	for (int c = 0; c < 4; c++) {
+		ends[0][c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * t_min));
+		ends[1][c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * t_max));
+	}
+
+	bc7_mode6_endpoints best;
+	int indices[16];
+	int error = bc7_mode6_fit_best(block, ends, &best, indices);
+
+	// Refit the endpoints to the chosen indices
+	float aa = 0, ab = 0, bb = 0, xa[4] = { 0, 0, 0, 0 }, xb[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		float w = bc7_weights4[indices[i]] / 64.0f;
+		aa += (1 - w) * (1 - w);
+		ab += (1 - w) * w;
+		bb += w * w;
+		for (int c = 0; c < 4; c++) {
+			xa[c] += (1 - w) * block[i * 4 + c];
+			xb[c] += w * block[i * 4 + c];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (error > 0 && fabsf(det) > 1e-6f) {
+		float refit[2][4];
+		for (int c = 0; c < 4; c++) {
+			refit[0][c] = std::min(255.0f, std::max(0.0f, (bb * xa[c] - ab * xb[c]) / det));
+			refit[1][c] = std::min(255.0f, std::max(0.0f, (aa * xb[c] - ab * xa[c]) / det));
+		}
+		bc7_mode6_endpoints refit_best;
+		int refit_indices[16];
+		if (bc7_mode6_fit_best(block, refit, &refit_best, refit_indices) < error) {
+			best = refit_best;
+			memcpy(indices, refit_indices, sizeof(indices));
+		}
+	}
+
+	// The first index is stored without its top bit, swap the endpoints if it is set
+	if (indices[0] & 8) {
+		std::swap(best.colour[0], best.colour[1]);
+		std::swap(best.pbit[0], best.pbit[1]);
+		for (int i = 0; i < 16; i++) {
+			indices[i] = 15 - indices[i];
+		}
+	}
+
+	memset(out, 0, 16);
+	block_bits bits = { out, 0 };
+	bits.write(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		bits.write(best.colour[0][c], 7);
+		bits.write(best.colour[1][c], 7);
+	}
+	bits.write(best.pbit[0], 1);
+	bits.write(best.pbit[1], 1);
+	bits.write(indices[0], 3);
+	for (int i = 1; i < 16; i++) {
+		bits.write(indices[i], 4);
+	}
+}
+
+// Encode one RGBA level in the given block format
+void encode_compressed_level(const std::vector<unsigned char>& rgba, int width, int height, GLenum format, unsigned char* out)
+{
+	int block_bytes = compressed_block_bytes(format);
+	int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+	unsigned char block[64];
+	for (int by = 0; by < blocks_y; by++) {
+		for (int bx = 0; bx < blocks_x; bx++) {
+			fetch_block(rgba, width, height, bx, by, block);
+			unsigned char* dst = out + ((size_t)by * blocks_x + bx) * block_bytes;
+			if (format == GL_COMPRESSED_RED_RGTC1) {
+				encode_bc4_block(block, dst);
+			}
+			else if (format == GL_COMPRESSED_RG_RGTC2) {
+				encode_bc4_block(block, dst);
+				encode_bc4_block(block + 1, dst + 8);
+			}
+			else {
+				encode_bc7_block(block, dst);
+			}
+		}
+	}
+}
+
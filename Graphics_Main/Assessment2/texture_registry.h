@@ -0,0 +1,192 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <GL/gl3w.h>
+
+#include "file.h"
+
+// Loaded textures keyed by the contents of their files and how they are uploaded
+// Requests for the same files, or for different files with the same bytes, share one texture object
+struct texture_registry_entry
+{
+	// Zero while the first request for it is still loading
+	GLuint texture = 0;
+	int refs = 0;
+	std::string name;
+	size_t gpu_bytes = 0;
+	double decode_seconds = 0;
+	// Targets of duplicate requests that arrived before the texture was ready
+	std::vector<GLuint*> waiting;
+	// Targets of duplicate requests given the texture, repointed when it is replaced
+	std::vector<GLuint*> shared;
+};
+
+struct texture_registry_state
+{
+	// Claims come from loader threads, everything else from the GL thread
+	std::mutex mutex;
+	// Content hash of every file seen, so a repeated path is not read again
+	std::unordered_map<std::string, uint64_t> file_hashes;
+	std::unordered_map<uint64_t, texture_registry_entry> entries;
+
+	int requests = 0;
+	int duplicates = 0;
+	size_t saved_bytes = 0;
+	double saved_seconds = 0;
+};
+
+texture_registry_state& texture_registry()
+{
+	static texture_registry_state state;
+	return state;
+}
+
+// Key of a set of files loaded with the given options, zero if a file cannot be read
+// Safe to call from any thread
+uint64_t texture_registry_key(const std::vector<std::string>& files, uint32_t options)
+{
+	texture_registry_state& registry = texture_registry();
+	uint64_t key = 14695981039346656037ULL ^ options;
+	for (const std::string& file : files) {
+		uint64_t hash = 0;
+		bool known;
+		{
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			auto it = registry.file_hashes.find(file);
+			known = it != registry.file_hashes.end();
+			if (known)
+				hash = it->second;
+		}
+		if (!known) {
+			if (!hash_file(file.c_str(), &hash))
+				return 0;
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			registry.file_hashes[file] = hash;
+		}
+		key = (key ^ hash) * 1099511628211ULL;
+		key ^= key >> 29;
+	}
+	return key == 0 ? 1 : key;
+}
+
+// Claim a key before loading it, false if another request already has it and this one should wait for it
+// Safe to call from any thread, a zero key is never shared
+bool claim_texture(uint64_t key, const std::string& name)
+{
+	texture_registry_state& registry = texture_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.requests++;
+	if (key == 0)
+		return true;
+	auto it = registry.entries.find(key);
+	if (it != registry.entries.end()) {
+		it->second.refs++;
+		registry.duplicates++;
+		return false;
+	}
+	texture_registry_entry& entry = registry.entries[key];
+	entry.refs = 1;
+	entry.name = name;
+	return true;
+}
+
+// Point a duplicate request at the claimed texture, now or once it has loaded
+void resolve_texture(uint64_t key, GLuint* target)
+{
+	texture_registry_state& registry = texture_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	auto it = registry.entries.find(key);
+	if (it == registry.entries.end())
+		return;
+	texture_registry_entry& entry = it->second;
+	if (entry.texture) {
+		*target = entry.texture;
+		entry.shared.push_back(target);
+		registry.saved_bytes += entry.gpu_bytes;
+		registry.saved_seconds += entry.decode_seconds;
+	}
+	else {
+		entry.waiting.push_back(target);
+	}
+}
+
+// Record the texture a claim loaded and hand it to the requests waiting on it
+// A failed load (zero texture) is forgotten so a later request tries again, the waiting targets keep what they had
+void register_texture(uint64_t key, GLuint texture, size_t gpu_bytes, double decode_seconds)
+{
+	texture_registry_state& registry = texture_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	auto it = registry.entries.find(key);
+	if (it == registry.entries.end())
+		return;
+	if (texture == 0) {
+		registry.entries.erase(it);
+		return;
+	}
+	texture_registry_entry& entry = it->second;
+	entry.texture = texture;
+	entry.gpu_bytes = gpu_bytes;
+	entry.decode_seconds = decode_seconds;
+	for (GLuint* target : entry.waiting) {
+		*target = texture;
+		entry.shared.push_back(target);
+		registry.saved_bytes += gpu_bytes;
+		registry.saved_seconds += decode_seconds;
+	}
+	entry.waiting.clear();
+}
+
+// Point every duplicate of a texture at the object replacing it, the caller repoints its own target
+// Textures that did not come through the registry are left alone
+void retarget_texture(GLuint texture, GLuint replacement)
+{
+	texture_registry_state& registry = texture_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (auto& it : registry.entries) {
+		texture_registry_entry& entry = it.second;
+		if (entry.texture != texture)
+			continue;
+		entry.texture = replacement;
+		for (GLuint* target : entry.shared) {
+			*target = replacement;
+		}
+		return;
+	}
+}
+
+// Drop one reference, the texture is deleted with the last one
+// Textures that did not come through the registry are deleted straight away
+void release_texture(GLuint texture)
+{
+	texture_registry_state& registry = texture_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (auto it = registry.entries.begin(); it != registry.entries.end(); ++it) {
+		if (it->second.texture == texture) {
+			if (--it->second.refs == 0) {
+				glDeleteTextures(1, &texture);
+				registry.entries.erase(it);
+			}
+			return;
+		}
+	}
+	glDeleteTextures(1, &texture);
+}
+
+void print_texture_registry()
+{
+	texture_registry_state& registry = texture_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	printf("Texture registry: %d requests, %zu unique textures, %d shared.\n", registry.requests, registry.entries.size(), registry.duplicates);
+	if (registry.duplicates > 0)
+		printf("  saved %.1f MB of VRAM and %.1f ms of decoding.\n", registry.saved_bytes / (1024.0 * 1024.0), registry.saved_seconds * 1000.0);
+	for (const auto& it : registry.entries) {
+		if (it.second.refs > 1)
+			printf("  %s used %d times.\n", it.second.name.c_str(), it.second.refs);
+	}
+}
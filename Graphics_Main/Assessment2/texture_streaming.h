@@ -0,0 +1,352 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+
+#include "texture.h"
+
+// Keeps the baked 2D textures inside a video memory budget by streaming their mip levels
+// Textures start with only their small levels, draws report how large their textures appear on screen,
+// the texture furthest below the detail it is drawn at gains one level at a time, and the least recently
+// drawn textures lose their top level while the budget is exceeded
+// Immutable storage cannot change its levels, so a texture gaining or losing one is copied into a new object
+
+// Set to 0 to upload every texture's whole chain
+#define TEXTURE_STREAMING 1
+// Video memory the streamed textures may use, cubemaps, hand made mipmaps and material arrays are not counted
+#define TEXTURE_BUDGET_MB 16
+// Largest level a texture starts with, and the smallest it is ever evicted down to
+#define TEXTURE_STREAM_START_SIZE 256
+// Bytes of new levels copied to the GPU per frame, on top of ASSET_UPLOAD_BUDGET
+#define TEXTURE_STREAM_UPLOAD_BUDGET (2 * 1024 * 1024)
+// Frames a new level takes to fade in through GL_TEXTURE_MIN_LOD
+#define TEXTURE_STREAM_FADE_FRAMES 30
+// Levels of extra detail over one texel per pixel of the bounding sphere, which underestimates the texel density of unwrapped meshes
+#define TEXTURE_STREAM_DETAIL_BIAS 1
+
+struct streamed_texture
+{
+	std::string name;
+	// Target of the request that loaded it, duplicates are repointed through the texture registry
+	GLuint* target = nullptr;
+	texture_kind kind = TEXTURE_PLAIN;
+	// The whole chain stays in system memory, larger levels are uploaded from it when wanted
+	baked_texture baked;
+	GLuint texture = 0;
+	// Level of the chain that is level 0 of the texture
+	int top = 0;
+	// Level the texture started with, it is never evicted below this
+	int lowest = 0;
+	// Largest level the draws of the last frame it was used in asked for
+	int wanted = 0;
+	uint64_t last_used = 0;
+	// Raised when a level is added and lowered over TEXTURE_STREAM_FADE_FRAMES, so the detail fades in
+	float min_lod = 0.f;
+};
+
+// A texture part way through gaining a level
+struct texture_transition
+{
+	streamed_texture* entry = nullptr;
+	// Storage with the new level, filled over several frames
+	GLuint texture = 0;
+	int top = 0;
+	std::vector<stream_slice> slices;
+	size_t slice = 0;
+	size_t offset = 0;
+};
+
+struct texture_streaming_state
+{
+	std::vector<std::unique_ptr<streamed_texture>> textures;
+	size_t budget = (size_t)TEXTURE_BUDGET_MB * 1024 * 1024;
+	// BASE_LEVEL and MIN_LOD may not change once a bindless handle has been made from a texture
+	// Without the clamps a new level is swapped in once it has uploaded completely
+	bool clamp_levels = true;
+	// Draws are stamped with the frame, advanced by pump_texture_streaming
+	uint64_t frame = 1;
+	texture_transition transition;
+	// Replaced textures, deleted a frame later so bindless handles made from them can be released first
+	std::vector<GLuint> retired;
+	GLuint pbo = 0;
+
+	int levels_streamed = 0;
+	int levels_evicted = 0;
+};
+
+texture_streaming_state& texture_streaming()
+{
+	static texture_streaming_state state;
+	return state;
+}
+
+// Budget in bytes, and whether the sampled levels may be clamped while a level streams in
+void configure_texture_streaming(size_t budget, bool clamp_levels)
+{
+	texture_streaming_state& state = texture_streaming();
+	state.budget = budget;
+	state.clamp_levels = clamp_levels;
+}
+
+// Whether a request's texture is uploaded a few levels at a time by the streamer
+bool texture_streams_mips(const texture_request& request)
+{
+	return TEXTURE_STREAMING && (request.kind == TEXTURE_PLAIN || request.kind == TEXTURE_PBR);
+}
+
+// First level no larger than TEXTURE_STREAM_START_SIZE, or the last level
+int texture_stream_start_level(const baked_texture& baked)
+{
+	int level = 0;
+	while (level + 1 < baked.num_levels && std::max(mip_extent(baked.width, level), mip_extent(baked.height, level)) > TEXTURE_STREAM_START_SIZE) {
+		level++;
+	}
+	return level;
+}
+
+// Video memory of a chain from level top down
+size_t streamed_level_bytes(const baked_texture& baked, int top)
+{
+	return baked.data.size() - baked_level_offset(baked, top);
+}
+
+// Video memory of every streamed texture, counting the new level of one part way through a transition
+size_t texture_streaming_bytes()
+{
+	texture_streaming_state& state = texture_streaming();
+	size_t bytes = 0;
+	for (const auto& entry : state.textures) {
+		bytes += streamed_level_bytes(entry->baked, entry->top);
+	}
+	const texture_transition& transition = state.transition;
+	if (transition.entry)
+		bytes += streamed_level_bytes(transition.entry->baked, transition.top) - streamed_level_bytes(transition.entry->baked, transition.entry->top);
+	return bytes;
+}
+
+// Take over a texture the asset stream uploaded from level top of its chain down
+void stream_texture_mips(const std::string& name, GLuint* target, texture_kind kind, baked_texture&& baked, int top)
+{
+	texture_streaming_state& state = texture_streaming();
+	std::unique_ptr<streamed_texture> entry(new streamed_texture());
+	entry->name = name;
+	entry->target = target;
+	entry->kind = kind;
+	entry->baked = std::move(baked);
+	entry->texture = *target;
+	entry->top = top;
+	entry->lowest = top;
+	entry->wanted = top;
+	state.textures.push_back(std::move(entry));
+	if (state.pbo == 0)
+		glCreateBuffers(1, &state.pbo);
+}
+
+// Report that a texture is drawn covering screen_size pixels across, call from the draw functions each frame
+// Textures the streamer does not manage are ignored
+void request_texture_detail(GLuint texture, float screen_size)
+{
+	texture_streaming_state& state = texture_streaming();
+	for (const auto& entry : state.textures) {
+		if (entry->texture != texture)
+			continue;
+		// Level whose size is closest to the pixels it covers
+		float ratio = std::max(entry->baked.width, entry->baked.height) / std::max(screen_size, 1.f);
+		int level = ratio > 1.f ? (int)floorf(log2f(ratio)) : 0;
+		level = std::min(std::max(level - TEXTURE_STREAM_DETAIL_BIAS, 0), entry->lowest);
+		if (entry->last_used != state.frame) {
+			entry->last_used = state.frame;
+			entry->wanted = level;
+		}
+		else {
+			entry->wanted = std::min(entry->wanted, level);
+		}
+		return;
+	}
+}
+
+// New storage for a texture's chain from level top down, with the levels it shares with the current texture copied over
+GLuint create_streamed_storage(const streamed_texture& entry, int top)
+{
+	const baked_texture& baked = entry.baked;
+	GLuint texture;
+	glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+	glTextureStorage2D(texture, baked.num_levels - top, baked.format, mip_extent(baked.width, top), mip_extent(baked.height, top));
+	set_texture_sampling(texture, entry.kind, baked.num_levels - top, true);
+	for (int level = std::max(top, entry.top); level < baked.num_levels; level++) {
+		glCopyImageSubData(entry.texture, GL_TEXTURE_2D, level - entry.top, 0, 0, 0, texture, GL_TEXTURE_2D, level - top, 0, 0, 0,
+			mip_extent(baked.width, level), mip_extent(baked.height, level), 1);
+	}
+	return texture;
+}
+
+// Swap a texture for new storage everywhere it is used, the old one is deleted next frame
+void replace_streamed_texture(streamed_texture& entry, GLuint texture)
+{
+	texture_streaming_state& state = texture_streaming();
+	retarget_texture(entry.texture, texture);
+	*entry.target = texture;
+	state.retired.push_back(entry.texture);
+	entry.texture = texture;
+}
+
+// Drop the top level of the least recently drawn texture that has one to spare, false if none can
+// Textures drawn in the last frame only lose levels they have more of than they were drawn at
+bool evict_texture_level(const streamed_texture* keep)
+{
+	texture_streaming_state& state = texture_streaming();
+	streamed_texture* victim = nullptr;
+	for (const auto& entry : state.textures) {
+		if (entry.get() == keep || entry.get() == state.transition.entry || entry->top >= entry->lowest)
+			continue;
+		if (entry->last_used == state.frame && entry->top >= entry->wanted)
+			continue;
+		if (!victim || entry->last_used < victim->last_used)
+			victim = entry.get();
+	}
+	if (!victim)
+		return false;
+	replace_streamed_texture(*victim, create_streamed_storage(*victim, victim->top + 1));
+	victim->top++;
+	victim->min_lod = 0.f;
+	state.levels_evicted++;
+	printf("Evicted %s down to %dx%d, %.1f of %.1f MB.\n", victim->name.c_str(), mip_extent(victim->baked.width, victim->top),
+		mip_extent(victim->baked.height, victim->top), texture_streaming_bytes() / (1024.0 * 1024.0), state.budget / (1024.0 * 1024.0));
+	return true;
+}
+
+// Start adding the next level to the texture drawn furthest below the detail it wants
+// Other textures are evicted first if the level does not fit the budget
+void start_texture_transition()
+{
+	texture_streaming_state& state = texture_streaming();
+	streamed_texture* best = nullptr;
+	for (const auto& entry : state.textures) {
+		if (entry->last_used != state.frame || entry->wanted >= entry->top)
+			continue;
+		if (!best || entry->top - entry->wanted > best->top - best->wanted)
+			best = entry.get();
+	}
+	if (!best)
+		return;
+	const baked_texture& baked = best->baked;
+	size_t level_bytes = baked_level_size(baked.format, mip_extent(baked.width, best->top - 1), mip_extent(baked.height, best->top - 1));
+	if (texture_streaming_bytes() + level_bytes > state.budget) {
+		// One eviction a frame, the level is tried again next frame
+		evict_texture_level(best);
+		return;
+	}
+
+	texture_transition& transition = state.transition;
+	transition.entry = best;
+	transition.top = best->top - 1;
+	transition.texture = create_streamed_storage(*best, transition.top);
+	transition.slices.clear();
+	add_baked_slices(transition.slices, baked, transition.top, transition.top, best->top, 0);
+	transition.slice = 0;
+	transition.offset = 0;
+	if (state.clamp_levels) {
+		// Draw with the levels that were already there until the new one has uploaded
+		glTextureParameteri(transition.texture, GL_TEXTURE_BASE_LEVEL, best->top - transition.top);
+		glTextureParameterf(transition.texture, GL_TEXTURE_MIN_LOD, best->min_lod);
+		replace_streamed_texture(*best, transition.texture);
+	}
+}
+
+// Upload up to budget bytes of the new level, then let the draws sample it
+void continue_texture_transition(size_t budget)
+{
+	texture_streaming_state& state = texture_streaming();
+	texture_transition& transition = state.transition;
+	streamed_texture& entry = *transition.entry;
+	while (budget > 0 && transition.slice < transition.slices.size()) {
+		const stream_slice& slice = transition.slices[transition.slice];
+		size_t bytes = upload_slice_rows(state.pbo, transition.texture, false, entry.baked.format, baked_upload_format(entry.baked.format), slice, transition.offset, budget);
+		budget -= std::min(bytes, budget);
+		transition.offset += bytes;
+		if (transition.offset >= slice.row_bytes * slice.rows) {
+			transition.slice++;
+			transition.offset = 0;
+		}
+	}
+	if (transition.slice < transition.slices.size())
+		return;
+
+	if (state.clamp_levels) {
+		// Sampling stays at the old detail and fades to the new level
+		entry.min_lod += (float)(entry.top - transition.top);
+		glTextureParameteri(transition.texture, GL_TEXTURE_BASE_LEVEL, 0);
+		glTextureParameterf(transition.texture, GL_TEXTURE_MIN_LOD, entry.min_lod);
+	}
+	else {
+		replace_streamed_texture(entry, transition.texture);
+	}
+	entry.top = transition.top;
+	transition.entry = nullptr;
+	transition.texture = 0;
+	state.levels_streamed++;
+	printf("Streamed %s up to %dx%d, %.1f of %.1f MB.\n", entry.name.c_str(), mip_extent(entry.baked.width, entry.top),
+		mip_extent(entry.baked.height, entry.top), texture_streaming_bytes() / (1024.0 * 1024.0), state.budget / (1024.0 * 1024.0));
+}
+
+// Evict, add and fade in levels using the detail the last frame's draws asked for
+// Call once a frame on the GL thread, before drawing
+void pump_texture_streaming(size_t budget = TEXTURE_STREAM_UPLOAD_BUDGET)
+{
+	texture_streaming_state& state = texture_streaming();
+	if (!state.retired.empty()) {
+		glDeleteTextures((GLsizei)state.retired.size(), state.retired.data());
+		state.retired.clear();
+	}
+
+	for (const auto& entry : state.textures) {
+		if (entry->min_lod <= 0.f)
+			continue;
+		entry->min_lod = std::max(entry->min_lod - 1.f / TEXTURE_STREAM_FADE_FRAMES, 0.f);
+		glTextureParameterf(entry->texture, GL_TEXTURE_MIN_LOD, entry->min_lod);
+	}
+
+	if (state.transition.entry)
+		continue_texture_transition(budget);
+	else if (texture_streaming_bytes() > state.budget)
+		evict_texture_level(nullptr);
+	else
+		start_texture_transition();
+
+	// Draws from here on belong to the next frame
+	state.frame++;
+}
+
+void print_texture_streaming()
+{
+	texture_streaming_state& state = texture_streaming();
+	printf("Texture streaming: %zu textures in %.1f of %.1f MB, %d levels streamed in, %d evicted.\n", state.textures.size(),
+		texture_streaming_bytes() / (1024.0 * 1024.0), state.budget / (1024.0 * 1024.0), state.levels_streamed, state.levels_evicted);
+	for (const auto& entry : state.textures) {
+		printf("  %s %dx%d of %dx%d, wants %dx%d.\n", entry->name.c_str(), mip_extent(entry->baked.width, entry->top), mip_extent(entry->baked.height, entry->top),
+			entry->baked.width, entry->baked.height, mip_extent(entry->baked.width, entry->wanted), mip_extent(entry->baked.height, entry->wanted));
+	}
+}
+
+// Free the chains kept in system memory and the textures waiting to be deleted
+// The streamed textures themselves belong to the scene like any other
+void shutdown_texture_streaming()
+{
+	texture_streaming_state& state = texture_streaming();
+	texture_transition& transition = state.transition;
+	if (transition.entry && transition.texture != transition.entry->texture)
+		glDeleteTextures(1, &transition.texture);
+	transition = texture_transition();
+	glDeleteTextures((GLsizei)state.retired.size(), state.retired.data());
+	state.retired.clear();
+	state.textures.clear();
+	glDeleteBuffers(1, &state.pbo);
+	state.pbo = 0;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <exception>
+
+// Fixed set of worker threads pulling jobs from a shared queue
+class thread_pool
+{
+public:
+	// Zero threads means one per hardware thread
+	explicit thread_pool(unsigned num_threads = 0)
+	{
+		if (num_threads == 0) {
+			num_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		for (unsigned i = 0; i < num_threads; i++) {
+			workers.emplace_back([this] { worker_loop(); });
+		}
+	}
+
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			stopping = true;
+		}
+		queue_changed.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	unsigned size() const
+	{
+		return (unsigned)workers.size();
+	}
+
+	// Queue a job, the future becomes ready once it has run
+	std::future<void> submit(std::function<void()> job)
+	{
+		auto task = std::make_shared<std::packaged_task<void()>>(std::move(job));
+		std::future<void> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			jobs.push([task] { (*task)(); });
+		}
+		queue_changed.notify_one();
+		return result;
+	}
+
+	// Split [0, count) into batches of at least min_batch and run them across the pool
+	// Blocks until every batch is finished, then rethrows the first exception a batch threw
+	void parallel_for(size_t count, size_t min_batch, const std::function<void(size_t begin, size_t end)>& body)
+	{
+		if (count == 0)
+			return;
+
+		// A few batches per thread keeps the threads busy when batches take uneven time
+		size_t num_batches = std::min((count + min_batch - 1) / min_batch, (size_t)size() * 4);
+		if (num_batches <= 1) {
+			body(0, count);
+			return;
+		}
+
+		size_t batch_size = (count + num_batches - 1) / num_batches;
+		std::vector<std::future<void>> batches;
+		for (size_t begin = 0; begin < count; begin += batch_size) {
+			size_t end = std::min(begin + batch_size, count);
+			batches.push_back(submit([&body, begin, end] { body(begin, end); }));
+		}
+		// Wait for every batch before rethrowing, the batches still reference body
+		std::exception_ptr error;
+		for (std::future<void>& batch : batches) {
+			try {
+				batch.get();
+			}
+			catch (...) {
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	void worker_loop()
+	{
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				queue_changed.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex queue_mutex;
+	std::condition_variable queue_changed;
+	bool stopping = false;
+};
+
+// Pool shared by the loaders, created on first use
+thread_pool& worker_pool()
+{
+	static thread_pool pool;
+	return pool;
+}
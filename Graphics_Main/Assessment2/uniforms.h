@@ -0,0 +1,214 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Active uniforms of every program CompileShader links, with the last value set through the setters below
+// Locations are resolved once at link time and a value equal to the cached one is not uploaded again
+// The setters use glProgramUniform, so they work whichever program is bound
+// Every uniform of a program must go through them, a glUniform call behind their back leaves the cache stale
+
+struct shader_uniform
+{
+	std::string name;
+	GLint location;
+	GLenum type;
+	// Elements of an array uniform, one otherwise
+	GLint count;
+	// Bytes uploaded so far, empty until the first upload
+	std::vector<unsigned char> value;
+};
+
+struct program_uniforms
+{
+	std::vector<shader_uniform> uniforms;
+	// Hash of the name to its uniform, arrays are also found by their name without [0]
+	std::unordered_map<uint64_t, int> lookup;
+};
+
+// Setter calls this frame and in the last complete frame
+struct uniform_counters
+{
+	int calls = 0;
+	int uploads = 0;
+	// Names the program has no active uniform of the setter's type for, which glUniform would ignore
+	int missing = 0;
+};
+
+struct uniform_state
+{
+	std::unordered_map<GLuint, program_uniforms> programs;
+	uniform_counters frame;
+	uniform_counters last_frame;
+	uint64_t frames = 0;
+	uint64_t total_calls = 0;
+	uint64_t total_uploads = 0;
+};
+
+uniform_state& uniform_tables()
+{
+	static uniform_state state;
+	return state;
+}
+
+// FNV-1a of a name, no std::string is built per setter call
+uint64_t uniform_name_hash(const char* name, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)name[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Read a linked program's active uniforms into its table, replacing any earlier table under the same name
+// Uniforms in blocks have no location and are left out
+void reflect_uniforms(GLuint program)
+{
+	program_uniforms& table = uniform_tables().programs[program];
+	table = program_uniforms();
+	GLint num_uniforms = 0, max_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &num_uniforms);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::vector<char> name(std::max(max_length, 1));
+	for (GLint i = 0; i < num_uniforms; i++) {
+		GLsizei length = 0;
+		shader_uniform uniform;
+		glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &uniform.count, &uniform.type, name.data());
+		uniform.location = glGetUniformLocation(program, name.data());
+		if (uniform.location < 0)
+			continue;
+		uniform.name.assign(name.data(), length);
+		int index = (int)table.uniforms.size();
+		table.lookup[uniform_name_hash(uniform.name.data(), uniform.name.size())] = index;
+		if (length > 3 && strcmp(&name[length - 3], "[0]") == 0)
+			table.lookup[uniform_name_hash(uniform.name.data(), length - 3)] = index;
+		table.uniforms.push_back(uniform);
+	}
+}
+
+// Forget a deleted program's table
+void forget_uniforms(GLuint program)
+{
+	uniform_tables().programs.erase(program);
+}
+
+bool is_float_uniform(GLenum type)
+{
+	return type == GL_FLOAT || (type >= GL_FLOAT_VEC2 && type <= GL_FLOAT_VEC4) || (type >= GL_FLOAT_MAT2 && type <= GL_FLOAT_MAT4);
+}
+
+// The uniform a setter refers to, null if the program has no such active uniform or it is not of the given type
+// GL_INT stands for every type set through glUniform1i, bools and samplers included
+shader_uniform* find_uniform(GLuint program, const char* name, GLenum type)
+{
+	uniform_state& state = uniform_tables();
+	state.frame.calls++;
+	auto table = state.programs.find(program);
+	if (table != state.programs.end()) {
+		auto it = table->second.lookup.find(uniform_name_hash(name, strlen(name)));
+		if (it != table->second.lookup.end()) {
+			shader_uniform& uniform = table->second.uniforms[it->second];
+			// Names without [0] are hashed too, compare up to the array suffix
+			size_t length = strlen(name);
+			bool same_name = strncmp(uniform.name.c_str(), name, length) == 0 && (uniform.name.size() == length || uniform.name.compare(length, std::string::npos, "[0]") == 0);
+			if (same_name && (type == GL_INT ? !is_float_uniform(uniform.type) : uniform.type == type))
+				return &uniform;
+		}
+	}
+	state.frame.missing++;
+	return nullptr;
+}
+
+// Whether data differs from the start of the uniform's cached value, caching it if so
+// Setting the first elements of an array leaves the cached rest alone, as glUniform does
+bool uniform_changed(shader_uniform& uniform, const void* data, size_t bytes)
+{
+	if (uniform.value.size() >= bytes && memcmp(uniform.value.data(), data, bytes) == 0)
+		return false;
+	if (uniform.value.size() < bytes)
+		uniform.value.resize(bytes);
+	memcpy(uniform.value.data(), data, bytes);
+	uniform_tables().frame.uploads++;
+	return true;
+}
+
+// Bools and samplers are set as ints like glUniform1i
+void set_uniform(GLuint program, const char* name, int value)
+{
+	shader_uniform* uniform = find_uniform(program, name, GL_INT);
+	if (uniform && uniform_changed(*uniform, &value, sizeof(value)))
+		glProgramUniform1i(program, uniform->location, value);
+}
+
+void set_uniform(GLuint program, const char* name, bool value)
+{
+	set_uniform(program, name, value ? 1 : 0);
+}
+
+void set_uniform(GLuint program, const char* name, float value)
+{
+	shader_uniform* uniform = find_uniform(program, name, GL_FLOAT);
+	if (uniform && uniform_changed(*uniform, &value, sizeof(value)))
+		glProgramUniform1f(program, uniform->location, value);
+}
+
+void set_uniform(GLuint program, const char* name, const glm::vec3& value)
+{
+	shader_uniform* uniform = find_uniform(program, name, GL_FLOAT_VEC3);
+	if (uniform && uniform_changed(*uniform, glm::value_ptr(value), sizeof(value)))
+		glProgramUniform3fv(program, uniform->location, 1, glm::value_ptr(value));
+}
+
+void set_uniform(GLuint program, const char* name, const glm::mat4& value)
+{
+	shader_uniform* uniform = find_uniform(program, name, GL_FLOAT_MAT4);
+	if (uniform && uniform_changed(*uniform, glm::value_ptr(value), sizeof(value)))
+		glProgramUniformMatrix4fv(program, uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+// The first count elements of an array uniform
+void set_uniform_array(GLuint program, const char* name, const int* values, int count)
+{
+	shader_uniform* uniform = find_uniform(program, name, GL_INT);
+	if (uniform && uniform_changed(*uniform, values, count * sizeof(int)))
+		glProgramUniform1iv(program, uniform->location, count, values);
+}
+
+void set_uniform_array(GLuint program, const char* name, const glm::vec3* values, int count)
+{
+	shader_uniform* uniform = find_uniform(program, name, GL_FLOAT_VEC3);
+	if (uniform && uniform_changed(*uniform, values, count * sizeof(glm::vec3)))
+		glProgramUniform3fv(program, uniform->location, count, glm::value_ptr(values[0]));
+}
+
+// Close the frame's counters, call once a frame after drawing
+void end_uniform_frame()
+{
+	uniform_state& state = uniform_tables();
+	state.last_frame = state.frame;
+	state.frames++;
+	state.total_calls += state.frame.calls;
+	state.total_uploads += state.frame.uploads;
+	state.frame = uniform_counters();
+}
+
+// Setter calls against what reached the driver, each call used to be a location lookup and an upload
+void print_uniform_counters()
+{
+	uniform_state& state = uniform_tables();
+	const uniform_counters& last = state.last_frame;
+	printf("Uniforms last frame: %d setter calls, %d uploaded, %d unchanged, %d not in the program, 0 location lookups (was %d lookups and %d uploads).\n",
+		last.calls, last.uploads, last.calls - last.uploads - last.missing, last.missing, last.calls, last.calls);
+	if (state.frames > 0)
+		printf("  %.1f uploads per frame on average over %llu frames.\n", (double)state.total_uploads / state.frames, (unsigned long long)state.frames);
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+
+// Colours a packed mesh can index, its palette is copied into the render queue palette table
+#define MAX_MESH_MATERIALS 32
+
+// Float layout meshes are built in before packing: x y z, r g b, s t, nx ny nz, then tx ty tz bx by bz for normal mapped meshes
+#define MESH_VERTEX_FLOATS 17
+#define MESH_VERTEX_FLOATS_NO_TANGENT 11
+
+// 20 byte vertex replacing the MESH_VERTEX_FLOATS (68 byte) layout
+struct packed_vertex
+{
+	// Position normalized to the mesh bounds
+	uint16_t pos[3];
+	// Index into the mesh colour palette
+	uint16_t material;
+	// Half float texture coordinates
+	uint16_t tex[2];
+	// Octahedral encoded normal
+	int16_t normal[2];
+	// Octahedral encoded tangent, then the sign of the bitangent
+	int8_t tangent[2];
+	int8_t bitangent_sign;
+	int8_t padding;
+};
+
+static_assert(sizeof(packed_vertex) == 20, "packed_vertex must stay 20 bytes");
+
+// Round a float to the nearest half float
+uint16_t float_to_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (exponent <= 0) {
+		// Below the smallest normal half, keep as a denormal or flush to zero
+		if (exponent < -10)
+			return (uint16_t)sign;
+		mantissa |= 0x800000;
+		uint32_t shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			half++;
+		return (uint16_t)(sign | half);
+	}
+	if (exponent >= 31) {
+		// Too big, or already infinite or NaN
+		bool is_nan = ((bits >> 23) & 0xFF) == 0xFF && mantissa != 0;
+		return (uint16_t)(sign | 0x7C00 | (is_nan ? 0x200 : 0));
+	}
+
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+	// A carry out of the mantissa correctly rounds up into the exponent
+	if (mantissa & 0x1000)
+		half++;
+	return (uint16_t)half;
+}
+
+// Map a unit vector onto the [-1, 1] square of an octahedron
+glm::vec2 oct_encode(glm::vec3 n)
+{
+	float length = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (length == 0.f)
+		return glm::vec2(0.f);
+	n /= length;
+	if (n.z < 0.f) {
+		// Fold the lower half over the diagonals
+		return glm::vec2((1.f - fabsf(n.y)) * (n.x >= 0.f ? 1.f : -1.f), (1.f - fabsf(n.x)) * (n.y >= 0.f ? 1.f : -1.f));
+	}
+	return glm::vec2(n.x, n.y);
+}
+
+int16_t to_snorm16(float value)
+{
+	return (int16_t)roundf(glm::clamp(value, -1.f, 1.f) * 32767.f);
+}
+
+int8_t to_snorm8(float value)
+{
+	return (int8_t)roundf(glm::clamp(value, -1.f, 1.f) * 127.f);
+}
+
+// Attribute layout for packed_vertex, call with the VAO and VBO bound
+// Locations match lighting_vertex.vert, colour (1) and bitangent (5) are left disabled
+void setup_packed_vertex_attributes()
+{
+	GLsizei stride = sizeof(packed_vertex);
+	// Position attribute, dequantized in the shader
+	glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(packed_vertex, pos));
+	glEnableVertexAttribArray(0);
+	// Texture attribute
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(packed_vertex, tex));
+	glEnableVertexAttribArray(2);
+	// Normal attribute, octahedral
+	glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(packed_vertex, normal));
+	glEnableVertexAttribArray(3);
+	// Tangent attribute, octahedral plus bitangent sign
+	glVertexAttribPointer(4, 3, GL_BYTE, GL_TRUE, stride, (void*)offsetof(packed_vertex, tangent));
+	glEnableVertexAttribArray(4);
+	// Material attribute
+	glVertexAttribIPointer(6, 1, GL_UNSIGNED_SHORT, stride, (void*)offsetof(packed_vertex, material));
+	glEnableVertexAttribArray(6);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(5);
+}
+
+// Float layout of the transparent objects: position, colour with alpha, texture and normal
+#define FLOAT_VERTEX_FLOATS 12
+
+// Attribute layout for float vertices, call with the VAO and VBO bound
+void setup_float_vertex_attributes()
+{
+	GLsizei stride = FLOAT_VERTEX_FLOATS * sizeof(float);
+	// Position attribute
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	glEnableVertexAttribArray(0);
+	// Colour attribute & Transparency using Alpha val
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+	// Texture attribute
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(7 * sizeof(float)));
+	glEnableVertexAttribArray(2);
+	// Normal attribute
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)(9 * sizeof(float)));
+	glEnableVertexAttribArray(3);
+
+	glDisableVertexAttribArray(4);
+	glDisableVertexAttribArray(5);
+	glDisableVertexAttribArray(6);
+}